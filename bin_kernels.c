@@ -0,0 +1,391 @@
+#include <float.h>
+#include <math.h>
+
+#include "bin_kernels.h"
+
+// The vector kernels do the same IEEE operations in the same order as the
+// scalar ones, so all of them give the same bins. The range checks are done
+// on the unrounded coordinates, which also rejects NaN and infinite points,
+// and truncation then rounds towards zero like a cast does.
+
+#if defined (__x86_64__)
+#include <immintrin.h>
+#define X86_KERNELS
+#endif
+
+static void bin_coords_scalar (const BinScale *s, uint32_t w, uint32_t h, uint32_t pad,
+                               const double *xs, const double *ys, uint32_t n, int32_t *xis, int32_t *yis)
+{
+    double xScale = (double) (w-1);
+    double yScale = (double) (h-1);
+    double lo  = -1.0 - pad;
+    double xhi = (double) w + pad;
+    double yhi = (double) h + pad;
+
+    for (uint32_t i=0; i<n; i++)
+    {
+        double xf = xScale * (xs[i] - s->xmin) * s->invXRange;
+        double yf = yScale * (ys[i] - s->ymin) * s->invYRange;
+        if (xf > lo && xf < xhi && yf > lo && yf < yhi)
+        {
+            xis[i] = (int32_t) xf;
+            yis[i] = (int32_t) yf;
+        }
+        else
+        {
+            xis[i] = BIN_OUTSIDE;
+            yis[i] = BIN_OUTSIDE;
+        }
+    }
+}
+
+static void bin_project_scalar (double rot[3][3], double perspective, const BinScale *s, uint32_t w, uint32_t h,
+                                const double *xs, const double *ys, const double *zs, uint32_t n, int32_t *xis, int32_t *yis)
+{
+    double xScale = (double) (w-1);
+    double yScale = (double) (h-1);
+
+    for (uint32_t i=0; i<n; i++)
+    {
+        double x = xs[i];
+        double y = ys[i];
+        double z = zs[i];
+
+        double x2 = rot[0][0] * x + rot[0][1] * y + rot[0][2] * z;
+        double y2 = rot[1][0] * x + rot[1][1] * y + rot[1][2] * z;
+        double z2 = rot[2][0] * x + rot[2][1] * y + rot[2][2] * z;
+
+        double scale = z2 * perspective + 1;
+
+        xis[i] = BIN_OUTSIDE;
+        yis[i] = BIN_OUTSIDE;
+        if (scale < 0 || !isfinite (z2))
+            continue;
+
+        x2 /= scale;
+        y2 /= scale;
+
+        double xf = xScale * (x2 - s->xmin) * s->invXRange;
+        double yf = yScale * (y2 - s->ymin) * s->invYRange;
+        if (xf > -1 && xf < w && yf > -1 && yf < h)
+        {
+            xis[i] = (int32_t) xf;
+            yis[i] = (int32_t) yf;
+        }
+    }
+}
+
+typedef void (*BinCoordsFun) (const BinScale *s, uint32_t w, uint32_t h, uint32_t pad,
+                              const double *xs, const double *ys, uint32_t n, int32_t *xis, int32_t *yis);
+typedef void (*BinProjectFun) (double rot[3][3], double perspective, const BinScale *s, uint32_t w, uint32_t h,
+                               const double *xs, const double *ys, const double *zs, uint32_t n, int32_t *xis, int32_t *yis);
+
+#ifdef X86_KERNELS
+
+// SSE2 is part of x86-64, no need to check for it
+static void bin_coords_sse2 (const BinScale *s, uint32_t w, uint32_t h, uint32_t pad,
+                             const double *xs, const double *ys, uint32_t n, int32_t *xis, int32_t *yis)
+{
+    __m128d xmin    = _mm_set1_pd (s->xmin);
+    __m128d ymin    = _mm_set1_pd (s->ymin);
+    __m128d xScale  = _mm_set1_pd ((double) (w-1));
+    __m128d yScale  = _mm_set1_pd ((double) (h-1));
+    __m128d invX    = _mm_set1_pd (s->invXRange);
+    __m128d invY    = _mm_set1_pd (s->invYRange);
+    __m128d lo      = _mm_set1_pd (-1.0 - pad);
+    __m128d xhi     = _mm_set1_pd ((double) w + pad);
+    __m128d yhi     = _mm_set1_pd ((double) h + pad);
+    __m128d outside = _mm_set1_pd ((double) BIN_OUTSIDE);
+
+    uint32_t i = 0;
+    for (; i+2<=n; i+=2)
+    {
+        __m128d xf = _mm_mul_pd (_mm_mul_pd (xScale, _mm_sub_pd (_mm_loadu_pd (xs+i), xmin)), invX);
+        __m128d yf = _mm_mul_pd (_mm_mul_pd (yScale, _mm_sub_pd (_mm_loadu_pd (ys+i), ymin)), invY);
+
+        __m128d in = _mm_and_pd (_mm_and_pd (_mm_cmpgt_pd (xf, lo), _mm_cmplt_pd (xf, xhi)),
+                                 _mm_and_pd (_mm_cmpgt_pd (yf, lo), _mm_cmplt_pd (yf, yhi)));
+        xf = _mm_or_pd (_mm_and_pd (in, xf), _mm_andnot_pd (in, outside));
+        yf = _mm_or_pd (_mm_and_pd (in, yf), _mm_andnot_pd (in, outside));
+
+        _mm_storel_epi64 ((__m128i *) (xis+i), _mm_cvttpd_epi32 (xf));
+        _mm_storel_epi64 ((__m128i *) (yis+i), _mm_cvttpd_epi32 (yf));
+    }
+    bin_coords_scalar (s, w, h, pad, xs+i, ys+i, n-i, xis+i, yis+i);
+}
+
+static void bin_project_sse2 (double rot[3][3], double perspective, const BinScale *s, uint32_t w, uint32_t h,
+                              const double *xs, const double *ys, const double *zs, uint32_t n, int32_t *xis, int32_t *yis)
+{
+    __m128d r[3][3];
+    for (int j=0; j<3; j++)
+        for (int k=0; k<3; k++)
+            r[j][k] = _mm_set1_pd (rot[j][k]);
+
+    __m128d persp     = _mm_set1_pd (perspective);
+    __m128d one       = _mm_set1_pd (1.0);
+    __m128d zero      = _mm_setzero_pd ();
+    __m128d signBit   = _mm_set1_pd (-0.0);
+    __m128d maxFinite = _mm_set1_pd (DBL_MAX);
+    __m128d xmin      = _mm_set1_pd (s->xmin);
+    __m128d ymin      = _mm_set1_pd (s->ymin);
+    __m128d xScale    = _mm_set1_pd ((double) (w-1));
+    __m128d yScale    = _mm_set1_pd ((double) (h-1));
+    __m128d invX      = _mm_set1_pd (s->invXRange);
+    __m128d invY      = _mm_set1_pd (s->invYRange);
+    __m128d lo        = _mm_set1_pd (-1.0);
+    __m128d xhi       = _mm_set1_pd ((double) w);
+    __m128d yhi       = _mm_set1_pd ((double) h);
+    __m128d outside   = _mm_set1_pd ((double) BIN_OUTSIDE);
+
+    uint32_t i = 0;
+    for (; i+2<=n; i+=2)
+    {
+        __m128d x = _mm_loadu_pd (xs+i);
+        __m128d y = _mm_loadu_pd (ys+i);
+        __m128d z = _mm_loadu_pd (zs+i);
+
+        __m128d x2 = _mm_add_pd (_mm_add_pd (_mm_mul_pd (r[0][0], x), _mm_mul_pd (r[0][1], y)), _mm_mul_pd (r[0][2], z));
+        __m128d y2 = _mm_add_pd (_mm_add_pd (_mm_mul_pd (r[1][0], x), _mm_mul_pd (r[1][1], y)), _mm_mul_pd (r[1][2], z));
+        __m128d z2 = _mm_add_pd (_mm_add_pd (_mm_mul_pd (r[2][0], x), _mm_mul_pd (r[2][1], y)), _mm_mul_pd (r[2][2], z));
+
+        __m128d scale = _mm_add_pd (_mm_mul_pd (z2, persp), one);
+        __m128d front = _mm_and_pd (_mm_cmpnlt_pd (scale, zero), _mm_cmple_pd (_mm_andnot_pd (signBit, z2), maxFinite));
+        x2 = _mm_div_pd (x2, scale);
+        y2 = _mm_div_pd (y2, scale);
+
+        __m128d xf = _mm_mul_pd (_mm_mul_pd (xScale, _mm_sub_pd (x2, xmin)), invX);
+        __m128d yf = _mm_mul_pd (_mm_mul_pd (yScale, _mm_sub_pd (y2, ymin)), invY);
+
+        __m128d in = _mm_and_pd (_mm_and_pd (_mm_cmpgt_pd (xf, lo), _mm_cmplt_pd (xf, xhi)),
+                                 _mm_and_pd (_mm_cmpgt_pd (yf, lo), _mm_cmplt_pd (yf, yhi)));
+        in = _mm_and_pd (in, front);
+        xf = _mm_or_pd (_mm_and_pd (in, xf), _mm_andnot_pd (in, outside));
+        yf = _mm_or_pd (_mm_and_pd (in, yf), _mm_andnot_pd (in, outside));
+
+        _mm_storel_epi64 ((__m128i *) (xis+i), _mm_cvttpd_epi32 (xf));
+        _mm_storel_epi64 ((__m128i *) (yis+i), _mm_cvttpd_epi32 (yf));
+    }
+    bin_project_scalar (rot, perspective, s, w, h, xs+i, ys+i, zs+i, n-i, xis+i, yis+i);
+}
+
+__attribute__ ((target ("avx2")))
+static void bin_coords_avx2 (const BinScale *s, uint32_t w, uint32_t h, uint32_t pad,
+                             const double *xs, const double *ys, uint32_t n, int32_t *xis, int32_t *yis)
+{
+    __m256d xmin    = _mm256_set1_pd (s->xmin);
+    __m256d ymin    = _mm256_set1_pd (s->ymin);
+    __m256d xScale  = _mm256_set1_pd ((double) (w-1));
+    __m256d yScale  = _mm256_set1_pd ((double) (h-1));
+    __m256d invX    = _mm256_set1_pd (s->invXRange);
+    __m256d invY    = _mm256_set1_pd (s->invYRange);
+    __m256d lo      = _mm256_set1_pd (-1.0 - pad);
+    __m256d xhi     = _mm256_set1_pd ((double) w + pad);
+    __m256d yhi     = _mm256_set1_pd ((double) h + pad);
+    __m256d outside = _mm256_set1_pd ((double) BIN_OUTSIDE);
+
+    uint32_t i = 0;
+    for (; i+4<=n; i+=4)
+    {
+        __m256d xf = _mm256_mul_pd (_mm256_mul_pd (xScale, _mm256_sub_pd (_mm256_loadu_pd (xs+i), xmin)), invX);
+        __m256d yf = _mm256_mul_pd (_mm256_mul_pd (yScale, _mm256_sub_pd (_mm256_loadu_pd (ys+i), ymin)), invY);
+
+        __m256d in = _mm256_and_pd (_mm256_and_pd (_mm256_cmp_pd (xf, lo, _CMP_GT_OQ), _mm256_cmp_pd (xf, xhi, _CMP_LT_OQ)),
+                                    _mm256_and_pd (_mm256_cmp_pd (yf, lo, _CMP_GT_OQ), _mm256_cmp_pd (yf, yhi, _CMP_LT_OQ)));
+        xf = _mm256_blendv_pd (outside, xf, in);
+        yf = _mm256_blendv_pd (outside, yf, in);
+
+        _mm_storeu_si128 ((__m128i *) (xis+i), _mm256_cvttpd_epi32 (xf));
+        _mm_storeu_si128 ((__m128i *) (yis+i), _mm256_cvttpd_epi32 (yf));
+    }
+    bin_coords_sse2 (s, w, h, pad, xs+i, ys+i, n-i, xis+i, yis+i);
+}
+
+__attribute__ ((target ("avx2")))
+static void bin_project_avx2 (double rot[3][3], double perspective, const BinScale *s, uint32_t w, uint32_t h,
+                              const double *xs, const double *ys, const double *zs, uint32_t n, int32_t *xis, int32_t *yis)
+{
+    __m256d r[3][3];
+    for (int j=0; j<3; j++)
+        for (int k=0; k<3; k++)
+            r[j][k] = _mm256_set1_pd (rot[j][k]);
+
+    __m256d persp     = _mm256_set1_pd (perspective);
+    __m256d one       = _mm256_set1_pd (1.0);
+    __m256d zero      = _mm256_setzero_pd ();
+    __m256d signBit   = _mm256_set1_pd (-0.0);
+    __m256d maxFinite = _mm256_set1_pd (DBL_MAX);
+    __m256d xmin      = _mm256_set1_pd (s->xmin);
+    __m256d ymin      = _mm256_set1_pd (s->ymin);
+    __m256d xScale    = _mm256_set1_pd ((double) (w-1));
+    __m256d yScale    = _mm256_set1_pd ((double) (h-1));
+    __m256d invX      = _mm256_set1_pd (s->invXRange);
+    __m256d invY      = _mm256_set1_pd (s->invYRange);
+    __m256d lo        = _mm256_set1_pd (-1.0);
+    __m256d xhi       = _mm256_set1_pd ((double) w);
+    __m256d yhi       = _mm256_set1_pd ((double) h);
+    __m256d outside   = _mm256_set1_pd ((double) BIN_OUTSIDE);
+
+    uint32_t i = 0;
+    for (; i+4<=n; i+=4)
+    {
+        __m256d x = _mm256_loadu_pd (xs+i);
+        __m256d y = _mm256_loadu_pd (ys+i);
+        __m256d z = _mm256_loadu_pd (zs+i);
+
+        __m256d x2 = _mm256_add_pd (_mm256_add_pd (_mm256_mul_pd (r[0][0], x), _mm256_mul_pd (r[0][1], y)), _mm256_mul_pd (r[0][2], z));
+        __m256d y2 = _mm256_add_pd (_mm256_add_pd (_mm256_mul_pd (r[1][0], x), _mm256_mul_pd (r[1][1], y)), _mm256_mul_pd (r[1][2], z));
+        __m256d z2 = _mm256_add_pd (_mm256_add_pd (_mm256_mul_pd (r[2][0], x), _mm256_mul_pd (r[2][1], y)), _mm256_mul_pd (r[2][2], z));
+
+        __m256d scale = _mm256_add_pd (_mm256_mul_pd (z2, persp), one);
+        __m256d front = _mm256_and_pd (_mm256_cmp_pd (scale, zero, _CMP_NLT_UQ),
+                                       _mm256_cmp_pd (_mm256_andnot_pd (signBit, z2), maxFinite, _CMP_LE_OQ));
+        x2 = _mm256_div_pd (x2, scale);
+        y2 = _mm256_div_pd (y2, scale);
+
+        __m256d xf = _mm256_mul_pd (_mm256_mul_pd (xScale, _mm256_sub_pd (x2, xmin)), invX);
+        __m256d yf = _mm256_mul_pd (_mm256_mul_pd (yScale, _mm256_sub_pd (y2, ymin)), invY);
+
+        __m256d in = _mm256_and_pd (_mm256_and_pd (_mm256_cmp_pd (xf, lo, _CMP_GT_OQ), _mm256_cmp_pd (xf, xhi, _CMP_LT_OQ)),
+                                    _mm256_and_pd (_mm256_cmp_pd (yf, lo, _CMP_GT_OQ), _mm256_cmp_pd (yf, yhi, _CMP_LT_OQ)));
+        in = _mm256_and_pd (in, front);
+        xf = _mm256_blendv_pd (outside, xf, in);
+        yf = _mm256_blendv_pd (outside, yf, in);
+
+        _mm_storeu_si128 ((__m128i *) (xis+i), _mm256_cvttpd_epi32 (xf));
+        _mm_storeu_si128 ((__m128i *) (yis+i), _mm256_cvttpd_epi32 (yf));
+    }
+    bin_project_sse2 (rot, perspective, s, w, h, xs+i, ys+i, zs+i, n-i, xis+i, yis+i);
+}
+
+__attribute__ ((target ("avx512f")))
+static void bin_coords_avx512 (const BinScale *s, uint32_t w, uint32_t h, uint32_t pad,
+                               const double *xs, const double *ys, uint32_t n, int32_t *xis, int32_t *yis)
+{
+    __m512d xmin    = _mm512_set1_pd (s->xmin);
+    __m512d ymin    = _mm512_set1_pd (s->ymin);
+    __m512d xScale  = _mm512_set1_pd ((double) (w-1));
+    __m512d yScale  = _mm512_set1_pd ((double) (h-1));
+    __m512d invX    = _mm512_set1_pd (s->invXRange);
+    __m512d invY    = _mm512_set1_pd (s->invYRange);
+    __m512d lo      = _mm512_set1_pd (-1.0 - pad);
+    __m512d xhi     = _mm512_set1_pd ((double) w + pad);
+    __m512d yhi     = _mm512_set1_pd ((double) h + pad);
+    __m512d outside = _mm512_set1_pd ((double) BIN_OUTSIDE);
+
+    uint32_t i = 0;
+    for (; i+8<=n; i+=8)
+    {
+        __m512d xf = _mm512_mul_pd (_mm512_mul_pd (xScale, _mm512_sub_pd (_mm512_loadu_pd (xs+i), xmin)), invX);
+        __m512d yf = _mm512_mul_pd (_mm512_mul_pd (yScale, _mm512_sub_pd (_mm512_loadu_pd (ys+i), ymin)), invY);
+
+        __mmask8 in = _mm512_cmp_pd_mask (xf, lo, _CMP_GT_OQ) & _mm512_cmp_pd_mask (xf, xhi, _CMP_LT_OQ) &
+                      _mm512_cmp_pd_mask (yf, lo, _CMP_GT_OQ) & _mm512_cmp_pd_mask (yf, yhi, _CMP_LT_OQ);
+        xf = _mm512_mask_blend_pd (in, outside, xf);
+        yf = _mm512_mask_blend_pd (in, outside, yf);
+
+        _mm256_storeu_si256 ((__m256i *) (xis+i), _mm512_cvttpd_epi32 (xf));
+        _mm256_storeu_si256 ((__m256i *) (yis+i), _mm512_cvttpd_epi32 (yf));
+    }
+    bin_coords_sse2 (s, w, h, pad, xs+i, ys+i, n-i, xis+i, yis+i);
+}
+
+__attribute__ ((target ("avx512f")))
+static void bin_project_avx512 (double rot[3][3], double perspective, const BinScale *s, uint32_t w, uint32_t h,
+                                const double *xs, const double *ys, const double *zs, uint32_t n, int32_t *xis, int32_t *yis)
+{
+    __m512d r[3][3];
+    for (int j=0; j<3; j++)
+        for (int k=0; k<3; k++)
+            r[j][k] = _mm512_set1_pd (rot[j][k]);
+
+    __m512d persp     = _mm512_set1_pd (perspective);
+    __m512d one       = _mm512_set1_pd (1.0);
+    __m512d zero      = _mm512_setzero_pd ();
+    __m512d maxFinite = _mm512_set1_pd (DBL_MAX);
+    __m512d xmin      = _mm512_set1_pd (s->xmin);
+    __m512d ymin      = _mm512_set1_pd (s->ymin);
+    __m512d xScale    = _mm512_set1_pd ((double) (w-1));
+    __m512d yScale    = _mm512_set1_pd ((double) (h-1));
+    __m512d invX      = _mm512_set1_pd (s->invXRange);
+    __m512d invY      = _mm512_set1_pd (s->invYRange);
+    __m512d lo        = _mm512_set1_pd (-1.0);
+    __m512d xhi       = _mm512_set1_pd ((double) w);
+    __m512d yhi       = _mm512_set1_pd ((double) h);
+    __m512d outside   = _mm512_set1_pd ((double) BIN_OUTSIDE);
+
+    uint32_t i = 0;
+    for (; i+8<=n; i+=8)
+    {
+        __m512d x = _mm512_loadu_pd (xs+i);
+        __m512d y = _mm512_loadu_pd (ys+i);
+        __m512d z = _mm512_loadu_pd (zs+i);
+
+        __m512d x2 = _mm512_add_pd (_mm512_add_pd (_mm512_mul_pd (r[0][0], x), _mm512_mul_pd (r[0][1], y)), _mm512_mul_pd (r[0][2], z));
+        __m512d y2 = _mm512_add_pd (_mm512_add_pd (_mm512_mul_pd (r[1][0], x), _mm512_mul_pd (r[1][1], y)), _mm512_mul_pd (r[1][2], z));
+        __m512d z2 = _mm512_add_pd (_mm512_add_pd (_mm512_mul_pd (r[2][0], x), _mm512_mul_pd (r[2][1], y)), _mm512_mul_pd (r[2][2], z));
+
+        __m512d scale = _mm512_add_pd (_mm512_mul_pd (z2, persp), one);
+        __mmask8 front = _mm512_cmp_pd_mask (scale, zero, _CMP_NLT_UQ) &
+                         _mm512_cmp_pd_mask (_mm512_abs_pd (z2), maxFinite, _CMP_LE_OQ);
+        x2 = _mm512_div_pd (x2, scale);
+        y2 = _mm512_div_pd (y2, scale);
+
+        __m512d xf = _mm512_mul_pd (_mm512_mul_pd (xScale, _mm512_sub_pd (x2, xmin)), invX);
+        __m512d yf = _mm512_mul_pd (_mm512_mul_pd (yScale, _mm512_sub_pd (y2, ymin)), invY);
+
+        __mmask8 in = front &
+                      _mm512_cmp_pd_mask (xf, lo, _CMP_GT_OQ) & _mm512_cmp_pd_mask (xf, xhi, _CMP_LT_OQ) &
+                      _mm512_cmp_pd_mask (yf, lo, _CMP_GT_OQ) & _mm512_cmp_pd_mask (yf, yhi, _CMP_LT_OQ);
+        xf = _mm512_mask_blend_pd (in, outside, xf);
+        yf = _mm512_mask_blend_pd (in, outside, yf);
+
+        _mm256_storeu_si256 ((__m256i *) (xis+i), _mm512_cvttpd_epi32 (xf));
+        _mm256_storeu_si256 ((__m256i *) (yis+i), _mm512_cvttpd_epi32 (yf));
+    }
+    bin_project_sse2 (rot, perspective, s, w, h, xs+i, ys+i, zs+i, n-i, xis+i, yis+i);
+}
+
+static BinCoordsFun  coordsFun   = bin_coords_sse2;
+static BinProjectFun projectFun  = bin_project_sse2;
+static const char   *kernelsName = "sse2";
+
+#else
+
+static BinCoordsFun  coordsFun   = bin_coords_scalar;
+static BinProjectFun projectFun  = bin_project_scalar;
+static const char   *kernelsName = "scalar";
+
+#endif
+
+void bin_coords (const BinScale *s, uint32_t w, uint32_t h, uint32_t pad,
+                 const double *xs, const double *ys, uint32_t n, int32_t *xis, int32_t *yis)
+{
+    coordsFun (s, w, h, pad, xs, ys, n, xis, yis);
+}
+
+void bin_project (double rot[3][3], double perspective, const BinScale *s, uint32_t w, uint32_t h,
+                  const double *xs, const double *ys, const double *zs, uint32_t n, int32_t *xis, int32_t *yis)
+{
+    projectFun (rot, perspective, s, w, h, xs, ys, zs, n, xis, yis);
+}
+
+const char *bin_kernels_init (void)
+{
+#ifdef X86_KERNELS
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx512f"))
+    {
+        coordsFun   = bin_coords_avx512;
+        projectFun  = bin_project_avx512;
+        kernelsName = "avx512";
+    }
+    else if (__builtin_cpu_supports ("avx2"))
+    {
+        coordsFun   = bin_coords_avx2;
+        projectFun  = bin_project_avx2;
+        kernelsName = "avx2";
+    }
+#endif
+    return kernelsName;
+}
@@ -0,0 +1,41 @@
+#ifndef _BIN_KERNELS_H_
+#define _BIN_KERNELS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+
+// bin coordinate of the points that are not binned
+#define BIN_OUTSIDE INT32_MIN
+
+// maps data coordinates to bin coordinates of a histogram
+typedef struct BinScale
+{
+    double xmin;
+    double ymin;
+    double invXRange;
+    double invYRange;
+} BinScale;
+
+// Bin coordinates of n points on a w by h grid, x truncated from
+// (w-1) * (x - xmin) * invXRange and y likewise. Points further than pad
+// bins outside of the grid, and NaN or infinite ones, get BIN_OUTSIDE.
+void bin_coords (const BinScale *s, uint32_t w, uint32_t h, uint32_t pad,
+                 const double *xs, const double *ys, uint32_t n, int32_t *xis, int32_t *yis);
+
+// Same for 3D points, rotated by rot and projected with the given
+// perspective. Points behind the eye get BIN_OUTSIDE too.
+void bin_project (double rot[3][3], double perspective, const BinScale *s, uint32_t w, uint32_t h,
+                  const double *xs, const double *ys, const double *zs, uint32_t n, int32_t *xis, int32_t *yis);
+
+// Picks the widest kernels the CPU supports, returns their name. Until
+// called, the kernels of the baseline instruction set are used.
+const char *bin_kernels_init (void);
+
+#ifdef __cplusplus
+} /* end extern C */
+#endif
+
+#endif /* _BIN_KERNELS_H_ */
@@ -3,11 +3,14 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 #include <stdatomic.h>
+#include <sched.h>
 #include <sys/stat.h>
 
 #include "cinterplot.h"
 #include "font.c"
 #include "oklab.h"
+#include "bin_kernels.h"
+#include "fft.h"
 #include "savepng.h"
 #include "macos_icon.h"
 
@@ -38,6 +41,7 @@ typedef struct CipState
     uint32_t margin : 8;
     uint32_t showHelp : 1;
     uint32_t stopped : 1;
+    uint32_t asyncHistograms : 1;
 
     int (*app_on_keyboard) (CipState *cs, int key, int mod, int pressed, int repeat);
     int (*app_on_mouse_motion) (CipState *cs, int windowIndex, double x, double y);
@@ -61,8 +65,20 @@ typedef struct CipState
     uint32_t windowHeight;
 
     uint32_t graphOrder;
+    uint32_t numThreads;
     int frameCounter;
     int pressedModifiers;
+    double lastInputTsp;      // time of the last input event that asked for a redraw
+    double frameBudget;       // seconds of histogram work per frame, 0 builds each histogram in one go
+
+    int *scratchBins;         // histogram shown instead of the one of an attacher, see plot_data
+    uint32_t scratchLen;
+
+    pthread_t builderThread;  // see cip_set_async_histograms
+    atomic_int building;      // the builder thread is going through the attachers
+    atomic_int builderHeld;   // it is not to start going through them, see cinterplot_wait
+    atomic_int published;     // it has finished a histogram since the last frame
+    atomic_int builderQuit;
 
     int  (*on_mouse_pressed)  (struct CipState *cs, int xi, int yi, int button, int clicks);
     int  (*on_mouse_released) (struct CipState *cs, int xi, int yi);
@@ -118,6 +134,9 @@ static volatile int iconWb = 0;
 
 static uint64_t make_histogram_2d (CipHistogram *hist, CipGraph *graph, uint32_t logMode, char plotType, uint64_t lastGraphCounter);
 static uint64_t make_histogram_3d (CipHistogram *hist, CipGraph *graph, uint32_t logMode, char plotType, uint64_t lastGraphCounter);
+static uint64_t make_histogram_rows (CipHistogram *hist, CipGraph *graph, uint32_t logMode, char plotType, uint64_t lastGraphCounter);
+static int spectrum_update (CipGraph *graph, int parallel);
+static void free_spectrum (CipGraph *graph);
 
 //static void *safe_malloc (size_t size)
 //{
@@ -188,15 +207,177 @@ static double get_time (void)
     return timestamp;
 }
 
+static inline void cpu_relax (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause ();
+#elif defined(__aarch64__)
+    __asm__ __volatile__ ("yield");
+#endif
+}
+
+#define ACCESS_SPIN_COUNT 64
+
+// Spins for a short while, then backs off to the scheduler so that
+// contending producers don't starve the one holding the flag.
 void wait_for_access (atomic_flag* accessFlag)
 {
-    while (atomic_flag_test_and_set(accessFlag))
-        continue;
+    uint32_t spins = 0;
+    while (atomic_flag_test_and_set_explicit (accessFlag, memory_order_acquire))
+    {
+        if (spins++ < ACCESS_SPIN_COUNT)
+            cpu_relax ();
+        else
+            sched_yield ();
+    }
+}
+
+static int try_access (atomic_flag* accessFlag)
+{
+    return !atomic_flag_test_and_set_explicit (accessFlag, memory_order_acquire);
 }
 
 void release_access (atomic_flag* accessFlag)
 {
-    atomic_flag_clear (accessFlag);
+    atomic_flag_clear_explicit (accessFlag, memory_order_release);
+}
+
+// Producers only need to serialise against each other. A graph fed by a
+// single thread skips the lock altogether, the stream buffer publishes new
+// items to the readers by itself.
+// Staged batches are also published by the render loop, so staging graphs
+// always take the lock.
+static void wait_for_insert_access (CipGraph *graph)
+{
+    if (!graph->singleProducer || graph->staging)
+        wait_for_access (& graph->insertAccess);
+}
+
+static void release_insert_access (CipGraph *graph)
+{
+    if (!graph->singleProducer || graph->staging)
+        release_access (& graph->insertAccess);
+}
+
+// Worker threads splitting the histogram passes of the render thread. The
+// calling thread is worker 0 and takes tasks too, parallel_for returns once
+// all tasks are done.
+#define MAX_WORKER_THREADS 64
+
+typedef void (*ParallelFun) (void *arg, uint32_t task, uint32_t worker);
+
+typedef struct WorkerPool
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t  wake;
+    pthread_cond_t  done;
+    pthread_t threads[MAX_WORKER_THREADS];
+    uint32_t nThreads;       // including the calling thread
+    uint32_t quit;
+    uint64_t job;
+    ParallelFun fun;
+    void *arg;
+    uint32_t nTasks;
+    atomic_uint nextTask;
+    uint32_t nPending;       // workers that have not finished the job yet
+} WorkerPool;
+
+static WorkerPool workerPool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, .nThreads = 1};
+
+static void worker_pool_run_tasks (WorkerPool *pool, uint32_t worker)
+{
+    uint32_t task;
+    while ((task = atomic_fetch_add (& pool->nextTask, 1)) < pool->nTasks)
+        pool->fun (pool->arg, task, worker);
+}
+
+static void *worker_pool_main (void *arg)
+{
+    WorkerPool *pool = & workerPool;
+    uint32_t worker = (uint32_t) (uintptr_t) arg;
+    uint64_t job = 0;
+
+    pthread_mutex_lock (& pool->mutex);
+    for (;;)
+    {
+        while (!pool->quit && pool->job == job)
+            pthread_cond_wait (& pool->wake, & pool->mutex);
+        if (pool->quit)
+            break;
+
+        job = pool->job;
+        pthread_mutex_unlock (& pool->mutex);
+        worker_pool_run_tasks (pool, worker);
+        pthread_mutex_lock (& pool->mutex);
+
+        if (--pool->nPending == 0)
+            pthread_cond_signal (& pool->done);
+    }
+    pthread_mutex_unlock (& pool->mutex);
+    return NULL;
+}
+
+static void worker_pool_stop (void)
+{
+    WorkerPool *pool = & workerPool;
+
+    pthread_mutex_lock (& pool->mutex);
+    pool->quit = 1;
+    pthread_cond_broadcast (& pool->wake);
+    pthread_mutex_unlock (& pool->mutex);
+
+    for (uint32_t i=1; i<pool->nThreads; i++)
+        pthread_join (pool->threads[i], NULL);
+
+    pool->quit = 0;
+    pool->nThreads = 1;
+}
+
+// not to be called while a parallel_for is running
+static void worker_pool_start (uint32_t nThreads)
+{
+    WorkerPool *pool = & workerPool;
+    worker_pool_stop ();
+
+    nThreads = MAX (1, MIN (nThreads, MAX_WORKER_THREADS));
+    for (uint32_t i=1; i<nThreads; i++)
+    {
+        if (pthread_create (& pool->threads[i], NULL, worker_pool_main, (void *) (uintptr_t) i))
+        {
+            print_warning ("could only start %u worker threads", i);
+            nThreads = i;
+            break;
+        }
+    }
+    pool->nThreads = nThreads;
+}
+
+static void parallel_for (uint32_t nTasks, ParallelFun fun, void *arg)
+{
+    WorkerPool *pool = & workerPool;
+    if (pool->nThreads == 1 || nTasks == 1)
+    {
+        for (uint32_t task=0; task<nTasks; task++)
+            fun (arg, task, 0);
+        return;
+    }
+
+    pthread_mutex_lock (& pool->mutex);
+    pool->fun      = fun;
+    pool->arg      = arg;
+    pool->nTasks   = nTasks;
+    pool->nPending = pool->nThreads - 1;
+    atomic_store (& pool->nextTask, 0);
+    pool->job++;
+    pthread_cond_broadcast (& pool->wake);
+    pthread_mutex_unlock (& pool->mutex);
+
+    worker_pool_run_tasks (pool, 0);
+
+    pthread_mutex_lock (& pool->mutex);
+    while (pool->nPending)
+        pthread_cond_wait (& pool->done, & pool->mutex);
+    pthread_mutex_unlock (& pool->mutex);
 }
 
 
@@ -441,1814 +622,4444 @@ double (*rotMatrix)[3][3]; // FIXME: should not be needed
 double perspectiveFactor = 0.15;
 
 
-static void cycle_graph_order (CipState *cs)
-{
-    cs->graphOrder++;
-    //print_debug ("graph order %u", cs->graphOrder);
-}
+#define GRAPH_BLOCK_LEN 1024
 
-int cip_autoscale_sw (CipSubWindow *sw)
+// Reader side view of a graph: a snapshot of its stream buffer restricted to
+// the last graph->len points, with the x, y (and z) fields located in
+// whichever layout the graph stores them. Readers copy the axes they need
+// block by block into plain double arrays with graph_view_fetch. An open view
+// keeps the reader in the epoch of the stream buffer instead of locking the
+// graph, producers resetting it don't wait for the view to be closed.
+typedef struct GraphView
 {
-    if (!sw)
-        return 0;
+    CipGraph *graph;
+    int reader;
+    StreamBufferSnapshot snap;
+    uint32_t len;
+    uint32_t first;          // snapshot index of the first point in view
+    uint64_t counter;
+    uint64_t firstCounter;   // counter of the first point in view
+    uint32_t axisColumn[3];  // stream buffer column holding the axis
+    size_t axisOffset[3];    // offset of the axis within a field of its column
+    size_t axisStride[3];
+    const struct LogColumn *logColumns[2]; // cached log of x and y, see graph_view_use_log
+    uint32_t logLocked;
+} GraphView;
+
+static uint32_t graph_view_open (CipGraph *graph, GraphView *view)
+{
+    StreamBuffer *sb = graph->sb;
+    view->reader = stream_buffer_read_begin (sb);
+    stream_buffer_get_snapshot (sb, & view->snap);
 
-    double xmin =  DBL_MAX;
-    double xmax = -DBL_MAX;
-    double ymin =  DBL_MAX;
-    double ymax = -DBL_MAX;
+    view->graph   = graph;
+    view->len     = view->snap.len;
+    view->first   = 0;
+    view->counter = view->snap.counter;
 
-    GraphAttacher **ag = sw->attachedGraphs;
-    for (int i=0; i<sw->numAttachedGraphs; i++)
-    {
-        CipGraph *graph = ag[i]->graph;
-        wait_for_access (& graph->readAccess);
-        wait_for_access (& graph->insertAccess);
+    view->logColumns[0] = NULL;
+    view->logColumns[1] = NULL;
+    view->logLocked     = 0;
 
-        int is3d = graph->sb->itemSize == sizeof (double) * 3;
+    if (graph->len && graph->len < view->len)
+    {
+        view->first = view->len - graph->len;
+        view->len = graph->len;
+    }
+    view->firstCounter = view->counter - view->len + 1;
 
-        if (is3d)
+    // x is not stored for implicit x graphs, the first column holds y
+    uint32_t a0 = graph->implicitX;
+    for (uint32_t a=a0; a<graph->dim; a++)
+    {
+        if (graph->columnar)
         {
-            double (*xyzs)[3];
-            uint32_t len;
-            stream_buffer_get (graph->sb, & xyzs, & len);
-
-            int firstIdx = (int) (graph->len && len > graph->len) ? len - graph->len : 0;
-            for (uint32_t i=firstIdx; i<len; i++)
-            {
-                double xyz[3];
-                matrix_vector_multiply (*rotMatrix, xyzs[i], xyz);
-
-                double x2 = xyz[0];
-                double y2 = xyz[1];
-                double z2 = xyz[2];
-
-                double scale = z2 * perspectiveFactor + 1;
-
-                if (scale < 0)
-                    continue;
-
-                x2 /= scale;
-                y2 /= scale;
-
-
-                if (isnan (x2) || isnan (y2) || isnan (z2) || isinf (x2) || isinf (y2) || isinf (z2))
-                    continue;
-
-                if (sw->logMode & 1) x2 = LOGFUN (x2);
-                if (sw->logMode & 2) y2 = LOGFUN (y2);
-                if (isnan (x2) || isnan (y2)) continue;
-                if (isinf (x2) || isinf (y2)) continue;
-
-                if (xmin > x2) xmin = x2;
-                if (xmax < x2) xmax = x2;
-                if (ymin > y2) ymin = y2;
-                if (ymax < y2) ymax = y2;
-            }
+            view->axisColumn[a] = a - a0;
+            view->axisOffset[a] = 0;
+            view->axisStride[a] = sb->columnSize[a - a0];
         }
         else
         {
-            double (*xys)[2];
-            uint32_t len;
-            stream_buffer_get (graph->sb, & xys, & len);
+            view->axisColumn[a] = 0;
+            view->axisOffset[a] = graph->axisOffset[a];
+            view->axisStride[a] = sb->itemSize;
+        }
+    }
 
-            int firstIdx = (int) len - (int) graph->len;
-            if (firstIdx < 0 || graph->len == 0)
-                firstIdx = 0;
+    return view->len;
+}
 
-            for (uint32_t i=firstIdx; i<len; i++)
-            {
-                double x = xys[i][0];
-                double y = xys[i][1];
+static void graph_view_close (GraphView *view)
+{
+    if (view->logLocked)
+        release_access (& view->graph->logAccess);
+    stream_buffer_read_end (view->graph->sb, view->reader);
+}
 
-                if (sw->logMode & 1) x = LOGFUN (x);
-                if (sw->logMode & 2) y = LOGFUN (y);
-                if (isnan (x) || isnan (y)) continue;
-                if (isinf (x) || isinf (y)) continue;
+#define DECODE_AXIS(type, isNaN)                                \
+    for (uint32_t i=0; i<n; i++, src += stride)                 \
+    {                                                           \
+        type raw;                                               \
+        memcpy (& raw, src, sizeof (raw));                      \
+        dst[i] = (isNaN) ? NaN : raw * scale + offset;          \
+    }
 
-                if (xmin > x) xmin = x;
-                if (xmax < x) xmax = x;
-                if (ymin > y) ymin = y;
-                if (ymax < y) ymax = y;
-            }
-        }
+// decodes n values of an axis stored contiguously with the given stride
+static void decode_axis (const CipAxisStorage *storage, const uint8_t *src, size_t stride, uint32_t n, double *dst)
+{
+    double scale  = storage->scale;
+    double offset = storage->offset;
 
+    switch (storage->type)
+    {
+     case CIP_STORE_DOUBLE:
+         if (stride == sizeof (double))
+             memcpy (dst, src, n * sizeof (double));
+         else
+             for (uint32_t i=0; i<n; i++, src += stride)
+                 memcpy (& dst[i], src, sizeof (double));
+         break;
 
-        release_access (& graph->insertAccess);
-        release_access (& graph->readAccess);
-    }
+     case CIP_STORE_FLOAT:
+         for (uint32_t i=0; i<n; i++, src += stride)
+         {
+             float f;
+             memcpy (& f, src, sizeof (f));
+             dst[i] = f;
+         }
+         break;
 
-    if (xmin == DBL_MAX || xmax == -DBL_MAX || ymin == DBL_MAX || ymax == -DBL_MAX)
-        return 0;
+     case CIP_STORE_INT16: DECODE_AXIS (int16_t, raw == INT16_MIN); break;
+     case CIP_STORE_INT32: DECODE_AXIS (int32_t, raw == INT32_MIN); break;
+     case CIP_STORE_UINT8: DECODE_AXIS (uint8_t, raw == UINT8_MAX); break;
+    }
+}
 
-    double dx = xmax - xmin;
-    double dy = ymax - ymin;
-    double mx = dx * 0.0;
-    double my = dy * 0.05;
+// Decodes n values of an axis, whatever its storage type, into doubles. The
+// points are read span by span, segmented buffers are not contiguous.
+static void graph_view_fetch (const GraphView *view, uint32_t axis, uint32_t i0, uint32_t n, double *dst)
+{
+    CipGraph *graph = view->graph;
 
-    sw->dataRange.x0 = xmin - mx;
-    sw->dataRange.y0 = ymax + my;
-    sw->dataRange.x1 = xmax + mx;
-    sw->dataRange.y1 = ymin - my;
+    if (axis == 0 && graph->implicitX)
+    {
+        double x0 = graph->x0;
+        double dx = graph->dx;
+        uint64_t c = view->firstCounter - 1 + i0;
+        for (uint32_t i=0; i<n; i++)
+            dst[i] = x0 + dx * (double) (c + i);
+        return;
+    }
 
-    return 1;
+    while (n)
+    {
+        uint32_t spanLen;
+        const uint8_t *src = stream_buffer_snapshot_span (graph->sb, & view->snap, view->axisColumn[axis],
+                                                          view->first + i0, & spanLen);
+        spanLen = MIN (spanLen, n);
+        decode_axis (& graph->axes[axis], src + view->axisOffset[axis], view->axisStride[axis], spanLen, dst);
+
+        i0  += spanLen;
+        dst += spanLen;
+        n   -= spanLen;
+    }
 }
 
-int cip_autoscale (CipState *cs, uint32_t windowIndex)
+// Zone map of a segment of a segmented graph: the bounding box of its finite
+// points, plus the first point of the next segment so that the line between
+// them is covered too. Axes that are not stored are unbounded.
+typedef struct SegmentZone
 {
-    return cip_autoscale_sw (cip_get_sub_window (cs, windowIndex));
-}
+    double min[3];
+    double max[3];
+} SegmentZone;
 
-void cip_set_range (CipSubWindow *sw, double xmin, double ymin, double xmax, double ymax, int setAsDefault)
+static void segment_zone_reset (CipGraph *graph, SegmentZone *zone)
 {
-    if (!sw)
-        exit_error ("bug");
+    for (uint32_t a=0; a<3; a++)
+    {
+        int stored = a >= graph->implicitX;
+        zone->min[a] = stored ?  DBL_MAX : -DBL_MAX;
+        zone->max[a] = stored ? -DBL_MAX :  DBL_MAX;
+    }
+}
 
-    sw->dataRange.x0 = xmin;
-    sw->dataRange.y0 = ymax;
-    sw->dataRange.x1 = xmax;
-    sw->dataRange.y1 = ymin;
+// Zone of the segment holding point i of the view, NULL for graphs without
+// zone maps. *n gets the number of points in view from i to the segment end.
+static const SegmentZone *graph_view_zone (const GraphView *view, uint32_t i, uint32_t *n)
+{
+    const SegmentZone *zone = stream_buffer_snapshot_meta (view->graph->sb, & view->snap, view->first + i, n);
+    *n = MIN (*n, view->len - i);
+    return zone;
+}
 
-    if (setAsDefault)
-        memcpy (& sw->defaultDataRange, & sw->dataRange, sizeof (CipArea));
+// returns 1 if no point of the zone is within [xlo,xhi] x [ylo,yhi]
+static int segment_zone_outside (const SegmentZone *zone, double xlo, double xhi, double ylo, double yhi)
+{
+    return zone->max[0] < xlo || zone->min[0] > xhi ||
+           zone->max[1] < ylo || zone->min[1] > yhi;
 }
 
-void cip_set_x_range (CipState *cs, uint32_t windowIndex, double xmin, double xmax, int setAsDefault)
+static double graph_view_value (const GraphView *view, uint32_t axis, uint32_t i)
 {
-    CipSubWindow *sw = cip_get_sub_window (cs, windowIndex);
-    if (!sw)
-        exit_error ("bug");
+    double v;
+    graph_view_fetch (view, axis, i, 1, & v);
+    return v;
+}
 
-    sw->dataRange.x0 = xmin;
-    sw->dataRange.x1 = xmax;
+// row i in view of a row graph, graph->rowWidth samples
+static const float *graph_view_row (const GraphView *view, uint32_t i)
+{
+    uint32_t n;
+    return stream_buffer_snapshot_span (view->graph->sb, & view->snap, 0, view->first + i, & n);
+}
 
-    if (setAsDefault)
-        memcpy (& sw->defaultDataRange, & sw->dataRange, sizeof (CipArea));
+// first point in view from lo on whose x is above xmin (or not below it, if inclusive),
+// hi if none is. The x of the points in [lo, hi) must be non-decreasing.
+static uint32_t graph_view_x_search (const GraphView *view, double xmin, int inclusive, uint32_t lo, uint32_t hi)
+{
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        double x = graph_view_value (view, 0, mid);
+        if (x < xmin || (!inclusive && x == xmin))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
 }
 
-void cip_set_y_range (CipState *cs, uint32_t windowIndex, double ymin, double ymax, int setAsDefault)
+// Index range [*i0, *i1) of the points in view that can be within
+// xmin <= x <= xmax, computed from x0 and dx for implicit x graphs and
+// binary searched when the stored x of all points in view is non-decreasing.
+// One point of margin is kept on each side, for rounding and for line
+// segments leaving the range. Other graphs have no order to exploit, all
+// points are returned.
+static void graph_view_x_range (const GraphView *view, double xmin, double xmax, uint32_t *i0, uint32_t *i1)
 {
-    CipSubWindow *sw = cip_get_sub_window (cs, windowIndex);
-    if (!sw)
-        exit_error ("bug");
+    *i0 = 0;
+    *i1 = view->len;
 
-    sw->dataRange.y0 = ymax;
-    sw->dataRange.y1 = ymin;
+    CipGraph *graph = view->graph;
+    if (!view->len)
+        return;
 
-    if (setAsDefault)
-        memcpy (& sw->defaultDataRange, & sw->dataRange, sizeof (CipArea));
+    if (!graph->implicitX)
+    {
+        // xDisorder is updated before the points are published, a newer
+        // value only makes the check more conservative
+        uint64_t disorder = __atomic_load_n (& graph->xDisorder, __ATOMIC_RELAXED);
+        if (view->firstCounter < disorder || isnan (xmin) || isnan (xmax) || xmin > xmax)
+            return;
+
+        uint32_t lo = graph_view_x_search (view, xmin, 1, 0, view->len);
+        uint32_t hi = graph_view_x_search (view, xmax, 0, lo, view->len);
+        *i0 = lo ? lo - 1 : 0;
+        *i1 = hi < view->len ? hi + 1 : hi;
+        return;
+    }
+
+    double c0 = (xmin - graph->x0) / graph->dx - (double) (view->firstCounter - 1);
+    double c1 = (xmax - graph->x0) / graph->dx - (double) (view->firstCounter - 1);
+    if (isnan (c0) || isnan (c1))
+        return;
+    if (c0 > c1)
+    {
+        double tmp = c0;
+        c0 = c1;
+        c1 = tmp;
+    }
+
+    double lo = floor (c0) - 1;
+    double hi = ceil (c1) + 2;
+    *i0 = lo <= 0 ? 0 : lo >= view->len ? view->len : (uint32_t) lo;
+    *i1 = hi <= 0 ? 0 : hi >= view->len ? view->len : (uint32_t) hi;
+    if (*i1 < *i0)
+        *i1 = *i0;
 }
 
-int cip_continuous_scroll_update (CipSubWindow *sw)
+// returns 1 if the producer overwrote any of the points in view while they were being read
+static int graph_view_overwritten (const GraphView *view)
 {
-    double xmin =  DBL_MAX;
-    double xmax = -DBL_MAX;
+    uint32_t n = stream_buffer_num_overwritten (view->graph->sb, & view->snap);
+    return n > view->snap.len - view->len;
+}
 
-    GraphAttacher **ag = sw->attachedGraphs;
-    for (int i=0; i<sw->numAttachedGraphs; i++)
-    {
-        CipGraph *graph = ag[i]->graph;
-        wait_for_access (& graph->readAccess);
-        wait_for_access (& graph->insertAccess);
+static void log_transform (double *v, uint32_t n)
+{
+    for (uint32_t i=0; i<n; i++)
+        v[i] = LOGFUN (v[i]);
+}
 
-        double (*xys)[2];
-        uint32_t len;
-        stream_buffer_get (graph->sb, & xys, & len);
+// LOGFUN of an axis of a graph, kept while some view of the graph is in log
+// scale, so that redrawing the view does not take the log of every point
+// again. Values are stored by point counter and extended as points come in.
+// Only the newest LOG_CACHE_MAX_LEN points are kept, the log of older ones
+// is taken when they are fetched, so that the cache of a huge or compactly
+// stored graph does not outgrow the graph itself.
+#define LOG_CACHE_MAX_LEN (1u << 22)
 
-        if (len)
-        {
-            int firstIdx = (int) len - (int) graph->len;
-            if (firstIdx < 0)
-                firstIdx = 0;
-            double x0 = xys[firstIdx][0];
-            double x1 = xys[len-1][0];
-            if (xmin > x0) xmin = x0;
-            if (xmax < x1) xmax = x1;
-        }
+typedef struct LogColumn
+{
+    double *values;
+    uint32_t mask;           // ring length - 1
+    uint32_t generation;     // of the stream buffer the values were taken from
+    uint64_t first;          // the points with counters first to end-1 are cached
+    uint64_t end;
+} LogColumn;
+
+struct CipLogCache
+{
+    LogColumn columns[2];
+};
 
-        release_access (& graph->insertAccess);
-        release_access (& graph->readAccess);
+// brings the log column of the axis up to date with the points of the view
+static void log_column_update (LogColumn *lc, const GraphView *view, uint32_t axis)
+{
+    uint64_t end = view->firstCounter + view->len;
+    uint32_t len = MIN (view->len, LOG_CACHE_MAX_LEN);
+
+    if (!lc->values || (uint64_t) lc->mask + 1 < len)
+    {
+        uint64_t ringLen = GRAPH_BLOCK_LEN;
+        while (ringLen < len)
+            ringLen <<= 1;
+
+        free (lc->values);
+        lc->values = safe_calloc (ringLen, sizeof (lc->values[0]));
+        lc->mask   = (uint32_t) (ringLen - 1);
+        lc->first  = 0;
+        lc->end    = 0;
     }
 
-    if (xmin == DBL_MAX || xmax == -DBL_MAX)
-        return 0;
+    // counters start over when the graph is reset or resized
+    uint64_t start = end - len;
+    if (lc->generation != view->snap.generation || lc->end < start || lc->first > start || lc->end > end)
+    {
+        lc->generation = view->snap.generation;
+        lc->first      = start;
+        lc->end        = start;
+    }
 
-    double width = sw->dataRange.x1 - sw->dataRange.x0;
-    sw->dataRange.x1 = xmax;
-    sw->dataRange.x0 = sw->dataRange.x1 - width;
+    double v[GRAPH_BLOCK_LEN];
+    uint32_t n;
+    for (uint64_t c=lc->end; c<end; c+=n)
+    {
+        n = (uint32_t) MIN (GRAPH_BLOCK_LEN, end - c);
+        graph_view_fetch (view, axis, (uint32_t) (c - view->firstCounter), n, v);
+        for (uint32_t i=0; i<n; i++)
+            lc->values[(c + i) & lc->mask] = LOGFUN (v[i]);
+    }
 
-    return 1;
+    lc->end   = end;
+    lc->first = MAX (lc->first, end - MIN (end, (uint64_t) lc->mask + 1));
 }
 
+// Makes graph_view_fetch_log of the axes in logMode read the log cache of
+// the graph, updated to the view first. The cache stays locked until the
+// view is closed.
+static void graph_view_use_log (GraphView *view, uint32_t logMode)
+{
+    CipGraph *graph = view->graph;
 
-void cip_continuous_scroll_enable (CipState *cs, uint32_t windowIndex)     { CipSubWindow *sw = cip_get_sub_window (cs, windowIndex); if (sw) sw->continuousScroll=1; }
-void cip_continuous_scroll_disable (CipState *cs, uint32_t windowIndex)    { CipSubWindow *sw = cip_get_sub_window (cs, windowIndex); if (sw) sw->continuousScroll=0; }
-int  cip_set_grid_mode (CipState *cs, uint32_t windowIndex, uint32_t mode) { CipSubWindow *sw = cip_get_sub_window (cs, windowIndex); return cip_set_grid_mode_sw (sw, mode); }
-int  cip_set_grid_mode_sw (CipSubWindow *sw, uint32_t mode) { if (sw) sw->gridMode = mode & 3; return 1; }
-int  cip_force_refresh (CipState *cs)                            { cs->forceRefresh = 1;        return 1; }
-int  cip_is_running (CipState *cs)                               { return cs->running; }
-void cip_redraw_async(CipState *cs)                              { cs->redraw=1; }
-void cip_set_bg_shade (CipState *cs, float bgShade)              { cs->bgShade = bgShade; }
-int  cip_set_crosshair_enabled (CipState *cs, uint32_t enabled)  { cs->crosshairEnabled  = enabled & 1; return 1; }
-int  cip_set_statusline_enabled (CipState *cs, uint32_t enabled) { cs->statuslineEnabled = enabled & 1; return 1; }
-int  cip_set_tracking_mode (CipState *cs, uint32_t mode)         { cs->trackingMode = mode & 3; return 1; }
-int  cip_toggle_paused (CipState *cs)                            { paused ^= 1;                 return 1; }
-int  cip_quit (CipState *cs)                                     { cs->running = 0; paused=0;   return 0; }
+    // the log of a 3D graph is taken after projecting it
+    if (!(logMode & 3) || graph->dim != 2)
+        return;
 
-static int toggle_help (CipState *cs)                            { cs->showHelp ^= 1;           return 1; }
+    wait_for_access (& graph->logAccess);
+    view->logLocked = 1;
 
-static int cycle_selected_graph (CipSubWindow *sw, uint32_t step)
-{
-    sw->selectedGraph = sw->numAttachedGraphs ? (sw->selectedGraph + step) % sw->numAttachedGraphs : 0;
-    return 1;
+    if (!graph->logCache)
+        graph->logCache = safe_calloc (1, sizeof (*graph->logCache));
+
+    for (uint32_t a=0; a<2; a++)
+    {
+        if (logMode & (1u << a))
+        {
+            log_column_update (& graph->logCache->columns[a], view, a);
+            view->logColumns[a] = & graph->logCache->columns[a];
+        }
+    }
 }
 
-static void undo_zooming (CipSubWindow *sw)
+static void graph_view_fetch_log (const GraphView *view, uint32_t axis, uint32_t i0, uint32_t n, double *dst)
 {
-    if (!sw)
-        return;
-    if (sw->defaultDataRange.x0 == sw->defaultDataRange.x1)
-        return;
-    if (sw->defaultDataRange.y0 == sw->defaultDataRange.y1)
+    const LogColumn *lc = view->logColumns[axis];
+    if (!lc)
+    {
+        graph_view_fetch (view, axis, i0, n, dst);
+        log_transform (dst, n);
         return;
+    }
 
-    memcpy (& sw->dataRange, & sw->defaultDataRange, sizeof (CipArea));
+    // points older than the cache
+    uint64_t c = view->firstCounter + i0;
+    uint32_t nOld = c < lc->first ? (uint32_t) MIN (n, lc->first - c) : 0;
+    if (nOld)
+    {
+        graph_view_fetch (view, axis, i0, nOld, dst);
+        log_transform (dst, nOld);
+    }
+
+    for (uint32_t i=nOld; i<n; i++)
+        dst[i] = lc->values[(c + i) & lc->mask];
 }
 
-static void transform_pos (const CipArea *srcArea, const CipPosition *srcPos, const CipArea *dstArea, CipPosition *dstPos)
+// fetches an axis, in log scale if logMode says so
+static void graph_view_fetch_scaled (const GraphView *view, uint32_t axis, uint32_t logMode, uint32_t i0, uint32_t n, double *dst)
 {
-    double xf = (srcPos->x - srcArea->x0) / (srcArea->x1 - srcArea->x0);
-    double yf = (srcPos->y - srcArea->y0) / (srcArea->y1 - srcArea->y0);
-    dstPos->x = xf * (dstArea->x1 - dstArea->x0) + dstArea->x0;
-    dstPos->y = yf * (dstArea->y1 - dstArea->y0) + dstArea->y0;
+    if (logMode & (1u << axis))
+        graph_view_fetch_log (view, axis, i0, n, dst);
+    else
+        graph_view_fetch (view, axis, i0, n, dst);
 }
 
-static void get_active_area (CipState *cs, CipArea *src, CipArea *dst)
+// fetches an axis of the points in view with indices is, in log scale if logMode says so
+static void graph_view_gather (const GraphView *view, uint32_t axis, uint32_t logMode, const uint32_t *is, uint32_t n, double *dst)
 {
-    uint32_t w = cs->windowWidth;
-    uint32_t h = cs->windowHeight - cs->statuslineEnabled * STATUSLINE_HEIGHT;
-
-    double xp = (double) (cs->bordered + cs->margin) / w;
-    double yp = (double) (cs->bordered + cs->margin) / h;
+    const LogColumn *lc = view->logColumns[axis];
+    int isLog = (logMode >> axis) & 1;
 
-    double epsw = 1.0 / cs->windowWidth;
-    double epsh = 1.0 / cs->windowHeight;
+    for (uint32_t i=0; i<n; i++)
+    {
+        if (isLog && lc && view->firstCounter + is[i] >= lc->first)
+            dst[i] = lc->values[(view->firstCounter + is[i]) & lc->mask];
+        else
+        {
+            graph_view_fetch (view, axis, is[i], 1, & dst[i]);
+            if (isLog)
+                dst[i] = LOGFUN (dst[i]);
+        }
+    }
+}
 
-    dst->x0 = src->x0 + xp;
-    dst->y0 = src->y0 + yp;
-    dst->x1 = src->x1 - xp - epsw;
-    dst->y1 = src->y1 - yp - epsh;
+static void free_log_cache (CipGraph *graph)
+{
+    wait_for_access (& graph->logAccess);
+    if (graph->logCache)
+    {
+        free (graph->logCache->columns[0].values);
+        free (graph->logCache->columns[1].values);
+        free (graph->logCache);
+        graph->logCache = NULL;
+    }
+    release_access (& graph->logAccess);
 }
 
-int cip_set_log_mode_sw (CipState *cs, CipSubWindow *sw, uint32_t mode)
+// Min/max summary of a 2D graph for drawing zoomed out line plots, see
+// bin_lines_lod. Level 0 buckets hold LOD_BASE_LEN consecutive points, each
+// level up buckets are LOD_FAN_OUT times as large. Like the log columns the
+// rings are indexed by point number and extended as points come in.
+#define LOD_BASE_SHIFT  4
+#define LOD_BASE_LEN    (1u << LOD_BASE_SHIFT)
+#define LOD_FAN_SHIFT   2
+#define LOD_FAN_OUT     (1u << LOD_FAN_SHIFT)
+#define LOD_MAX_LEVELS  12
+#define LOD_SHIFT(level) (LOD_BASE_SHIFT + LOD_FAN_SHIFT * (level))
+
+// fewer points than this per column are drawn segment by segment
+#define LOD_MIN_POINTS_PER_COLUMN 4
+
+typedef struct LodBucket
 {
-    if (!sw)
-        return 0;
+    double minX;             // of the finite points
+    double maxX;
+    double minY;
+    double maxY;
+    double firstY;           // of the first and last point
+    double lastY;
+    double travelY;          // sum of the steps in y from point to point
+    uint32_t nonFinite;      // points with NaN or infinite coordinates
+} LodBucket;
+
+typedef struct LodLevel
+{
+    LodBucket *buckets;      // by bucket number
+    uint32_t mask;
+} LodLevel;
 
-    mode &= 3;
+typedef struct CipLineLod
+{
+    LodLevel levels[LOD_MAX_LEVELS];
+    uint32_t nLevels;
+    uint32_t generation;     // of the stream buffer the buckets were built from
+    uint64_t capacity;       // points the rings can hold
+    uint64_t first;          // the points numbered first to end-1 are summarized
+    uint64_t end;
+} CipLineLod;
+
+static void lod_bucket_reset (LodBucket *b)
+{
+    b->minX      =  DBL_MAX;
+    b->maxX      = -DBL_MAX;
+    b->minY      =  DBL_MAX;
+    b->maxY      = -DBL_MAX;
+    b->firstY    = NaN;
+    b->lastY     = NaN;
+    b->travelY   = 0;
+    b->nonFinite = 0;
+}
 
-    int xIsLog = sw->logMode & 1;
-    int yIsLog = sw->logMode & 2;
+static void lod_bucket_merge (LodBucket *b, const LodBucket *child)
+{
+    if (b->minX > child->minX) b->minX = child->minX;
+    if (b->maxX < child->maxX) b->maxX = child->maxX;
+    if (b->minY > child->minY) b->minY = child->minY;
+    if (b->maxY < child->maxY) b->maxY = child->maxY;
+    if (isnan (b->firstY))
+        b->firstY = child->firstY;
+    else
+        b->travelY += fabs (child->firstY - b->lastY);
+    b->travelY += child->travelY;
+    b->lastY = child->lastY;
+    b->nonFinite += child->nonFinite;
+}
 
-    int xWantsLog = mode & 1;
-    int yWantsLog = mode & 2;
+static void line_lod_free_levels (CipLineLod *lod)
+{
+    for (uint32_t l=0; l<lod->nLevels; l++)
+        free (lod->levels[l].buckets);
+    memset (lod, 0, sizeof (*lod));
+}
 
-    CipArea activeArea;
-    CipArea zoomWindowArea = {0,0,1,1};
-    get_active_area (cs, & zoomWindowArea, & activeArea);
-    CipPosition winPos;
-    transform_pos (& sw->dataRange, & sw->mouseDataPos, & activeArea, & winPos);
+// brings the summary up to date with the points of the view
+static void line_lod_update (CipLineLod *lod, const GraphView *view)
+{
+    uint64_t first = view->firstCounter - 1;
+    uint64_t end   = first + view->len;
 
-    if (xIsLog != xWantsLog)
+    if (lod->capacity < view->len)
     {
-        if (xWantsLog)
-        {
-            sw->mouseDataPos.x = LOGFUN (sw->mouseDataPos.x);
-            sw->dataRange.x0   = LOGFUN (sw->dataRange.x0);
-            sw->dataRange.x1   = LOGFUN (sw->dataRange.x1);
-        }
-        else
+        line_lod_free_levels (lod);
+
+        lod->capacity = 1 << 16;
+        while (lod->capacity < view->len)
+            lod->capacity <<= 1;
+
+        // the coarsest level still has a few buckets across the whole ring
+        lod->nLevels = 1;
+        while (lod->nLevels < LOD_MAX_LEVELS && (lod->capacity >> LOD_SHIFT (lod->nLevels)) >= 4)
+            lod->nLevels++;
+
+        for (uint32_t l=0; l<lod->nLevels; l++)
         {
-            sw->dataRange.x0   = EXPFUN (sw->dataRange.x0);
-            sw->dataRange.x1   = EXPFUN (sw->dataRange.x1);
-            sw->mouseDataPos.x = EXPFUN (sw->mouseDataPos.x);
+            uint64_t ringLen = 1;
+            while (ringLen < (lod->capacity >> LOD_SHIFT (l)) + 2)
+                ringLen <<= 1;
+            lod->levels[l].buckets = safe_calloc (ringLen, sizeof (LodBucket));
+            lod->levels[l].mask    = (uint32_t) (ringLen - 1);
         }
+        lod->generation = view->snap.generation + 1;
     }
 
-    if (yIsLog != yWantsLog)
+    // counters start over when the graph is reset or resized
+    if (lod->generation != view->snap.generation || lod->end < first || lod->first > first || lod->end > end)
     {
-        if (yWantsLog)
-        {
-            sw->dataRange.y0   = LOGFUN (sw->dataRange.y0);
-            sw->dataRange.y1   = LOGFUN (sw->dataRange.y1);
-            sw->mouseDataPos.y = LOGFUN (sw->mouseDataPos.y);
-        }
-        else
-        {
-            sw->dataRange.y0   = EXPFUN (sw->dataRange.y0);
-            sw->dataRange.y1   = EXPFUN (sw->dataRange.y1);
-            sw->mouseDataPos.y = EXPFUN (sw->mouseDataPos.y);
-        }
+        lod->generation = view->snap.generation;
+        lod->first      = first;
+        lod->end        = first;
+        for (uint32_t l=0; l<lod->nLevels; l++)
+            lod_bucket_reset (& lod->levels[l].buckets[(first >> LOD_SHIFT (l)) & lod->levels[l].mask]);
     }
 
-    sw->logMode = mode & 3;
-
-    if (isnan (sw->dataRange.x0) || isnan (sw->dataRange.x1) ||
-        isnan (sw->dataRange.y0) || isnan (sw->dataRange.y1))
+    double xs[GRAPH_BLOCK_LEN];
+    double ys[GRAPH_BLOCK_LEN];
+    uint32_t n;
+    for (uint64_t p=lod->end; p<end; p+=n)
     {
-        cip_autoscale_sw (sw);
-    }
+        n = (uint32_t) MIN (GRAPH_BLOCK_LEN, end - p);
+        graph_view_fetch (view, 0, (uint32_t) (p - first), n, xs);
+        graph_view_fetch (view, 1, (uint32_t) (p - first), n, ys);
 
-    transform_pos (& activeArea, & winPos, & sw->dataRange, & sw->mouseDataPos);
+        for (uint32_t i=0; i<n; i++)
+        {
+            uint64_t q = p + i;
+            LodBucket *b = & lod->levels[0].buckets[(q >> LOD_BASE_SHIFT) & lod->levels[0].mask];
+            if ((q & (LOD_BASE_LEN - 1)) == 0)
+                lod_bucket_reset (b);
+
+            double x = xs[i];
+            double y = ys[i];
+            if (isfinite (x) && isfinite (y))
+            {
+                if (b->minX > x) b->minX = x;
+                if (b->maxX < x) b->maxX = x;
+                if (b->minY > y) b->minY = y;
+                if (b->maxY < y) b->maxY = y;
+            }
+            else
+                b->nonFinite++;
 
-    return 1;
-}
+            if (isnan (b->firstY))
+                b->firstY = y;
+            else
+                b->travelY += fabs (y - b->lastY);
+            b->lastY = y;
 
-int cip_set_log_mode (CipState *cs, uint32_t windowIndex, uint32_t mode)
-{
-    return cip_set_log_mode_sw (cs, cip_get_sub_window (cs, windowIndex), mode);
+            // completed buckets are merged into the next level up
+            for (uint32_t l=0; l+1<lod->nLevels && ((q + 1) & ((1ull << LOD_SHIFT (l)) - 1)) == 0; l++)
+            {
+                uint64_t k = q >> LOD_SHIFT (l);
+                LodBucket *parent = & lod->levels[l+1].buckets[(k >> LOD_FAN_SHIFT) & lod->levels[l+1].mask];
+                if ((k & (LOD_FAN_OUT - 1)) == 0)
+                    lod_bucket_reset (parent);
+                lod_bucket_merge (parent, & lod->levels[l].buckets[k & lod->levels[l].mask]);
+            }
+        }
+    }
+
+    lod->end   = end;
+    lod->first = MAX (lod->first, end - MIN (end, lod->capacity));
 }
 
-static void sub_window_change (CipState *cs, int dir)
+static void free_line_lod (CipGraph *graph)
 {
-    int index = (int) (cs->activeSw - cs->subWindows);
-    index += dir;
-    if (index < 0)
-        index = 0;
-    if (index > (int) cs->numSubWindows - 1)
-        index = (int) cs->numSubWindows - 1;
-    if (cs->zoomEnabled)
+    wait_for_access (& graph->lodAccess);
+    if (graph->lineLod)
     {
-        CipSubWindow *sw0 = cs->activeSw;
-        CipSubWindow *sw1 = & cs->subWindows[index];
-        CipArea activeArea;
-        CipArea zoomWindowArea = {0,0,1,1};
-        get_active_area (cs, & zoomWindowArea, & activeArea);
-        CipPosition winPos;
-        transform_pos (& sw0->dataRange, & sw0->mouseDataPos, & activeArea, & winPos);
-        transform_pos (& activeArea, & winPos, & sw1->dataRange, & sw1->mouseDataPos);
+        line_lod_free_levels (graph->lineLod);
+        free (graph->lineLod);
+        graph->lineLod = NULL;
     }
-    cs->activeSw = & cs->subWindows[index];
+    release_access (& graph->lodAccess);
 }
 
-int cip_zoom (CipSubWindow *sw, double xf, double yf)
+// Grid index of a 2D graph with a spatial index, so that zoomed in point
+// plots and region queries only visit the points near the area they look
+// at. The bounding box of the points is split into GRID_SIZE x GRID_SIZE
+// cells listing the numbers of their points in ascending order. Points
+// outside of the box go to an extra cell that is always visited, the box is
+// fitted to the points again once that cell gets crowded. Like the log
+// columns the index is extended as points come in.
+#define GRID_SHIFT   8
+#define GRID_SIZE    (1u << GRID_SHIFT)
+#define GRID_OUTSIDE (GRID_SIZE * GRID_SIZE) // cell of the points outside of the box
+
+// points outside of the box tolerated before refitting it, at least
+#define GRID_MIN_OUTSIDE 4096
+
+// points handed to a GridFun at a time
+#define GRID_VISIT_LEN 256
+
+// visiting a point of the grid costs about as much as scanning this many
+#define GRID_SCAN_RATIO 8
+
+typedef struct GridCell
 {
-    if (!sw)
-        return 0;
-    CipArea *dr = & sw->dataRange;
-    double dx = (dr->x1 - dr->x0) * xf;
-    double dy = (dr->y1 - dr->y0) * yf;
-    dr->x0 += dx;
-    dr->x1 -= dx;
-    dr->y0 += dy;
-    dr->y1 -= dy;
-    return 1;
+    uint32_t *points;        // counter - base of the points, ascending
+    uint32_t n;
+    uint32_t capacity;
+} GridCell;
+
+typedef struct CipGridIndex
+{
+    GridCell *cells;         // GRID_OUTSIDE + 1 of them
+    double min[2];           // box of the cells, x and y
+    double max[2];
+    double scale[2];         // cells per unit
+    uint32_t generation;     // of the stream buffer the points were taken from
+    uint64_t base;           // counter of point number 0
+    uint64_t end;            // the finite points with counters base to end-1 are indexed
+    uint64_t nOutside;
+} CipGridIndex;
+
+// called with the indices in view of n points of the grid
+typedef void (*GridFun) (void *arg, const uint32_t *is, uint32_t n);
+
+// cell column (axis 0) or row (axis 1) of v, -1 outside of the box
+static int32_t grid_coord (const CipGridIndex *grid, uint32_t axis, double v)
+{
+    if (!(v >= grid->min[axis] && v <= grid->max[axis]))
+        return -1;
+
+    double c = (v - grid->min[axis]) * grid->scale[axis];
+    return c < GRID_SIZE - 1 ? (int32_t) c : (int32_t) (GRID_SIZE - 1);
 }
 
-int cip_move (CipSubWindow *sw, double xf, double yf)
+// Cells *c0 to *c1 of an axis holding the values from lo to hi, returns 0 if
+// no cell does. Cell coordinates don't decrease with the value, every point
+// within [lo, hi] is in one of them.
+static int grid_range (const CipGridIndex *grid, uint32_t axis, double lo, double hi, uint32_t *c0, uint32_t *c1)
 {
-    if (!sw)
+    if (hi < grid->min[axis] || lo > grid->max[axis])
         return 0;
-    CipArea *dr = & sw->dataRange;
-    double dx = (dr->x1 - dr->x0) * xf;
-    double dy = (dr->y1 - dr->y0) * yf;
-    dr->x0 -= dx;
-    dr->x1 -= dx;
-    dr->y0 -= dy;
-    dr->y1 -= dy;
+
+    *c0 = lo > grid->min[axis] ? (uint32_t) grid_coord (grid, axis, lo) : 0;
+    *c1 = hi < grid->max[axis] ? (uint32_t) grid_coord (grid, axis, hi) : GRID_SIZE - 1;
     return 1;
 }
 
-#ifdef __APPLE__
-#include <mach-o/dyld.h>
-#endif
-
-static char *make_title(char *buf, size_t size)
+// indexes the points of the view from grid->end to end
+static void grid_index_add (CipGridIndex *grid, const GraphView *view, uint64_t end)
 {
-#ifdef __APPLE__
-    char path[4096];
-    uint32_t n = sizeof(path);
+    double xs[GRAPH_BLOCK_LEN];
+    double ys[GRAPH_BLOCK_LEN];
+    uint32_t n;
+    for (uint64_t c=grid->end; c<end; c+=n)
+    {
+        n = (uint32_t) MIN (GRAPH_BLOCK_LEN, end - c);
+        graph_view_fetch (view, 0, (uint32_t) (c - view->firstCounter), n, xs);
+        graph_view_fetch (view, 1, (uint32_t) (c - view->firstCounter), n, ys);
 
-    if (!buf || size == 0)
-        return NULL;
+        for (uint32_t i=0; i<n; i++)
+        {
+            if (!isfinite (xs[i]) || !isfinite (ys[i]))
+                continue;
 
-    if (_NSGetExecutablePath(path, &n) != 0) {
-        buf[0] = '\0';
-        return buf;
-    }
+            int32_t cx = grid_coord (grid, 0, xs[i]);
+            int32_t cy = grid_coord (grid, 1, ys[i]);
+            GridCell *cell = & grid->cells[GRID_OUTSIDE];
+            if (cx >= 0 && cy >= 0)
+                cell = & grid->cells[(uint32_t) cy * GRID_SIZE + (uint32_t) cx];
+            else
+                grid->nOutside++;
 
-    char *name = strrchr(path, '/');
-    if (!name) {
-        snprintf(buf, size, "%s", path);
-        return buf;
+            if (cell->n == cell->capacity)
+            {
+                cell->capacity = cell->capacity ? 2 * cell->capacity : 16;
+                cell->points = realloc (cell->points, cell->capacity * sizeof (cell->points[0]));
+                if (!cell->points)
+                    exit_error ("can't realloc %u", cell->capacity);
+            }
+            cell->points[cell->n++] = (uint32_t) (c + i - grid->base);
+        }
     }
+    grid->end = end;
+}
 
-    *name++ = '\0';
+// fits the box to the points in view and indexes them all again
+static void grid_index_rebuild (CipGridIndex *grid, const GraphView *view)
+{
+    double min[2] = { DBL_MAX,  DBL_MAX};
+    double max[2] = {-DBL_MAX, -DBL_MAX};
 
-    char *dir = strrchr(path, '/');
-    dir = dir ? dir + 1 : path;
+    double v[2][GRAPH_BLOCK_LEN];
+    uint32_t n;
+    for (uint32_t b=0; b<view->len; b+=n)
+    {
+        n = MIN (GRAPH_BLOCK_LEN, view->len - b);
+        graph_view_fetch (view, 0, b, n, v[0]);
+        graph_view_fetch (view, 1, b, n, v[1]);
+        for (uint32_t i=0; i<n; i++)
+        {
+            if (!isfinite (v[0][i]) || !isfinite (v[1][i]))
+                continue;
 
-    snprintf(buf, size, "%s:%s", dir, name);
-    return buf;
-#else
-    if (buf && size)
-        snprintf (buf, size, "%s", CINTERPLOT_TITLE);
-    return buf;
-#endif
-}
+            for (uint32_t a=0; a<2; a++)
+            {
+                if (min[a] > v[a][i]) min[a] = v[a][i];
+                if (max[a] < v[a][i]) max[a] = v[a][i];
+            }
+        }
+    }
 
-static void reinitialise_sdl_context (CipState *cs, int reinitWindow)
-{
-    if (iconData)
+    for (uint32_t a=0; a<2; a++)
     {
-        void *ptr = iconData;
-        iconData = NULL;
-        free (ptr);
+        grid->min[a]   = min[a];
+        grid->max[a]   = max[a];
+        grid->scale[a] = max[a] > min[a] ? GRID_SIZE / (max[a] - min[a]) : 0;
     }
 
-    if (cs->texture)
-        SDL_DestroyTexture (cs->texture);
-    if (cs->renderer)
-        SDL_DestroyRenderer (cs->renderer);
+    for (uint32_t c=0; c<=GRID_OUTSIDE; c++)
+        grid->cells[c].n = 0;
 
-    if (reinitWindow)
-    {
-        if (cs->window)
-            SDL_DestroyWindow (cs->window);
+    grid->generation = view->snap.generation;
+    grid->base       = view->firstCounter;
+    grid->end        = view->firstCounter;
+    grid->nOutside   = 0;
+    grid_index_add (grid, view, view->firstCounter + view->len);
+}
 
-        char title[256];
-        make_title (title, sizeof (title));
+// brings the index up to date with the points of the view
+static void grid_index_update (CipGridIndex *grid, const GraphView *view)
+{
+    uint64_t first = view->firstCounter;
+    uint64_t end   = first + view->len;
 
-        cs->window = SDL_CreateWindow (title, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-                                       (int) cs->windowWidth, (int) cs->windowHeight, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
-        if (!cs->window)
-            exit_error ("Window could not be created: SDL Error: %s\n", SDL_GetError ());
+    if (!grid->cells)
+    {
+        grid->cells = safe_calloc (GRID_OUTSIDE + 1, sizeof (GridCell));
+        grid->generation = view->snap.generation + 1;
     }
 
-    cs->renderer = SDL_CreateRenderer (cs->window, -1, SDL_RENDERER_ACCELERATED);
-    if (!cs->renderer)
-        exit_error ("Renderer could not be created! SDL Error: %s\n", SDL_GetError ());
+    // Counters start over when the graph is reset or resized. Points that
+    // left the view are dropped once they outnumber the ones in it, the box
+    // is refitted once too many points fall outside of it.
+    if (grid->generation != view->snap.generation || grid->base > first || grid->end < first || grid->end > end ||
+        first - grid->base > end - first || end - grid->base > UINT32_MAX ||
+        (grid->nOutside > GRID_MIN_OUTSIDE && grid->nOutside * 8 > grid->end - grid->base))
+        grid_index_rebuild (grid, view);
+    else
+        grid_index_add (grid, view, end);
+}
 
-    cs->texture = SDL_CreateTexture (cs->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
-                                     (int) cs->windowWidth, (int) cs->windowHeight);
-    if (!cs->texture)
-        exit_error ("Texture could not be created: SDL Error: %s\n", SDL_GetError ());
+// points in the cells holding [xlo, xhi] x [ylo, yhi], some of which may have left the view
+static uint64_t grid_index_count (const CipGridIndex *grid, double xlo, double xhi, double ylo, double yhi)
+{
+    uint64_t n = grid->cells[GRID_OUTSIDE].n;
 
-    SDL_SetWindowFullscreen (cs->window, cs->fullscreen ? SDL_WINDOW_FULLSCREEN_DESKTOP : 0);
+    uint32_t cx0, cx1, cy0, cy1;
+    if (grid_range (grid, 0, xlo, xhi, & cx0, & cx1) && grid_range (grid, 1, ylo, yhi, & cy0, & cy1))
+        for (uint32_t cy=cy0; cy<=cy1; cy++)
+            for (uint32_t cx=cx0; cx<=cx1; cx++)
+                n += grid->cells[cy * GRID_SIZE + cx].n;
 
-    iconData = malloc (sizeof (uint32_t) * cs->windowWidth * cs->windowHeight);
-    if (!iconData)
-        print_error ("failed to allocate iconData buffer");
+    return n;
 }
 
-int cip_set_fullscreen (CipState *cs, uint32_t fullscreen)
+// adds the points of a cell still in view to is, which holds n, passing it on to fun whenever full
+static uint32_t grid_cell_visit (const GridCell *cell, uint32_t first, uint32_t *is, uint32_t n, GridFun fun, void *arg)
 {
-    cs->fullscreen = fullscreen & 1;
-
-    if (cs->fullscreen)
+    // the points are ascending, skip the ones that left the view
+    uint32_t lo = 0;
+    uint32_t hi = cell->n;
+    while (lo < hi)
     {
-        SDL_DisplayMode displayMode;
-        SDL_GetCurrentDisplayMode (0, & displayMode);
-        assert (displayMode.w > 0);
-        assert (displayMode.h > 0);
-        print_debug ("fullscreen res: %u %u", displayMode.w, displayMode.h);
-        cs->windowWidth  = (uint32_t) displayMode.w;
-        cs->windowHeight = (uint32_t) displayMode.h;
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (cell->points[mid] < first)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-    else
+
+    for (uint32_t k=lo; k<cell->n; k++)
     {
-        cs->windowWidth  = CINTERPLOT_INIT_WIDTH;
-        cs->windowHeight = CINTERPLOT_INIT_HEIGHT;
+        is[n++] = cell->points[k] - first;
+        if (n == GRID_VISIT_LEN)
+        {
+            fun (arg, is, n);
+            n = 0;
+        }
     }
+    return n;
+}
 
-    reinitialise_sdl_context (cs, 1);
-    return 1;
+// Calls fun with the points in view that can be within [xlo, xhi] x [ylo, yhi],
+// in no particular order. The index must be up to date with the view.
+static void grid_index_visit (const CipGridIndex *grid, const GraphView *view, double xlo, double xhi, double ylo, double yhi,
+                              GridFun fun, void *arg)
+{
+    uint32_t first = (uint32_t) (view->firstCounter - grid->base);
+    uint32_t is[GRID_VISIT_LEN];
+    uint32_t n = 0;
+
+    uint32_t cx0, cx1, cy0, cy1;
+    if (grid_range (grid, 0, xlo, xhi, & cx0, & cx1) && grid_range (grid, 1, ylo, yhi, & cy0, & cy1))
+        for (uint32_t cy=cy0; cy<=cy1; cy++)
+            for (uint32_t cx=cx0; cx<=cx1; cx++)
+                n = grid_cell_visit (& grid->cells[cy * GRID_SIZE + cx], first, is, n, fun, arg);
+
+    n = grid_cell_visit (& grid->cells[GRID_OUTSIDE], first, is, n, fun, arg);
+    if (n)
+        fun (arg, is, n);
 }
 
-static void lineRGBA (uint32_t *pixels, uint32_t _w, uint32_t _h, uint32_t _x0, uint32_t _y0, uint32_t _x1, uint32_t _y1, uint32_t color)
+// the index of a graph with a spatial index, up to date with the view and locked
+static CipGridIndex *graph_view_lock_grid (const GraphView *view)
 {
-    if (!pixels)
-        return;
+    CipGraph *graph = view->graph;
+    wait_for_access (& graph->gridAccess);
+    if (!graph->gridIndex)
+        graph->gridIndex = safe_calloc (1, sizeof (*graph->gridIndex));
+    grid_index_update (graph->gridIndex, view);
+    return graph->gridIndex;
+}
 
-    int w  = (int) _w;
-    int h  = (int) _h;
-    int x0 = (int) _x0;
-    int y0 = (int) _y0;
-    int x1 = (int) _x1;
-    int y1 = (int) _y1;
-
-    int xabs = (x1 > x0) ? x1 - x0 : x0 - x1;
-    int yabs = (y1 > y0) ? y1 - y0 : y0 - y1;
+static void free_grid_index (CipGraph *graph)
+{
+    wait_for_access (& graph->gridAccess);
+    CipGridIndex *grid = graph->gridIndex;
+    if (grid)
+    {
+        for (uint32_t c=0; grid->cells && c<=GRID_OUTSIDE; c++)
+            free (grid->cells[c].points);
+        free (grid->cells);
+        free (grid);
+        graph->gridIndex = NULL;
+    }
+    release_access (& graph->gridAccess);
+}
 
-    if (xabs > yabs)
+// drops the log columns and line summaries no view needs anymore
+static void release_view_caches (CipState *cs)
+{
+    for (uint32_t swi=0; swi<cs->numSubWindows; swi++)
     {
-        int xstart = ((x0 < x1) ? x0 : x1);
-        int xstop  = xstart + xabs;
+        CipSubWindow *sw = & cs->subWindows[swi];
+        for (int i=0; i<sw->numAttachedGraphs; i++)
+        {
+            CipGraph *graph = sw->attachedGraphs[i]->graph;
 
-        if (xstart <   0) xstart = 0;
-        if (xstart > w-1) xstart = w-1;
-        if (xstop <    0) xstop  = 0;
-        if (xstop >  w-1) xstop  = w-1;
+            uint32_t wanted = 0;
+            int hasLines = 0;
+            for (uint32_t swk=0; swk<cs->numSubWindows; swk++)
+            {
+                CipSubWindow *swOther = & cs->subWindows[swk];
+                for (int k=0; k<swOther->numAttachedGraphs; k++)
+                {
+                    GraphAttacher *attacher = swOther->attachedGraphs[k];
+                    if (attacher->graph != graph)
+                        continue;
 
-        for (int x=xstart; x<=xstop; x++)
-        {
-            int y = (int) (y0 + ((double) (x - x0) / (x1 - x0) * (y1 - y0) + 0.5));
-            if (x>=0 && y>=0 && x<w && y<h)
-                pixels[y*w+x] = color;
-        }
-    }
-    else if (yabs >= xabs && y0 != y1)
-    {
-        int ystart = ((y0 < y1) ? y0 : y1);
-        int ystop  = ystart + yabs;
+                    wanted |= swOther->logMode;
+                    char plotType = attacher->plotType;
+                    hasLines |= plotType == 'l' || plotType == 't' || plotType == 's';
+                }
+            }
 
-        if (ystart <   0) ystart = 0;
-        if (ystart > h-1) ystart = h-1;
-        if (ystop <    0) ystop  = 0;
-        if (ystop >  h-1) ystop  = h-1;
+            if (!hasLines)
+                free_line_lod (graph);
 
-        for (int y=ystart; y<=ystop; y++)
-        {
-            int x = (int) (x0 + ((double) (y - y0) / (y1 - y0) * (x1 - x0) + 0.5));
-            if (x>=0 && y>=0 && x<w && y<h)
-                pixels[y*w+x] = color;
+            if (!(wanted & 3))
+            {
+                free_log_cache (graph);
+                continue;
+            }
+
+            wait_for_access (& graph->logAccess);
+            for (uint32_t a=0; graph->logCache && a<2; a++)
+            {
+                LogColumn *lc = & graph->logCache->columns[a];
+                if (!(wanted & (1u << a)) && lc->values)
+                {
+                    free (lc->values);
+                    memset (lc, 0, sizeof (*lc));
+                }
+            }
+            release_access (& graph->logAccess);
         }
     }
-    else
-    {
-        int x = x0;
-        int y = y0;
-        if (x>=0 && y>=0 && x<w && y<h)
-            pixels[y*w+x] = color;
-    }
 }
 
-void cip_histogram_line (CipHistogram *hist, int x0, int y0, int x1, int y1)
+static void cycle_graph_order (CipState *cs)
 {
-    int *bins = hist->bins;
-
-    int w = (int) hist->w;
-    int h = (int) hist->h;
+    cs->graphOrder++;
+    //print_debug ("graph order %u", cs->graphOrder);
+}
 
-    if ((x0 < 0 && x1 < 0) ||
-        (y0 < 0 && y1 < 0) ||
-        (x0 > w && x1 > w) ||
-        (y0 > h && y1 > h)
-       )
-        return;
+int cip_autoscale_sw (CipSubWindow *sw)
+{
+    if (!sw)
+        return 0;
 
-    int xabs = (x1 > x0) ? x1 - x0 : x0 - x1;
-    int yabs = (y1 > y0) ? y1 - y0 : y0 - y1;
+    double xmin =  DBL_MAX;
+    double xmax = -DBL_MAX;
+    double ymin =  DBL_MAX;
+    double ymax = -DBL_MAX;
 
-    if (xabs > yabs)
+    GraphAttacher **ag = sw->attachedGraphs;
+    for (int i=0; i<sw->numAttachedGraphs; i++)
     {
-        int xstart = ((x0 < x1) ? x0 : x1);
-        int xstop  = xstart + xabs;
+        CipGraph *graph = ag[i]->graph;
+        int is3d = graph->dim == 3;
 
-        if (xstart <   0) xstart = 0;
-        if (xstart > w-1) xstart = w-1;
-        if (xstop <    0) xstop  = 0;
-        if (xstop >  w-1) xstop  = w-1;
+        GraphView view;
+        uint32_t len = graph_view_open (graph, & view);
 
-        for (int x=xstart; x<=xstop; x++)
+        // a row graph spans its samples in x and their values in y, as drawn,
+        // in log mode the ones above zero
+        if (graph->rowWidth)
         {
-            int y = (int) (y0 + ((double) (x - x0) / (x1 - x0) * (y1 - y0) + 0.5));
-            if (x>=0 && y>=0 && x<w && y<h)
-                bins[y*w+x]++;
+            double lo =  DBL_MAX;
+            double hi = -DBL_MAX;
+            for (uint32_t r=0; r<len; r++)
+            {
+                const float *row = graph_view_row (& view, r);
+                for (uint32_t si=0; si<graph->rowWidth; si++)
+                {
+                    if (!isfinite (row[si]) || ((sw->logMode & 2) && row[si] <= 0)) continue;
+                    if (lo > row[si]) lo = row[si];
+                    if (hi < row[si]) hi = row[si];
+                }
+            }
+            if (lo <= hi)
+            {
+                if (sw->logMode & 2)
+                {
+                    lo = LOGFUN (lo);
+                    hi = LOGFUN (hi);
+                }
+                if (ymin > lo) ymin = lo;
+                if (ymax < hi) ymax = hi;
+            }
+
+            for (uint32_t si=0; len && si<graph->rowWidth; si++)
+            {
+                double x = graph->x0 + graph->dx * si;
+                if (sw->logMode & 1)
+                {
+                    if (x <= 0) continue;
+                    x = LOGFUN (x);
+                }
+                if (xmin > x) xmin = x;
+                if (xmax < x) xmax = x;
+            }
+            graph_view_close (& view);
+            continue;
         }
-    }
-    else if (yabs >= xabs && y0 != y1)
-    {
-        int ystart = ((y0 < y1) ? y0 : y1);
-        int ystop  = ystart + yabs;
 
-        if (ystart <   0) ystart = 0;
-        if (ystart > h-1) ystart = h-1;
-        if (ystop <    0) ystop  = 0;
-        if (ystop >  h-1) ystop  = h-1;
+        graph_view_use_log (& view, sw->logMode);
 
-        for (int y=ystart; y<=ystop; y++)
+        // x of an implicit x graph is monotonic, its range is given by the end points
+        int xFromEnds = graph->implicitX && !is3d && !(sw->logMode & 1);
+        int hasPoints = 0;
+
+        double xs[GRAPH_BLOCK_LEN];
+        double ys[GRAPH_BLOCK_LEN];
+        double zs[GRAPH_BLOCK_LEN];
+
+        // whole segments, but the last one, are summarized by their zone maps
+        int useZones = !is3d && !sw->logMode;
+
+        uint32_t n;
+        for (uint32_t b=0; b<len; b+=n)
         {
-            int x = (int) (x0 + ((double) (y - y0) / (y1 - y0) * (x1 - x0) + 0.5));
-            if (x>=0 && y>=1 && x<w && y<h)
-                bins[y*w+x]++;
-        }
-    }
-    else
-    {
-        int x = x0;
-        int y = y0;
-        if (x>=0 && y>=0 && x<w && y<h)
-            bins[y*w+x]++;
-    }
-}
+            uint32_t segmentLeft;
+            const SegmentZone *zone = graph_view_zone (& view, b, & segmentLeft);
+            n = MIN (GRAPH_BLOCK_LEN, segmentLeft);
 
-static void draw_rect (uint32_t* pixels, uint32_t w, uint32_t h, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, uint32_t color)
-{
-    if (x1 < x0)
-    {
-        x1 ^= x0;
-        x0 ^= x1;
-        x1 ^= x0;
-    }
-    if (y1 < y0)
-    {
-        y1 ^= y0;
-        y0 ^= y1;
-        y1 ^= y0;
-    }
-    if (!pixels)
-        return;
+            if (useZones && zone && segmentLeft == graph->sb->segmentLen && b + segmentLeft < len)
+            {
+                n = segmentLeft;
+                if (zone->min[1] > zone->max[1])
+                    continue;
 
-    for (uint32_t yi=y0; yi<=y1 && yi<h; yi++)
-    {
-        pixels[yi*w + x0] = color;
-        pixels[yi*w + x1] = color;
-    }
-    for (uint32_t xi=x0; xi<=x1 && xi<w; xi++)
-    {
-        pixels[y0*w + xi] = color;
-        pixels[y1*w + xi] = color;
-    }
-}
+                if (ymin > zone->min[1]) ymin = zone->min[1];
+                if (ymax < zone->max[1]) ymax = zone->max[1];
+                if (!xFromEnds)
+                {
+                    if (xmin > zone->min[0]) xmin = zone->min[0];
+                    if (xmax < zone->max[0]) xmax = zone->max[0];
+                }
+                hasPoints = 1;
+                continue;
+            }
 
+            if (xFromEnds)
+            {
+                graph_view_fetch_scaled (& view, 1, sw->logMode, b, n, ys);
 
-static int on_mouse_pressed (CipState *cs, int xi, int yi, int button, int clicks)
-{
-    if (cs->activeSw == NULL)
-    {
-        cs->mouseState = MOUSE_STATE_NONE;
-        return 0;
-    }
+                for (uint32_t j=0; j<n; j++)
+                {
+                    double y = ys[j];
+                    if (isnan (y) || isinf (y)) continue;
 
-    if (button == 1)
-    {
-        switch (cs->pressedModifiers)
-        {
-         case KMOD_NONE:
-             {
-                 cs->mouseState = MOUSE_STATE_SELECTING;
-                 uint32_t w = cs->windowWidth;
-                 uint32_t h = cs->windowHeight - cs->statuslineEnabled * STATUSLINE_HEIGHT;
-                 cs->mouseWindowPos.x = (double) xi / w;
-                 cs->mouseWindowPos.y = (double) yi / h;
-                 cs->activeSw->selectedWindowArea0.x0 = cs->mouseWindowPos.x;
-                 cs->activeSw->selectedWindowArea0.y0 = cs->mouseWindowPos.y;
-                 cs->activeSw->selectedWindowArea0.x1 = cs->mouseWindowPos.x;
-                 cs->activeSw->selectedWindowArea0.y1 = cs->mouseWindowPos.y;
+                    if (ymin > y) ymin = y;
+                    if (ymax < y) ymax = y;
+                    hasPoints = 1;
+                }
+                continue;
+            }
 
-                 cs->activeSw->selectedWindowArea1.x0 = cs->mouseWindowPos.x;
-                 cs->activeSw->selectedWindowArea1.y0 = cs->mouseWindowPos.y;
-                 cs->activeSw->selectedWindowArea1.x1 = cs->mouseWindowPos.x;
-                 cs->activeSw->selectedWindowArea1.y1 = cs->mouseWindowPos.y;
-                 break;
-             }
-         case KMOD_GUI:
-             {
-                 cs->mouseState = MOUSE_STATE_MOVING;
-                 break;
-             }
-         default:
-             break;
+            if (is3d)
+            {
+                graph_view_fetch (& view, 0, b, n, xs);
+                graph_view_fetch (& view, 1, b, n, ys);
+                graph_view_fetch (& view, 2, b, n, zs);
+                for (uint32_t j=0; j<n; j++)
+                {
+                    double src[3] = {xs[j], ys[j], zs[j]};
+                    double xyz[3];
+                    matrix_vector_multiply (sw->rotMatrix, src, xyz);
+
+                    double x2 = xyz[0];
+                    double y2 = xyz[1];
+                    double z2 = xyz[2];
+
+                    double scale = z2 * perspectiveFactor + 1;
+
+                    if (scale < 0)
+                    {
+                        xs[j] = NaN;
+                        continue;
+                    }
+
+                    xs[j] = x2 / scale;
+                    ys[j] = y2 / scale;
+
+                    if (isnan (z2) || isinf (z2))
+                        xs[j] = NaN;
+                }
+
+                if (sw->logMode & 1) log_transform (xs, n);
+                if (sw->logMode & 2) log_transform (ys, n);
+            }
+            else
+            {
+                graph_view_fetch_scaled (& view, 0, sw->logMode, b, n, xs);
+                graph_view_fetch_scaled (& view, 1, sw->logMode, b, n, ys);
+            }
+
+            for (uint32_t j=0; j<n; j++)
+            {
+                double x = xs[j];
+                double y = ys[j];
+
+                if (isnan (x) || isnan (y)) continue;
+                if (isinf (x) || isinf (y)) continue;
+
+                if (xmin > x) xmin = x;
+                if (xmax < x) xmax = x;
+                if (ymin > y) ymin = y;
+                if (ymax < y) ymax = y;
+            }
         }
-    }
-    else if (button == 3)
-    {
-        switch (cs->pressedModifiers)
+
+        if (xFromEnds && hasPoints)
         {
-         case KMOD_NONE:
-             {
-                 cs->mouseState = MOUSE_STATE_MOVING;
-                 break;
-             }
-         default:
-             break;
+            double x0 = graph_view_value (& view, 0, 0);
+            double x1 = graph_view_value (& view, 0, len - 1);
+            if (xmin > MIN (x0, x1)) xmin = MIN (x0, x1);
+            if (xmax < MAX (x0, x1)) xmax = MAX (x0, x1);
         }
+
+        graph_view_close (& view);
     }
 
+    if (xmin == DBL_MAX || xmax == -DBL_MAX || ymin == DBL_MAX || ymax == -DBL_MAX)
+        return 0;
+
+    double dx = xmax - xmin;
+    double dy = ymax - ymin;
+    double mx = dx * 0.0;
+    double my = dy * 0.05;
+
+    sw->dataRange.x0 = xmin - mx;
+    sw->dataRange.y0 = ymax + my;
+    sw->dataRange.x1 = xmax + mx;
+    sw->dataRange.y1 = ymin - my;
+
     return 1;
 }
 
-static int on_mouse_released (CipState *cs, int xi, int yi)
+int cip_autoscale (CipState *cs, uint32_t windowIndex)
 {
-    switch (cs->mouseState)
-    {
-     case MOUSE_STATE_SELECTING:
-         {
-             CipArea *swa0 = & cs->activeSw->selectedWindowArea0;
-             CipArea *swa1 = & cs->activeSw->selectedWindowArea1;
-             if (swa1->x0 == swa1->x1 && swa1->y0 == swa1->y1)
-                 cs->zoomEnabled ^= 1;
-             else
-             {
-
-                 CipSubWindow *sw = cs->activeSw;
-                 CipArea *dr  = & sw->dataRange;
-                 CipArea *swa = & sw->selectedWindowArea1;
-                 CipArea activeArea;
-                 CipArea zoomWindowArea = {0,0,1,1};
-                 get_active_area (cs, (cs->zoomEnabled ? & zoomWindowArea : & sw->windowArea), & activeArea);
-                 CipPosition wPos0 = {swa->x0, swa->y0};
-                 CipPosition wPos1 = {swa->x1, swa->y1};
-                 CipPosition dPos0, dPos1;
-
-                 transform_pos (& activeArea, & wPos0, & sw->dataRange, & dPos0);
-                 transform_pos (& activeArea, & wPos1, & sw->dataRange, & dPos1);
+    return cip_autoscale_sw (cip_get_sub_window (cs, windowIndex));
+}
 
-                 memcpy (& sw->defaultDataRange, & sw->dataRange, sizeof (CipArea));
-                 dr->x0 = dPos0.x;
-                 dr->y0 = dPos0.y;
-                 dr->x1 = dPos1.x;
-                 dr->y1 = dPos1.y;
-                 print ("zoom to new area [%f, %f] < [%f, %f] => ", dr->x0, dr->y0, dr->x1, dr->y1);
-             }
-             swa0->x0 = swa0->x1 = swa0->y0 = swa0->y1 = NaN;
-             swa1->x0 = swa1->x1 = swa1->y0 = swa1->y1 = NaN;
-             break;
-         }
-     default:
-         {
-             // do nothing
-         }
-    }
+void cip_set_range (CipSubWindow *sw, double xmin, double ymin, double xmax, double ymax, int setAsDefault)
+{
+    if (!sw)
+        exit_error ("bug");
 
-    cs->mouseState = MOUSE_STATE_NONE;
+    sw->dataRange.x0 = xmin;
+    sw->dataRange.y0 = ymax;
+    sw->dataRange.x1 = xmax;
+    sw->dataRange.y1 = ymin;
 
-    return 1;
+    if (setAsDefault)
+        memcpy (& sw->defaultDataRange, & sw->dataRange, sizeof (CipArea));
 }
 
-static void matMul(double A[3][3], double B[3][3], double C[3][3])
+void cip_set_x_range (CipState *cs, uint32_t windowIndex, double xmin, double xmax, int setAsDefault)
 {
-    for (int i = 0; i < 3; i++)
-        for (int j = 0; j < 3; j++)
-            C[i][j] = A[i][0] * B[0][j] + A[i][1] * B[1][j] + A[i][2] * B[2][j];
+    CipSubWindow *sw = cip_get_sub_window (cs, windowIndex);
+    if (!sw)
+        exit_error ("bug");
+
+    sw->dataRange.x0 = xmin;
+    sw->dataRange.x1 = xmax;
+
+    if (setAsDefault)
+        memcpy (& sw->defaultDataRange, & sw->dataRange, sizeof (CipArea));
 }
 
-void rotate_x (double mtx[3][3], double theta, int order)
+void cip_set_y_range (CipState *cs, uint32_t windowIndex, double ymin, double ymax, int setAsDefault)
 {
-    double rot[3][3] =
-    {
-        {1, 0, 0},
-        {0, cos(theta), -sin(theta)},
-        {0, sin(theta),  cos(theta)}
-    };
+    CipSubWindow *sw = cip_get_sub_window (cs, windowIndex);
+    if (!sw)
+        exit_error ("bug");
 
-    double tmp[3][3];
-    if (order)
-        matMul (rot, mtx, tmp);
-    else
-        matMul (mtx, rot, tmp);
+    sw->dataRange.y0 = ymax;
+    sw->dataRange.y1 = ymin;
 
-    for (int i = 0; i < 3; i++)
-        for (int j = 0; j < 3; j++)
-            mtx[i][j] = tmp[i][j];
+    if (setAsDefault)
+        memcpy (& sw->defaultDataRange, & sw->dataRange, sizeof (CipArea));
 }
 
-void rotate_y (double mtx[3][3], double theta, int order)
+int cip_continuous_scroll_update (CipSubWindow *sw)
 {
-    double rot[3][3] =
+    double xmin =  DBL_MAX;
+    double xmax = -DBL_MAX;
+
+    GraphAttacher **ag = sw->attachedGraphs;
+    for (int i=0; i<sw->numAttachedGraphs; i++)
     {
-        {cos(theta), 0, -sin(theta)},
-        {0, 1, 0},
-        {sin(theta), 0, cos(theta)}
-    };
+        CipGraph *graph = ag[i]->graph;
 
-    double tmp[3][3];
-    if (order)
-        matMul (rot, mtx, tmp);
-    else
-        matMul (mtx, rot, tmp);
+        GraphView view;
+        uint32_t len = graph_view_open (graph, & view);
 
-    for (int i = 0; i < 3; i++)
-        for (int j = 0; j < 3; j++)
-            mtx[i][j] = tmp[i][j];
+        if (len)
+        {
+            double x0 = graph_view_value (& view, 0, 0);
+            double x1 = graph_view_value (& view, 0, len - 1);
+            if (xmin > x0) xmin = x0;
+            if (xmax < x1) xmax = x1;
+        }
+
+        graph_view_close (& view);
+    }
+
+    if (xmin == DBL_MAX || xmax == -DBL_MAX)
+        return 0;
+
+    double width = sw->dataRange.x1 - sw->dataRange.x0;
+    sw->dataRange.x1 = xmax;
+    sw->dataRange.x0 = sw->dataRange.x1 - width;
+
+    return 1;
 }
 
-void rotate_z (double mtx[3][3], double theta, int order)
+
+void cip_continuous_scroll_enable (CipState *cs, uint32_t windowIndex)     { CipSubWindow *sw = cip_get_sub_window (cs, windowIndex); if (sw) sw->continuousScroll=1; }
+void cip_continuous_scroll_disable (CipState *cs, uint32_t windowIndex)    { CipSubWindow *sw = cip_get_sub_window (cs, windowIndex); if (sw) sw->continuousScroll=0; }
+int  cip_set_grid_mode (CipState *cs, uint32_t windowIndex, uint32_t mode) { CipSubWindow *sw = cip_get_sub_window (cs, windowIndex); return cip_set_grid_mode_sw (sw, mode); }
+int  cip_set_grid_mode_sw (CipSubWindow *sw, uint32_t mode) { if (sw) sw->gridMode = mode & 3; return 1; }
+int  cip_force_refresh (CipState *cs)                            { cs->forceRefresh = 1;        return 1; }
+int  cip_is_running (CipState *cs)                               { return cs->running; }
+void cip_redraw_async(CipState *cs)                              { cs->redraw=1; }
+void cip_set_bg_shade (CipState *cs, float bgShade)              { cs->bgShade = bgShade; }
+int  cip_set_crosshair_enabled (CipState *cs, uint32_t enabled)  { cs->crosshairEnabled  = enabled & 1; return 1; }
+int  cip_set_statusline_enabled (CipState *cs, uint32_t enabled) { cs->statuslineEnabled = enabled & 1; return 1; }
+int  cip_set_tracking_mode (CipState *cs, uint32_t mode)         { cs->trackingMode = mode & 3; return 1; }
+int  cip_toggle_paused (CipState *cs)                            { paused ^= 1;                 return 1; }
+int  cip_quit (CipState *cs)                                     { cs->running = 0; paused=0;   return 0; }
+
+static int toggle_help (CipState *cs)                            { cs->showHelp ^= 1;           return 1; }
+
+static int cycle_selected_graph (CipSubWindow *sw, uint32_t step)
 {
-    double rot[3][3] =
-    {
-        {cos(theta), -sin(theta), 0},
-        {sin(theta),  cos(theta), 0},
-        {0, 0, 1}
-    };
+    sw->selectedGraph = sw->numAttachedGraphs ? (sw->selectedGraph + step) % sw->numAttachedGraphs : 0;
+    return 1;
+}
 
-    double tmp[3][3];
-    if (order)
-        matMul (rot, mtx, tmp);
-    else
-        matMul (mtx, rot, tmp);
+static void undo_zooming (CipSubWindow *sw)
+{
+    if (!sw)
+        return;
+    if (sw->defaultDataRange.x0 == sw->defaultDataRange.x1)
+        return;
+    if (sw->defaultDataRange.y0 == sw->defaultDataRange.y1)
+        return;
 
-    for (int i = 0; i < 3; i++)
-        for (int j = 0; j < 3; j++)
-            mtx[i][j] = tmp[i][j];
+    memcpy (& sw->dataRange, & sw->defaultDataRange, sizeof (CipArea));
 }
 
-static void normalise_matrix (double mtx[3][3])
+static void transform_pos (const CipArea *srcArea, const CipPosition *srcPos, const CipArea *dstArea, CipPosition *dstPos)
 {
-    double norm;
+    double xf = (srcPos->x - srcArea->x0) / (srcArea->x1 - srcArea->x0);
+    double yf = (srcPos->y - srcArea->y0) / (srcArea->y1 - srcArea->y0);
+    dstPos->x = xf * (dstArea->x1 - dstArea->x0) + dstArea->x0;
+    dstPos->y = yf * (dstArea->y1 - dstArea->y0) + dstArea->y0;
+}
 
-    // Normalize first column
-    norm = sqrt(mtx[0][0] * mtx[0][0] + mtx[1][0] * mtx[1][0] + mtx[2][0] * mtx[2][0]);
-    mtx[0][0] /= norm;
-    mtx[1][0] /= norm;
-    mtx[2][0] /= norm;
+static void get_active_area (CipState *cs, CipArea *src, CipArea *dst)
+{
+    uint32_t w = cs->windowWidth;
+    uint32_t h = cs->windowHeight - cs->statuslineEnabled * STATUSLINE_HEIGHT;
 
-    // Make second column orthogonal to first and normalize
-    double dot = mtx[0][0] * mtx[0][1] + mtx[1][0] * mtx[1][1] + mtx[2][0] * mtx[2][1];
-    mtx[0][1] -= dot * mtx[0][0];
-    mtx[1][1] -= dot * mtx[1][0];
-    mtx[2][1] -= dot * mtx[2][0];
+    double xp = (double) (cs->bordered + cs->margin) / w;
+    double yp = (double) (cs->bordered + cs->margin) / h;
 
-    norm = sqrt(mtx[0][1] * mtx[0][1] + mtx[1][1] * mtx[1][1] + mtx[2][1] * mtx[2][1]);
-    mtx[0][1] /= norm;
-    mtx[1][1] /= norm;
-    mtx[2][1] /= norm;
+    double epsw = 1.0 / cs->windowWidth;
+    double epsh = 1.0 / cs->windowHeight;
 
-    // Compute third column as cross product of first two
-    mtx[0][2] = mtx[1][0] * mtx[2][1] - mtx[2][0] * mtx[1][1];
-    mtx[1][2] = mtx[2][0] * mtx[0][1] - mtx[0][0] * mtx[2][1];
-    mtx[2][2] = mtx[0][0] * mtx[1][1] - mtx[1][0] * mtx[0][1];
+    dst->x0 = src->x0 + xp;
+    dst->y0 = src->y0 + yp;
+    dst->x1 = src->x1 - xp - epsw;
+    dst->y1 = src->y1 - yp - epsh;
 }
 
-static int on_mouse_wheel (CipState *cs, float xf, float yf)
+int cip_set_log_mode_sw (CipState *cs, CipSubWindow *sw, uint32_t mode)
 {
-    CipSubWindow *sw = cs->activeSw;
-    if (sw && cs->mouseState == MOUSE_STATE_NONE)
-    {
-        if (cs->pressedModifiers == KMOD_GUI)
-        {
-            // zooming
-            CipArea *dr = & sw->dataRange;
-            double a = (sw->mouseDataPos.x - dr->x0) / (dr->x1 - dr->x0);
-            double b = (sw->mouseDataPos.y - dr->y0) / (dr->y1 - dr->y0);
+    if (!sw)
+        return 0;
 
-            double dx = -0.05 * (dr->x1 - dr->x0) * xf;
-            double dy = -0.05 * (dr->y1 - dr->y0) * yf;
-            dr->x0 += dx * a;
-            dr->x1 -= dx * (1-a);
-            dr->y0 += dy * b;
-            dr->y1 -= dy * (1-b);
-            return 1;
-        }
-        else if (cs->pressedModifiers == KMOD_ALT)
-        {
-            perspectiveFactor -= 0.01 * xf;
-            if (perspectiveFactor < 0)
-                perspectiveFactor = 0;
+    mode &= 3;
 
-            rotate_z (sw->rotMatrix, -yf * 0.08, 1);
-            //print_debug ("perspectiveFactor: %f", perspectiveFactor);
-        }
-        else if (cs->pressedModifiers == KMOD_SHIFT)
-        {
-            double center0[3] = {cx,cy,cz};
-            double centerRotated0[3];
-            matrix_vector_multiply (sw->rotMatrix, center0, centerRotated0);
-            double scale0 = centerRotated0[2] * perspectiveFactor + 1;
-            centerRotated0[0] /= scale0;
-            centerRotated0[1] /= scale0;
+    int xIsLog = sw->logMode & 1;
+    int yIsLog = sw->logMode & 2;
 
-            rotate_x (sw->rotMatrix, -yf * 0.08, 1);
-            rotate_y (sw->rotMatrix, -xf * 0.08, 1);
-            normalise_matrix (sw->rotMatrix);
+    int xWantsLog = mode & 1;
+    int yWantsLog = mode & 2;
 
-            double center1[3] = {cx,cy,cz};
-            double centerRotated1[3];
-            matrix_vector_multiply (sw->rotMatrix, center1, centerRotated1);
-
-            double scale1 = centerRotated1[2] * perspectiveFactor + 1;
-            centerRotated1[0] /= scale1;
-            centerRotated1[1] /= scale1;
-
-            double dx = centerRotated1[0] - centerRotated0[0];
-            double dy = centerRotated1[1] - centerRotated0[1];
-            double dz = centerRotated1[2] - centerRotated0[2];
-            (void) dz;
-
-
-            CipArea *dr = & sw->dataRange;
-            dr->x0 += dx;
-            dr->x1 += dx;
-            dr->y0 += dy;
-            dr->y1 += dy;
+    CipArea activeArea;
+    CipArea zoomWindowArea = {0,0,1,1};
+    get_active_area (cs, & zoomWindowArea, & activeArea);
+    CipPosition winPos;
+    transform_pos (& sw->dataRange, & sw->mouseDataPos, & activeArea, & winPos);
 
-            cs->forceRefresh = 1;
-            return 1;
+    if (xIsLog != xWantsLog)
+    {
+        if (xWantsLog)
+        {
+            sw->mouseDataPos.x = LOGFUN (sw->mouseDataPos.x);
+            sw->dataRange.x0   = LOGFUN (sw->dataRange.x0);
+            sw->dataRange.x1   = LOGFUN (sw->dataRange.x1);
         }
         else
         {
-            // moving
-            CipSubWindow *sw = cs->activeSw;
-            CipArea *dr = & sw->dataRange;
-
-            double dx = xf * 0.01;
-            double dy = yf * 0.01;
-
-             CipArea activeArea;
-             CipArea zoomWindowArea = {0,0,1,1};
-             if (cs->zoomEnabled)
-                 get_active_area (cs, & zoomWindowArea, & activeArea);
-             else
-                 get_active_area (cs, & sw->windowArea, & activeArea);
-
-             dx /= activeArea.x1 - activeArea.x0;
-             dy /= activeArea.y1 - activeArea.y0;
-
-             dx *= dr->x1 - dr->x0;
-             dy *= dr->y1 - dr->y0;
-
-            //printn ("moving window [%f, %f] < [%f, %f] => ", dr->x0, dr->y0, dr->x1, dr->y1);
-            dr->x0 += dx;
-            dr->x1 += dx;
-            dr->y0 -= dy;
-            dr->y1 -= dy;
-            sw->mouseDataPos.x += dx;
-            sw->mouseDataPos.y -= dy;
-            //print ("[%f, %f] < [%f, %f] => ", dr->x0, dr->y0, dr->x1, dr->y1);
-            return 1;
+            sw->dataRange.x0   = EXPFUN (sw->dataRange.x0);
+            sw->dataRange.x1   = EXPFUN (sw->dataRange.x1);
+            sw->mouseDataPos.x = EXPFUN (sw->mouseDataPos.x);
         }
     }
-    return 0;
-}
-
-static int find_closest_point (CipHistogram *hist, uint32_t _x0, uint32_t _y0, uint32_t *_x, uint32_t *_y)
-{
-    // this algorithm takes a point (x0,y0) and spirals around it with a rectangular
-    // spiral until it finds a point in the histogram that is set. When it is found,
-    // it will make sure it will stop the loop after it is sure no other point can
-    // be closer. The spiral looks like this:
-    //   >>>>>>>>>|
-    //   ^>>>>>>>||
-    //   ^^>>>>>|||
-    //   ^^^>>>||||
-    //   ^^^^>|||||
-    //   ^^^^<<||||
-    //   ^^^<<<<|||
-    //   ^^<<<<<<||
-    //   ^<<<<<<<<|
-
-    int x0 = (int) _x0;
-    int y0 = (int) _y0;
-
-    int dirx[4] = {1, 0, -1,  0};
-    int diry[4] = {0, 1,  0, -1};
-
-    int w = (int) hist->w;
-    int h = (int) hist->h;
-    int *bins = hist->bins;
-
-    int x = x0;
-    int y = y0;
-
-    int maxSideLen = w+w+h+h;
-    int minD2 = w*w+h*h;
 
-    int sideLen = 1;
-    int dir = 0;
-    int sideCount = 0;
-    int outsideCount = 0;
-    int bestX = -1;
-    int bestY = -1;
-    while (outsideCount < 4 && sideLen <= maxSideLen)
+    if (yIsLog != yWantsLog)
     {
-        int sideInside = (dirx[dir] && (0 <= y && y < h)) || (diry[dir] && (0 <= x && x < w));
-        if (sideInside)
+        if (yWantsLog)
         {
-            outsideCount = 0;
-            for (int i=0; i<sideLen; i++)
-            {
-                if (0 <= y && y < h && 0 <= x && x < w)
-                {
-                    if (bins[y*w+x])
-                    {
-                        int newMaxSideLen = (int) (1.41421356 * sideLen) + 1;
-                        if (maxSideLen < newMaxSideLen)
-                            maxSideLen = newMaxSideLen;
-                        int dx = x - x0;
-                        int dy = y - y0;
-                        int d2 = dx*dx+dy*dy;
-                        if (minD2 > d2)
-                        {
-                            minD2 = d2;
-                            bestX = x;
-                            bestY = y;
-                        }
-                    }
-                }
-                x += dirx[dir];
-                y += diry[dir];
-            }
+            sw->dataRange.y0   = LOGFUN (sw->dataRange.y0);
+            sw->dataRange.y1   = LOGFUN (sw->dataRange.y1);
+            sw->mouseDataPos.y = LOGFUN (sw->mouseDataPos.y);
         }
         else
         {
-            x += dirx[dir] * sideLen;
-            y += diry[dir] * sideLen;
-            outsideCount++;
-        }
-
-        dir = (dir + 1) % 4;
-        if (++sideCount == 2)
-        {
-            sideCount = 0;
-            sideLen++;
+            sw->dataRange.y0   = EXPFUN (sw->dataRange.y0);
+            sw->dataRange.y1   = EXPFUN (sw->dataRange.y1);
+            sw->mouseDataPos.y = EXPFUN (sw->mouseDataPos.y);
         }
     }
-    if (bestX < 0 || bestY < 0)
+
+    sw->logMode = mode & 3;
+
+    if (isnan (sw->dataRange.x0) || isnan (sw->dataRange.x1) ||
+        isnan (sw->dataRange.y0) || isnan (sw->dataRange.y1))
     {
-        print_debug ("no point found");
-        return -1;
+        cip_autoscale_sw (sw);
     }
 
-    *_x = (uint32_t) bestX;
-    *_y = (uint32_t) bestY;
+    transform_pos (& activeArea, & winPos, & sw->dataRange, & sw->mouseDataPos);
 
-    return 0;
+    return 1;
 }
 
-static int on_mouse_motion (CipState *cs, int xi, int yi)
+int cip_set_log_mode (CipState *cs, uint32_t windowIndex, uint32_t mode)
 {
-    switch (cs->mouseState)
+    return cip_set_log_mode_sw (cs, cip_get_sub_window (cs, windowIndex), mode);
+}
+
+static void sub_window_change (CipState *cs, int dir)
+{
+    int index = (int) (cs->activeSw - cs->subWindows);
+    index += dir;
+    if (index < 0)
+        index = 0;
+    if (index > (int) cs->numSubWindows - 1)
+        index = (int) cs->numSubWindows - 1;
+    if (cs->zoomEnabled)
     {
-     case MOUSE_STATE_NONE:
-         {
-             uint32_t w = cs->windowWidth;
-             uint32_t h = cs->windowHeight - cs->statuslineEnabled * STATUSLINE_HEIGHT;
-             CipArea activeArea;
+        CipSubWindow *sw0 = cs->activeSw;
+        CipSubWindow *sw1 = & cs->subWindows[index];
+        CipArea activeArea;
+        CipArea zoomWindowArea = {0,0,1,1};
+        get_active_area (cs, & zoomWindowArea, & activeArea);
+        CipPosition winPos;
+        transform_pos (& sw0->dataRange, & sw0->mouseDataPos, & activeArea, & winPos);
+        transform_pos (& activeArea, & winPos, & sw1->dataRange, & sw1->mouseDataPos);
+    }
+    cs->activeSw = & cs->subWindows[index];
+}
 
-             if (!cs->zoomEnabled)
-                 cs->activeSw = NULL;
+int cip_zoom (CipSubWindow *sw, double xf, double yf)
+{
+    if (!sw)
+        return 0;
+    CipArea *dr = & sw->dataRange;
+    double dx = (dr->x1 - dr->x0) * xf;
+    double dy = (dr->y1 - dr->y0) * yf;
+    dr->x0 += dx;
+    dr->x1 -= dx;
+    dr->y0 += dy;
+    dr->y1 -= dy;
+    return 1;
+}
 
-             for (int i=0; i<cs->numSubWindows; i++)
-             {
-                 CipSubWindow *sw;
-                 if (cs->zoomEnabled)
-                 {
-                     sw = cs->activeSw;
-                     CipArea zoomWindowArea = {0,0,1,1};
-                     get_active_area (cs, & zoomWindowArea, & activeArea);
-                 }
-                 else
-                 {
-                     sw = & cs->subWindows[i];
-                     get_active_area (cs, & sw->windowArea, & activeArea);
-                 }
+int cip_move (CipSubWindow *sw, double xf, double yf)
+{
+    if (!sw)
+        return 0;
+    CipArea *dr = & sw->dataRange;
+    double dx = (dr->x1 - dr->x0) * xf;
+    double dy = (dr->y1 - dr->y0) * yf;
+    dr->x0 -= dx;
+    dr->x1 -= dx;
+    dr->y0 -= dy;
+    dr->y1 -= dy;
+    return 1;
+}
 
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
+#endif
 
-                 cs->mouseWindowPos.x = (double) xi / w;
-                 cs->mouseWindowPos.y = (double) yi / h;
-                 transform_pos (& activeArea, & cs->mouseWindowPos, & sw->dataRange, & sw->mouseDataPos);
+static char *make_title(char *buf, size_t size)
+{
+#ifdef __APPLE__
+    char path[4096];
+    uint32_t n = sizeof(path);
 
-                 if (activeArea.x0 <= cs->mouseWindowPos.x && cs->mouseWindowPos.x <= activeArea.x1 &&
-                     activeArea.y0 <= cs->mouseWindowPos.y && cs->mouseWindowPos.y <= activeArea.y1)
-                     cs->activeSw = sw;
+    if (!buf || size == 0)
+        return NULL;
 
-                 if (cs->zoomEnabled)
-                     break;
-             }
+    if (_NSGetExecutablePath(path, &n) != 0) {
+        buf[0] = '\0';
+        return buf;
+    }
 
-             if (cs->trackingMode && cs->activeSw && cs->activeSw->numAttachedGraphs > 0)
+    char *name = strrchr(path, '/');
+    if (!name) {
+        snprintf(buf, size, "%s", path);
+        return buf;
+    }
+
+    *name++ = '\0';
+
+    char *dir = strrchr(path, '/');
+    dir = dir ? dir + 1 : path;
+
+    snprintf(buf, size, "%s:%s", dir, name);
+    return buf;
+#else
+    if (buf && size)
+        snprintf (buf, size, "%s", CINTERPLOT_TITLE);
+    return buf;
+#endif
+}
+
+static void reinitialise_sdl_context (CipState *cs, int reinitWindow)
+{
+    if (iconData)
+    {
+        void *ptr = iconData;
+        iconData = NULL;
+        free (ptr);
+    }
+
+    if (cs->texture)
+        SDL_DestroyTexture (cs->texture);
+    if (cs->renderer)
+        SDL_DestroyRenderer (cs->renderer);
+
+    if (reinitWindow)
+    {
+        if (cs->window)
+            SDL_DestroyWindow (cs->window);
+
+        char title[256];
+        make_title (title, sizeof (title));
+
+        cs->window = SDL_CreateWindow (title, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                                       (int) cs->windowWidth, (int) cs->windowHeight, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+        if (!cs->window)
+            exit_error ("Window could not be created: SDL Error: %s\n", SDL_GetError ());
+    }
+
+    cs->renderer = SDL_CreateRenderer (cs->window, -1, SDL_RENDERER_ACCELERATED);
+    if (!cs->renderer)
+        exit_error ("Renderer could not be created! SDL Error: %s\n", SDL_GetError ());
+
+    cs->texture = SDL_CreateTexture (cs->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                     (int) cs->windowWidth, (int) cs->windowHeight);
+    if (!cs->texture)
+        exit_error ("Texture could not be created: SDL Error: %s\n", SDL_GetError ());
+
+    SDL_SetWindowFullscreen (cs->window, cs->fullscreen ? SDL_WINDOW_FULLSCREEN_DESKTOP : 0);
+
+    iconData = malloc (sizeof (uint32_t) * cs->windowWidth * cs->windowHeight);
+    if (!iconData)
+        print_error ("failed to allocate iconData buffer");
+}
+
+int cip_set_fullscreen (CipState *cs, uint32_t fullscreen)
+{
+    cs->fullscreen = fullscreen & 1;
+
+    if (cs->fullscreen)
+    {
+        SDL_DisplayMode displayMode;
+        SDL_GetCurrentDisplayMode (0, & displayMode);
+        assert (displayMode.w > 0);
+        assert (displayMode.h > 0);
+        print_debug ("fullscreen res: %u %u", displayMode.w, displayMode.h);
+        cs->windowWidth  = (uint32_t) displayMode.w;
+        cs->windowHeight = (uint32_t) displayMode.h;
+    }
+    else
+    {
+        cs->windowWidth  = CINTERPLOT_INIT_WIDTH;
+        cs->windowHeight = CINTERPLOT_INIT_HEIGHT;
+    }
+
+    reinitialise_sdl_context (cs, 1);
+    return 1;
+}
+
+static void lineRGBA (uint32_t *pixels, uint32_t _w, uint32_t _h, uint32_t _x0, uint32_t _y0, uint32_t _x1, uint32_t _y1, uint32_t color)
+{
+    if (!pixels)
+        return;
+
+    int w  = (int) _w;
+    int h  = (int) _h;
+    int x0 = (int) _x0;
+    int y0 = (int) _y0;
+    int x1 = (int) _x1;
+    int y1 = (int) _y1;
+
+    int xabs = (x1 > x0) ? x1 - x0 : x0 - x1;
+    int yabs = (y1 > y0) ? y1 - y0 : y0 - y1;
+
+    if (xabs > yabs)
+    {
+        int xstart = ((x0 < x1) ? x0 : x1);
+        int xstop  = xstart + xabs;
+
+        if (xstart <   0) xstart = 0;
+        if (xstart > w-1) xstart = w-1;
+        if (xstop <    0) xstop  = 0;
+        if (xstop >  w-1) xstop  = w-1;
+
+        for (int x=xstart; x<=xstop; x++)
+        {
+            int y = (int) (y0 + ((double) (x - x0) / (x1 - x0) * (y1 - y0) + 0.5));
+            if (x>=0 && y>=0 && x<w && y<h)
+                pixels[y*w+x] = color;
+        }
+    }
+    else if (yabs >= xabs && y0 != y1)
+    {
+        int ystart = ((y0 < y1) ? y0 : y1);
+        int ystop  = ystart + yabs;
+
+        if (ystart <   0) ystart = 0;
+        if (ystart > h-1) ystart = h-1;
+        if (ystop <    0) ystop  = 0;
+        if (ystop >  h-1) ystop  = h-1;
+
+        for (int y=ystart; y<=ystop; y++)
+        {
+            int x = (int) (x0 + ((double) (y - y0) / (y1 - y0) * (x1 - x0) + 0.5));
+            if (x>=0 && y>=0 && x<w && y<h)
+                pixels[y*w+x] = color;
+        }
+    }
+    else
+    {
+        int x = x0;
+        int y = y0;
+        if (x>=0 && y>=0 && x<w && y<h)
+            pixels[y*w+x] = color;
+    }
+}
+
+void cip_histogram_line (CipHistogram *hist, int x0, int y0, int x1, int y1)
+{
+    raster_line (hist->bins, hist->w, hist->h, x0, y0, x1, y1);
+}
+
+static void draw_rect (uint32_t* pixels, uint32_t w, uint32_t h, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, uint32_t color)
+{
+    if (x1 < x0)
+    {
+        x1 ^= x0;
+        x0 ^= x1;
+        x1 ^= x0;
+    }
+    if (y1 < y0)
+    {
+        y1 ^= y0;
+        y0 ^= y1;
+        y1 ^= y0;
+    }
+    if (!pixels)
+        return;
+
+    for (uint32_t yi=y0; yi<=y1 && yi<h; yi++)
+    {
+        pixels[yi*w + x0] = color;
+        pixels[yi*w + x1] = color;
+    }
+    for (uint32_t xi=x0; xi<=x1 && xi<w; xi++)
+    {
+        pixels[y0*w + xi] = color;
+        pixels[y1*w + xi] = color;
+    }
+}
+
+
+static int on_mouse_pressed (CipState *cs, int xi, int yi, int button, int clicks)
+{
+    if (cs->activeSw == NULL)
+    {
+        cs->mouseState = MOUSE_STATE_NONE;
+        return 0;
+    }
+
+    if (button == 1)
+    {
+        switch (cs->pressedModifiers)
+        {
+         case KMOD_NONE:
+             {
+                 cs->mouseState = MOUSE_STATE_SELECTING;
+                 uint32_t w = cs->windowWidth;
+                 uint32_t h = cs->windowHeight - cs->statuslineEnabled * STATUSLINE_HEIGHT;
+                 cs->mouseWindowPos.x = (double) xi / w;
+                 cs->mouseWindowPos.y = (double) yi / h;
+                 cs->activeSw->selectedWindowArea0.x0 = cs->mouseWindowPos.x;
+                 cs->activeSw->selectedWindowArea0.y0 = cs->mouseWindowPos.y;
+                 cs->activeSw->selectedWindowArea0.x1 = cs->mouseWindowPos.x;
+                 cs->activeSw->selectedWindowArea0.y1 = cs->mouseWindowPos.y;
+
+                 cs->activeSw->selectedWindowArea1.x0 = cs->mouseWindowPos.x;
+                 cs->activeSw->selectedWindowArea1.y0 = cs->mouseWindowPos.y;
+                 cs->activeSw->selectedWindowArea1.x1 = cs->mouseWindowPos.x;
+                 cs->activeSw->selectedWindowArea1.y1 = cs->mouseWindowPos.y;
+                 break;
+             }
+         case KMOD_GUI:
+             {
+                 cs->mouseState = MOUSE_STATE_MOVING;
+                 break;
+             }
+         default:
+             break;
+        }
+    }
+    else if (button == 3)
+    {
+        switch (cs->pressedModifiers)
+        {
+         case KMOD_NONE:
+             {
+                 cs->mouseState = MOUSE_STATE_MOVING;
+                 break;
+             }
+         default:
+             break;
+        }
+    }
+
+    return 1;
+}
+
+static int on_mouse_released (CipState *cs, int xi, int yi)
+{
+    switch (cs->mouseState)
+    {
+     case MOUSE_STATE_SELECTING:
+         {
+             CipArea *swa0 = & cs->activeSw->selectedWindowArea0;
+             CipArea *swa1 = & cs->activeSw->selectedWindowArea1;
+             if (swa1->x0 == swa1->x1 && swa1->y0 == swa1->y1)
+                 cs->zoomEnabled ^= 1;
+             else
              {
+
                  CipSubWindow *sw = cs->activeSw;
-                 if (cs->zoomEnabled)
-                 {
-                     CipArea zoomWindowArea = {0,0,1,1};
-                     get_active_area (cs, & zoomWindowArea, & activeArea);
-                 }
-                 else
-                 {
+                 CipArea *dr  = & sw->dataRange;
+                 CipArea *swa = & sw->selectedWindowArea1;
+                 CipArea activeArea;
+                 CipArea zoomWindowArea = {0,0,1,1};
+                 get_active_area (cs, (cs->zoomEnabled ? & zoomWindowArea : & sw->windowArea), & activeArea);
+                 CipPosition wPos0 = {swa->x0, swa->y0};
+                 CipPosition wPos1 = {swa->x1, swa->y1};
+                 CipPosition dPos0, dPos1;
+
+                 transform_pos (& activeArea, & wPos0, & sw->dataRange, & dPos0);
+                 transform_pos (& activeArea, & wPos1, & sw->dataRange, & dPos1);
+
+                 memcpy (& sw->defaultDataRange, & sw->dataRange, sizeof (CipArea));
+                 dr->x0 = dPos0.x;
+                 dr->y0 = dPos0.y;
+                 dr->x1 = dPos1.x;
+                 dr->y1 = dPos1.y;
+                 print ("zoom to new area [%f, %f] < [%f, %f] => ", dr->x0, dr->y0, dr->x1, dr->y1);
+             }
+             swa0->x0 = swa0->x1 = swa0->y0 = swa0->y1 = NaN;
+             swa1->x0 = swa1->x1 = swa1->y0 = swa1->y1 = NaN;
+             break;
+         }
+     default:
+         {
+             // do nothing
+         }
+    }
+
+    cs->mouseState = MOUSE_STATE_NONE;
+
+    return 1;
+}
+
+static void matMul(double A[3][3], double B[3][3], double C[3][3])
+{
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            C[i][j] = A[i][0] * B[0][j] + A[i][1] * B[1][j] + A[i][2] * B[2][j];
+}
+
+void rotate_x (double mtx[3][3], double theta, int order)
+{
+    double rot[3][3] =
+    {
+        {1, 0, 0},
+        {0, cos(theta), -sin(theta)},
+        {0, sin(theta),  cos(theta)}
+    };
+
+    double tmp[3][3];
+    if (order)
+        matMul (rot, mtx, tmp);
+    else
+        matMul (mtx, rot, tmp);
+
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            mtx[i][j] = tmp[i][j];
+}
+
+void rotate_y (double mtx[3][3], double theta, int order)
+{
+    double rot[3][3] =
+    {
+        {cos(theta), 0, -sin(theta)},
+        {0, 1, 0},
+        {sin(theta), 0, cos(theta)}
+    };
+
+    double tmp[3][3];
+    if (order)
+        matMul (rot, mtx, tmp);
+    else
+        matMul (mtx, rot, tmp);
+
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            mtx[i][j] = tmp[i][j];
+}
+
+void rotate_z (double mtx[3][3], double theta, int order)
+{
+    double rot[3][3] =
+    {
+        {cos(theta), -sin(theta), 0},
+        {sin(theta),  cos(theta), 0},
+        {0, 0, 1}
+    };
+
+    double tmp[3][3];
+    if (order)
+        matMul (rot, mtx, tmp);
+    else
+        matMul (mtx, rot, tmp);
+
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            mtx[i][j] = tmp[i][j];
+}
+
+static void normalise_matrix (double mtx[3][3])
+{
+    double norm;
+
+    // Normalize first column
+    norm = sqrt(mtx[0][0] * mtx[0][0] + mtx[1][0] * mtx[1][0] + mtx[2][0] * mtx[2][0]);
+    mtx[0][0] /= norm;
+    mtx[1][0] /= norm;
+    mtx[2][0] /= norm;
+
+    // Make second column orthogonal to first and normalize
+    double dot = mtx[0][0] * mtx[0][1] + mtx[1][0] * mtx[1][1] + mtx[2][0] * mtx[2][1];
+    mtx[0][1] -= dot * mtx[0][0];
+    mtx[1][1] -= dot * mtx[1][0];
+    mtx[2][1] -= dot * mtx[2][0];
+
+    norm = sqrt(mtx[0][1] * mtx[0][1] + mtx[1][1] * mtx[1][1] + mtx[2][1] * mtx[2][1]);
+    mtx[0][1] /= norm;
+    mtx[1][1] /= norm;
+    mtx[2][1] /= norm;
+
+    // Compute third column as cross product of first two
+    mtx[0][2] = mtx[1][0] * mtx[2][1] - mtx[2][0] * mtx[1][1];
+    mtx[1][2] = mtx[2][0] * mtx[0][1] - mtx[0][0] * mtx[2][1];
+    mtx[2][2] = mtx[0][0] * mtx[1][1] - mtx[1][0] * mtx[0][1];
+}
+
+static int on_mouse_wheel (CipState *cs, float xf, float yf)
+{
+    CipSubWindow *sw = cs->activeSw;
+    if (sw && cs->mouseState == MOUSE_STATE_NONE)
+    {
+        if (cs->pressedModifiers == KMOD_GUI)
+        {
+            // zooming
+            CipArea *dr = & sw->dataRange;
+            double a = (sw->mouseDataPos.x - dr->x0) / (dr->x1 - dr->x0);
+            double b = (sw->mouseDataPos.y - dr->y0) / (dr->y1 - dr->y0);
+
+            double dx = -0.05 * (dr->x1 - dr->x0) * xf;
+            double dy = -0.05 * (dr->y1 - dr->y0) * yf;
+            dr->x0 += dx * a;
+            dr->x1 -= dx * (1-a);
+            dr->y0 += dy * b;
+            dr->y1 -= dy * (1-b);
+            return 1;
+        }
+        else if (cs->pressedModifiers == KMOD_ALT)
+        {
+            perspectiveFactor -= 0.01 * xf;
+            if (perspectiveFactor < 0)
+                perspectiveFactor = 0;
+
+            rotate_z (sw->rotMatrix, -yf * 0.08, 1);
+            //print_debug ("perspectiveFactor: %f", perspectiveFactor);
+        }
+        else if (cs->pressedModifiers == KMOD_SHIFT)
+        {
+            double center0[3] = {cx,cy,cz};
+            double centerRotated0[3];
+            matrix_vector_multiply (sw->rotMatrix, center0, centerRotated0);
+            double scale0 = centerRotated0[2] * perspectiveFactor + 1;
+            centerRotated0[0] /= scale0;
+            centerRotated0[1] /= scale0;
+
+            rotate_x (sw->rotMatrix, -yf * 0.08, 1);
+            rotate_y (sw->rotMatrix, -xf * 0.08, 1);
+            normalise_matrix (sw->rotMatrix);
+
+            double center1[3] = {cx,cy,cz};
+            double centerRotated1[3];
+            matrix_vector_multiply (sw->rotMatrix, center1, centerRotated1);
+
+            double scale1 = centerRotated1[2] * perspectiveFactor + 1;
+            centerRotated1[0] /= scale1;
+            centerRotated1[1] /= scale1;
+
+            double dx = centerRotated1[0] - centerRotated0[0];
+            double dy = centerRotated1[1] - centerRotated0[1];
+            double dz = centerRotated1[2] - centerRotated0[2];
+            (void) dz;
+
+
+            CipArea *dr = & sw->dataRange;
+            dr->x0 += dx;
+            dr->x1 += dx;
+            dr->y0 += dy;
+            dr->y1 += dy;
+
+            cs->forceRefresh = 1;
+            return 1;
+        }
+        else
+        {
+            // moving
+            CipSubWindow *sw = cs->activeSw;
+            CipArea *dr = & sw->dataRange;
+
+            double dx = xf * 0.01;
+            double dy = yf * 0.01;
+
+             CipArea activeArea;
+             CipArea zoomWindowArea = {0,0,1,1};
+             if (cs->zoomEnabled)
+                 get_active_area (cs, & zoomWindowArea, & activeArea);
+             else
+                 get_active_area (cs, & sw->windowArea, & activeArea);
+
+             dx /= activeArea.x1 - activeArea.x0;
+             dy /= activeArea.y1 - activeArea.y0;
+
+             dx *= dr->x1 - dr->x0;
+             dy *= dr->y1 - dr->y0;
+
+            //printn ("moving window [%f, %f] < [%f, %f] => ", dr->x0, dr->y0, dr->x1, dr->y1);
+            dr->x0 += dx;
+            dr->x1 += dx;
+            dr->y0 -= dy;
+            dr->y1 -= dy;
+            sw->mouseDataPos.x += dx;
+            sw->mouseDataPos.y -= dy;
+            //print ("[%f, %f] < [%f, %f] => ", dr->x0, dr->y0, dr->x1, dr->y1);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// bins of the row drawn at y
+static int *hist_row (const CipHistogram *hist, uint32_t y)
+{
+    return & hist->bins[((y + hist->topRow) % hist->h) * hist->w];
+}
+
+static int find_closest_point (CipHistogram *hist, uint32_t _x0, uint32_t _y0, uint32_t *_x, uint32_t *_y)
+{
+    // this algorithm takes a point (x0,y0) and spirals around it with a rectangular
+    // spiral until it finds a point in the histogram that is set. When it is found,
+    // it will make sure it will stop the loop after it is sure no other point can
+    // be closer. The spiral looks like this:
+    //   >>>>>>>>>|
+    //   ^>>>>>>>||
+    //   ^^>>>>>|||
+    //   ^^^>>>||||
+    //   ^^^^>|||||
+    //   ^^^^<<||||
+    //   ^^^<<<<|||
+    //   ^^<<<<<<||
+    //   ^<<<<<<<<|
+
+    int x0 = (int) _x0;
+    int y0 = (int) _y0;
+
+    int dirx[4] = {1, 0, -1,  0};
+    int diry[4] = {0, 1,  0, -1};
+
+    int w = (int) hist->w;
+    int h = (int) hist->h;
+
+    int x = x0;
+    int y = y0;
+
+    int maxSideLen = w+w+h+h;
+    int minD2 = w*w+h*h;
+
+    int sideLen = 1;
+    int dir = 0;
+    int sideCount = 0;
+    int outsideCount = 0;
+    int bestX = -1;
+    int bestY = -1;
+    while (outsideCount < 4 && sideLen <= maxSideLen)
+    {
+        int sideInside = (dirx[dir] && (0 <= y && y < h)) || (diry[dir] && (0 <= x && x < w));
+        if (sideInside)
+        {
+            outsideCount = 0;
+            for (int i=0; i<sideLen; i++)
+            {
+                if (0 <= y && y < h && 0 <= x && x < w)
+                {
+                    if (hist_row (hist, (uint32_t) y)[x])
+                    {
+                        int newMaxSideLen = (int) (1.41421356 * sideLen) + 1;
+                        if (maxSideLen < newMaxSideLen)
+                            maxSideLen = newMaxSideLen;
+                        int dx = x - x0;
+                        int dy = y - y0;
+                        int d2 = dx*dx+dy*dy;
+                        if (minD2 > d2)
+                        {
+                            minD2 = d2;
+                            bestX = x;
+                            bestY = y;
+                        }
+                    }
+                }
+                x += dirx[dir];
+                y += diry[dir];
+            }
+        }
+        else
+        {
+            x += dirx[dir] * sideLen;
+            y += diry[dir] * sideLen;
+            outsideCount++;
+        }
+
+        dir = (dir + 1) % 4;
+        if (++sideCount == 2)
+        {
+            sideCount = 0;
+            sideLen++;
+        }
+    }
+    if (bestX < 0 || bestY < 0)
+    {
+        print_debug ("no point found");
+        return -1;
+    }
+
+    *_x = (uint32_t) bestX;
+    *_y = (uint32_t) bestY;
+
+    return 0;
+}
+
+static int on_mouse_motion (CipState *cs, int xi, int yi)
+{
+    switch (cs->mouseState)
+    {
+     case MOUSE_STATE_NONE:
+         {
+             uint32_t w = cs->windowWidth;
+             uint32_t h = cs->windowHeight - cs->statuslineEnabled * STATUSLINE_HEIGHT;
+             CipArea activeArea;
+
+             if (!cs->zoomEnabled)
+                 cs->activeSw = NULL;
+
+             for (int i=0; i<cs->numSubWindows; i++)
+             {
+                 CipSubWindow *sw;
+                 if (cs->zoomEnabled)
+                 {
+                     sw = cs->activeSw;
+                     CipArea zoomWindowArea = {0,0,1,1};
+                     get_active_area (cs, & zoomWindowArea, & activeArea);
+                 }
+                 else
+                 {
+                     sw = & cs->subWindows[i];
                      get_active_area (cs, & sw->windowArea, & activeArea);
                  }
 
-                 if (sw->selectedGraph > sw->numAttachedGraphs - 1)
-                     sw->selectedGraph = sw->numAttachedGraphs - 1;
 
-                 CipHistogram *hist = & sw->attachedGraphs[sw->selectedGraph]->hist;
-                 uint32_t w = hist->w;
-                 uint32_t h = hist->h;
-                 int *bins = hist->bins;
-                 double (*xyzSums)[3] = hist->xyzSums;
-                 if (!bins)
-                     exit_error ("unexpected null pointer");
-                 CipArea binArea = {0, 0, w, h};
-                 CipPosition binPos;
-                 transform_pos (& activeArea, & cs->mouseWindowPos, & binArea, & binPos);
-                 uint32_t x0 = (uint32_t) binPos.x;
-                 uint32_t y0 = (uint32_t) binPos.y;
+                 cs->mouseWindowPos.x = (double) xi / w;
+                 cs->mouseWindowPos.y = (double) yi / h;
+                 transform_pos (& activeArea, & cs->mouseWindowPos, & sw->dataRange, & sw->mouseDataPos);
+
+                 if (activeArea.x0 <= cs->mouseWindowPos.x && cs->mouseWindowPos.x <= activeArea.x1 &&
+                     activeArea.y0 <= cs->mouseWindowPos.y && cs->mouseWindowPos.y <= activeArea.y1)
+                     cs->activeSw = sw;
+
+                 if (cs->zoomEnabled)
+                     break;
+             }
+
+             if (cs->trackingMode && cs->activeSw && cs->activeSw->numAttachedGraphs > 0)
+             {
+                 CipSubWindow *sw = cs->activeSw;
+                 if (cs->zoomEnabled)
+                 {
+                     CipArea zoomWindowArea = {0,0,1,1};
+                     get_active_area (cs, & zoomWindowArea, & activeArea);
+                 }
+                 else
+                 {
+                     get_active_area (cs, & sw->windowArea, & activeArea);
+                 }
+
+                 if (sw->selectedGraph > sw->numAttachedGraphs - 1)
+                     sw->selectedGraph = sw->numAttachedGraphs - 1;
+
+                 CipHistogram *hist = & sw->attachedGraphs[sw->selectedGraph]->hist;
+                 uint32_t w = hist->w;
+                 uint32_t h = hist->h;
+                 int *bins = hist->bins;
+                 double (*xyzSums)[3] = hist->xyzSums;
+                 if (!bins)
+                     exit_error ("unexpected null pointer");
+                 CipArea binArea = {0, 0, w, h};
+                 CipPosition binPos;
+                 transform_pos (& activeArea, & cs->mouseWindowPos, & binArea, & binPos);
+                 uint32_t x0 = (uint32_t) binPos.x;
+                 uint32_t y0 = (uint32_t) binPos.y;
+
+                 if (cs->trackingMode == 1)
+                 {
+                     if (x0 < w && y0 < h)
+                     {
+                         int _y0 = (int) y0;
+                         int bestY = -1;
+                         for (int dy=0; dy<h; dy++)
+                         {
+                             int yy0 = _y0 + dy;
+                             int yy1 = _y0 - dy;
+                             if (yy0 >= 0 && yy0 < h && hist_row (hist, (uint32_t) yy0)[x0])
+                             {
+                                 bestY = yy0;
+                                 break;
+                             }
+                             else if (yy1 >= 0 && yy1 < h && hist_row (hist, (uint32_t) yy1)[x0])
+                             {
+                                 bestY = yy1;
+                                 break;
+                             }
+                         }
+                         if (bestY >= 0)
+                         {
+                             binPos.y = bestY;
+                             transform_pos (& binArea, & binPos, & activeArea, & cs->mouseWindowPos);
+                             transform_pos (& activeArea, & cs->mouseWindowPos, & sw->dataRange, & sw->mouseDataPos);
+                         }
+                     }
+                 }
+                 else if (cs->trackingMode == 2)
+                 {
+                     if (x0 < w && y0 < h)
+                     {
+                         int _x0 = (int) x0;
+                         int bestX = -1;
+                         for (int dx=0; dx<w; dx++)
+                         {
+                             int xx0 = _x0 + dx;
+                             int xx1 = _x0 - dx;
+                             if (xx0 >= 0 && xx0 < w && hist_row (hist, y0)[xx0])
+                             {
+                                 bestX = xx0;
+                                 break;
+                             }
+                             else if (xx1 >= 0 && xx1 < w && hist_row (hist, y0)[xx1])
+                             {
+                                 bestX = xx1;
+                                 break;
+                             }
+                         }
+                         if (bestX >= 0)
+                         {
+                             binPos.x = bestX;
+                             transform_pos (& binArea, & binPos, & activeArea, & cs->mouseWindowPos);
+                             transform_pos (& activeArea, & cs->mouseWindowPos, & sw->dataRange, & sw->mouseDataPos);
+                         }
+                     }
+                 }
+                 else if (cs->trackingMode == 3)
+                 {
+                     uint32_t xi, yi;
+                     if (find_closest_point (hist, x0, y0, & xi, & yi) >= 0)
+                     {
+                         binPos.x = xi;
+                         binPos.y = yi;
+                         if (xyzSums)
+                         {
+                             int cnt  = bins   [yi * w + xi];
+                             double x = xyzSums[yi * w + xi][0] / cnt;
+                             double y = xyzSums[yi * w + xi][1] / cnt;
+                             double z = xyzSums[yi * w + xi][2] / cnt;
+                             print_debug ("xyz=[%f,%f,%f]", x,y,z);
+                             cx = x;
+                             cy = y;
+                             cz = z;
+                         }
+                         transform_pos (& binArea, & binPos, & activeArea, & cs->mouseWindowPos);
+                         transform_pos (& activeArea, & cs->mouseWindowPos, & sw->dataRange, & sw->mouseDataPos);
+                     }
+                 }
+                 else
+                     exit_error ("bug: %d", cs->trackingMode);
+             }
+
+             if (cs->app_on_mouse_motion && cs->activeSw)
+             {
+                 CipSubWindow *sw = cs->activeSw;
+                 int windowIndex = 0;
+                 for (windowIndex=0; windowIndex<cs->numSubWindows; windowIndex++)
+                     if (& cs->subWindows[windowIndex] == sw)
+                         break;
+
+                 cs->app_on_mouse_motion (cs, windowIndex, sw->mouseDataPos.x, sw->mouseDataPos.y);
+             }
+
+             break;
+         }
+     case MOUSE_STATE_MOVING:
+         {
+             CipPosition oldPos = {cs->mouseWindowPos.x, cs->mouseWindowPos.y};
+             uint32_t w = cs->windowWidth;
+             uint32_t h = cs->windowHeight - cs->statuslineEnabled * STATUSLINE_HEIGHT;
+             cs->mouseWindowPos.x = (double) xi / w;
+             cs->mouseWindowPos.y = (double) yi / h;
+             CipSubWindow *sw = cs->activeSw;
+             CipArea *dr = & sw->dataRange;
+             double dx = (cs->mouseWindowPos.x - oldPos.x);
+             double dy = (cs->mouseWindowPos.y - oldPos.y);
+             if (!cs->zoomEnabled)
+             {
+                 dx /= (sw->windowArea.x1 - sw->windowArea.x0);
+                 dy /= (sw->windowArea.y1 - sw->windowArea.y0);
+             }
+             dx *= dr->x1 - dr->x0;
+             dy *= dr->y1 - dr->y0;
+
+             //printn ("moving window [%f, %f] < [%f, %f] => ", dr->x0, dr->y0, dr->x1, dr->y1);
+             dr->x0 -= dx;
+             dr->x1 -= dx;
+             dr->y0 -= dy;
+             dr->y1 -= dy;
+             //print ("[%f, %f] < [%f, %f] => ", dr->x0, dr->y0, dr->x1, dr->y1);
+
+             break;
+         }
+     case MOUSE_STATE_SELECTING:
+         {
+             uint32_t w = cs->windowWidth;
+             uint32_t h = cs->windowHeight - cs->statuslineEnabled * STATUSLINE_HEIGHT;
+             cs->mouseWindowPos.x = (double) xi / w;
+             cs->mouseWindowPos.y = (double) yi / h;
+             CipArea *swa0 = & cs->activeSw->selectedWindowArea0;
+             CipArea *swa1 = & cs->activeSw->selectedWindowArea1;
+             swa0->x1 = cs->mouseWindowPos.x;
+             swa0->y1 = cs->mouseWindowPos.y;
+             if (swa0->x0 < swa0->x1)
+             {
+                 swa1->x0 = swa0->x0;
+                 swa1->x1 = swa0->x1;
+             }
+             else
+             {
+                 swa1->x0 = swa0->x1;
+                 swa1->x1 = swa0->x0;
+             }
+             if (swa0->y0 < swa0->y1)
+             {
+                 swa1->y0 = swa0->y0;
+                 swa1->y1 = swa0->y1;
+             }
+             else
+             {
+                 swa1->y0 = swa0->y1;
+                 swa1->y1 = swa0->y0;
+             }
+
+             double minDiffX = 16.0 / w;
+             double minDiffY = 16.0 / h;
+
+             double dx = swa1->x1 - swa1->x0;
+             double dy = swa1->y1 - swa1->y0;
+
+             if (dx >= minDiffX || dy >= minDiffY)
+             {
+                 CipArea zoomWindowArea = {0,0,1,1};
+                 CipArea *wa = cs->zoomEnabled ? & zoomWindowArea : & cs->activeSw->windowArea;
+                 if (dx < minDiffX)
+                 {
+                     swa1->x0 = wa->x0;
+                     swa1->x1 = wa->x1;
+                 }
+                 if (dy < minDiffY)
+                 {
+                     swa1->y0 = wa->y0;
+                     swa1->y1 = wa->y1;
+                 }
+             }
+             break;
+         }
+     case MOUSE_STATE_RESIZING_L:
+         {
+             break;
+         }
+     case MOUSE_STATE_RESIZING_R:
+         {
+             break;
+         }
+     case MOUSE_STATE_RESIZING_T:
+         {
+             break;
+         }
+     case MOUSE_STATE_RESIZING_B:
+         {
+             break;
+         }
+     case MOUSE_STATE_RESIZING_TL:
+         {
+             break;
+         }
+     case MOUSE_STATE_RESIZING_TR:
+         {
+             break;
+         }
+     case MOUSE_STATE_RESIZING_BL:
+         {
+             break;
+         }
+     case MOUSE_STATE_RESIZING_BR:
+         {
+             break;
+         }
+     default:
+         exit_error ("bug");
+    }
+    cs->mouse.x = xi;
+    cs->mouse.y = yi;
+    return 1;
+}
+
+static void cycle_line_type (CipSubWindow *sw, int dir)
+{
+    if (!sw)
+        return;
+
+    if (dir > 0)
+    {
+        for (int i=0; i<sw->numAttachedGraphs; i++)
+        {
+            GraphAttacher *attacher = sw->attachedGraphs[i];
+            switch (attacher->plotType)
+            {
+             case 'p': attacher->plotType = '+'; break;
+             case '+': attacher->plotType = 'l'; break;
+             case 'l': attacher->plotType = 't'; break;
+             case 't': attacher->plotType = 's'; break;
+             case 's': attacher->plotType = 'w'; break;
+             case 'w': attacher->plotType = 'p'; break;
+             default: print_error ("unknown line type '%c'", attacher->plotType); break;
+            }
+        }
+    }
+    else
+    {
+        for (int i=0; i<sw->numAttachedGraphs; i++)
+        {
+            GraphAttacher *attacher = sw->attachedGraphs[i];
+            switch (attacher->plotType)
+            {
+             case 'w': attacher->plotType = 's'; break;
+             case 'p': attacher->plotType = 'w'; break;
+             case '+': attacher->plotType = 'p'; break;
+             case 'l': attacher->plotType = '+'; break;
+             case 't': attacher->plotType = 'l'; break;
+             case 's': attacher->plotType = 't'; break;
+             default: print_error ("unknown line type '%c'", attacher->plotType); break;
+            }
+        }
+    }
+}
+
+void cip_set_app_keyboard_callback (CipState *cs, int (*app_on_keyboard) (CipState *cs, int key, int mod, int pressed, int repeat))
+{
+    cs->app_on_keyboard = app_on_keyboard;
+}
+
+void cip_set_app_mouse_motion (CipState *cs, int (*app_on_mouse_motion) (CipState *cs, int windowIndex, double x, double y))
+{
+    cs->app_on_mouse_motion = app_on_mouse_motion;
+}
+
+static int on_keyboard (CipState *cs, int key, int mod, int pressed, int repeat)
+{
+    static int userRedirect = 0;
+    if (key == 27 && pressed)
+    {
+        if (cs->app_on_keyboard)
+        {
+            userRedirect ^= 1;
+            print_debug ("keyboard redirect turned %s", userRedirect ? "on" : "off");
+        }
+        else
+        {
+            print_debug ("call cip_set_app_keyboard_callback to enable user keyboard callback");
+        }
+    }
+
+    if (userRedirect && cs->app_on_keyboard)
+    {
+        return cs->app_on_keyboard (cs, key, mod, pressed, repeat);
+    }
+
+
+    // FIXME: If both the left and right key of the same modifier gets pressed at
+    // the same time and then one gets released, the state of pressedModifiers
+    // gets zeroed out
+    if (key == SDLK_LSHIFT || key == SDLK_RSHIFT)
+    {
+        if (pressed)
+            cs->pressedModifiers |= KMOD_SHIFT;
+        else
+            cs->pressedModifiers &= ~KMOD_SHIFT;
+        return 0;
+    }
+    else if (key == SDLK_LGUI || key == SDLK_RGUI)
+    {
+        if (pressed)
+            cs->pressedModifiers |= KMOD_GUI;
+        else
+            cs->pressedModifiers &= ~KMOD_GUI;
+        return 0;
+    }
+    else if (key == SDLK_LALT || key == SDLK_RALT)
+    {
+        if (pressed)
+            cs->pressedModifiers |= KMOD_ALT;
+        else
+            cs->pressedModifiers &= ~KMOD_ALT;
+        return 0;
+    }
+    else if (key == SDLK_LCTRL || key == SDLK_RCTRL)
+    {
+        if (pressed)
+            cs->pressedModifiers |= KMOD_CTRL;
+        else
+            cs->pressedModifiers &= ~KMOD_CTRL;
+        return 0;
+    }
+
+    int unhandled = 0;
+    if (pressed)
+    {
+        if (!repeat)
+        {
+           if (mod == KMOD_NONE)
+           {
+               switch (key)
+               {
+                case 'a': cip_autoscale_sw (cs->activeSw); break;
+                case 'c': cycle_graph_order (cs); break;
+                case 'f': cip_set_fullscreen (cs, ! cs->fullscreen); break;
+                case 'g': if (cs->activeSw) { cip_set_grid_mode_sw (cs->activeSw, cs->activeSw->gridMode + 1); print_debug ("grid mode %d", cs->activeSw->gridMode); } break;
+                case 'h': toggle_help (cs); break;
+                case 'i': cip_save_png (cs, ".", cs->frameCounter, 0); break;
+                case 'm': cip_set_crosshair_enabled (cs, !cs->crosshairEnabled); break;
+                case 'o': if (cs->activeSw) {cip_set_log_mode_sw (cs, cs->activeSw, cs->activeSw->logMode + 1); print_debug ("log mode %d", cs->activeSw->logMode);} break;
+                case '\t': if (cs->activeSw) {cycle_selected_graph (cs->activeSw, 1); print_debug ("graph %d", cs->activeSw->selectedGraph);cs->on_mouse_motion (cs, cs->mouse.x, cs->mouse.y);} break; 
+                case 's': cip_set_statusline_enabled (cs, !cs->statuslineEnabled); break;
+                case 'q': cip_quit (cs); break;
+                case 'u': undo_zooming (cs->activeSw); break;
+                case 'e': cip_force_refresh (cs); break;
+                case 't': cip_set_tracking_mode (cs, cs->trackingMode + 1); cs->on_mouse_motion (cs, cs->mouse.x, cs->mouse.y);break;
+                case 'l': cycle_line_type (cs->activeSw, 1); break;
+                          //case 'x': exit_zoom (cs); break;
+                case ' ': cip_toggle_paused (cs); break;
+
+                //case 'r':
+                //          {
+                //              extern int recording;
+                //              recording ^= 1;
+                //              print_debug ("recording %d", recording);
+                //              break;
+                //          }
+                case '0':
+                case '1':
+                case '2':
+                case '3':
+                case '4':
+                case '5':
+                case '6':
+                case '7':
+                case '8':
+                case '9':
+                          {
+                              if (cs->activeSw)
+                              {
+                                  int idx = key - '0';
+                                  CipSubWindow *sw = cs->activeSw;
+                                  CipArea *dstArea = & sw->dataRange;
+                                  CipArea *srcArea = & storedDataRanges[idx];
+                                  if (srcArea->x0 != srcArea->x1 && srcArea->y0 != srcArea->y1)
+                                  {
+                                      memcpy (dstArea, srcArea, sizeof (*srcArea));
+                                      print_debug ("restore range from %d", idx);
+                                  }
+                                  else
+                                      print_debug ("no range stored at %d", idx);
+                              }
+                              break;
+                          }
+                          //{
+                          //    int index = key - '1';
+                          //    if (index < 0)
+                          //        index = 9;
+                          //    float shades[10] = {0.0f, 0.04f, 0.06f, 0.08f, 0.10f, 0.14f, 0.2f, 0.4f, 0.7f, 1.0f};
+                          //    cs->bgShade = shades[index];
+                          //    break;
+                          //}
+                case 27:
+                          {
+                              cs->mouseState = MOUSE_STATE_NONE;
+                              if (cs->activeSw)
+                              {
+                                  CipArea *a0 = & cs->activeSw->selectedWindowArea0;
+                                  CipArea *a1 = & cs->activeSw->selectedWindowArea1;
+                                  bzero (a0, sizeof (*a0));
+                                  bzero (a1, sizeof (*a1));
+                              }
+                              break;
+                          }
+                case 'x':
+                case 'y':
+                case 'z':
+                          {
+                              int s = key - 'x';
+                              if (cs->activeSw)
+                              {
+                                  double (*mtx)[3] = cs->activeSw->rotMatrix;
+                                  for (int i=0; i<3; i++)
+                                      for (int j=0; j<3; j++)
+                                          mtx[i][j] = (i == ((j + s) % 3));
+                              }
+                              break;
+                          }
+                default: unhandled = 1;
+               }
+           }
+           else if (mod == KMOD_LSHIFT || mod == KMOD_RSHIFT || mod == KMOD_SHIFT)
+           {
+               switch (key)
+               {
+                case '0':
+                case '1':
+                case '2':
+                case '3':
+                case '4':
+                case '5':
+                case '6':
+                case '7':
+                case '8':
+                case '9':
+                    {
+                        if (cs->activeSw)
+                        {
+                            int idx = key - '0';
+                            CipSubWindow *sw = cs->activeSw;
+                            CipArea *srcArea = & sw->dataRange;
+                            CipArea *dstArea = & storedDataRanges[idx];
+                            if (srcArea->x0 != srcArea->x1 && srcArea->y0 != srcArea->y1)
+                            {
+                                memcpy (dstArea, srcArea, sizeof (*srcArea));
+                                print_debug ("save range to %d", idx);
+                            }
+                        }
+                        break;
+                    }
+                case '\t':
+                    if (cs->activeSw)
+                    {
+                        cycle_selected_graph (cs->activeSw, cs->activeSw->numAttachedGraphs - 1);
+                        print_debug ("graph %d", cs->activeSw->selectedGraph);
+                        cs->on_mouse_motion (cs, cs->mouse.x, cs->mouse.y);
+                    }
+                    break;
+                case 'l': cycle_line_type (cs->activeSw, -1);
+                          break;
+                case 't':
+                    {
+                        cip_set_tracking_mode (cs, cs->trackingMode + 3);
+                        cs->on_mouse_motion (cs, cs->mouse.x, cs->mouse.y);
+                        break;
+                    }
+                case 'n': sub_window_change (cs, -1);
+                          break;
+                default: unhandled = 1;
+               }
+           }
+           else
+           {
+               unhandled = 1;
+           }
+        }
+        if (unhandled || repeat)
+        {
+            unhandled = 0;
+            if (mod == KMOD_NONE)
+            {
+                double zf = 0.05;
+                double mf = 0.025;
+                switch (key)
+                {
+                 case 'n': sub_window_change (cs,  1); break;
+                 case '+': cip_zoom (cs->activeSw,  zf,  zf); break;
+                 case '-': cip_zoom (cs->activeSw, -zf, -zf); break;
+                 case ',': cip_zoom (cs->activeSw, -zf,  0.00); break;
+                 case '.': cip_zoom (cs->activeSw,  zf,  0.00); break;
+                           //case 'i': cip_zoom (cs->activeSw,  0.00, -zf); break;
+                           //case 'o': cip_zoom (cs->activeSw,  0.00,  zf); break;
+                 case SDLK_UP:    cip_move (cs->activeSw,  0.00, -mf); break;
+                 case SDLK_DOWN:  cip_move (cs->activeSw,  0.00,  mf); break;
+                 case SDLK_LEFT:  cip_move (cs->activeSw, -mf,  0.00); break;
+                 case SDLK_RIGHT: cip_move (cs->activeSw,  mf,  0.00); break;
+                 default: unhandled = 1; break;
+                }
+            }
+            else if (mod == KMOD_LSHIFT || mod == KMOD_RSHIFT || mod == KMOD_SHIFT)
+            {
+                switch (key)
+                {
+                 case 'n': sub_window_change (cs, -1); break;
+                 default: unhandled = 1; break;
+                }
+            }
+            else
+            {
+                unhandled = 1;
+            }
+        }
+    }
+
+    if (cs->pressedModifiers == KMOD_CTRL && key == 'c')
+    {
+        cip_quit (cs);
+        unhandled = 0;
+    }
+
+    if (unhandled && (! cs->app_on_keyboard || ! cs->app_on_keyboard (cs, key, mod, pressed, repeat)))
+    {
+        print_debug ("key: %c (%d), pressed: %d, repeat: %d", key, key, pressed, repeat);
+        return 0;
+    }
+
+    return 1;
+}
+
+
+GraphAttacher *cip_graph_attach (CipState *cs, CipGraph *graph, uint32_t windowIndex, HistogramFun histogramFun, char plotType, char *colorSpec, uint32_t numColors)
+{
+    if (windowIndex >= cs->numSubWindows)
+    {
+        print_error ("windowIndex %d out of range", windowIndex);
+        return NULL;
+    }
+
+    CipSubWindow *sw = & cs->subWindows[windowIndex];
+    if (sw->numAttachedGraphs >= sw->maxNumAttachedGraphs)
+    {
+        print_error ("maximum number of attached graphs reached");
+        return NULL;
+    }
+
+    int is3d = graph->dim == 3;
+    GraphAttacher *attacher = safe_calloc (1, sizeof (*attacher));
+    attacher->graph = graph;
+    attacher->plotType = plotType;
+    attacher->hist.w = 0;
+    attacher->hist.h = 0;
+    attacher->hist.bins = NULL;
+    attacher->hist.xyzSums = NULL;
+    attacher->histogramFun = histogramFun ? histogramFun : graph->rowWidth ? make_histogram_rows :
+                             is3d ? make_histogram_3d : make_histogram_2d;
+    attacher->colorScheme = make_color_scheme (colorSpec, numColors);
+    attacher->lastGraphCounter = 0;
+    atomic_flag_clear (& attacher->asyncAccess);
+
+    sw->attachedGraphs[sw->numAttachedGraphs] = attacher;
+    sw->numAttachedGraphs++;
+    return attacher;
+}
+
+static void cinterplot_wait (CipState *cs)
+{
+    cs->stopped = 1;
+    atomic_store (& cs->builderHeld, 1);
+    while (cs->redrawing || atomic_load (& cs->building))
+        usleep (10000);
+}
+
+static void cinterplot_continue (CipState *cs)
+{
+    atomic_store (& cs->builderHeld, 0);
+    cs->stopped = 0;
+}
+
+// Limits the time spent on histograms each frame, 0 (the default) builds
+// every histogram in one go. Rebuilds that take longer are spread over the
+// next frames, shown from a growing share of the points in the meantime, or
+// for custom histogram functions at a lower resolution.
+void cip_set_frame_budget (CipState *cs, double seconds)
+{
+    cs->frameBudget = seconds > 0 ? seconds : 0;
+}
+
+static void *histogram_builder (void *arg);
+
+// Builds the histograms on a thread of their own, the render thread only
+// draws the last ones it finished, moved along while the view changes. Input
+// stays responsive however slow the histograms are. Rebuilds go in slices of
+// the frame budget, or ASYNC_SLICE_TIME without one, and start over when the
+// view changes in the middle of one.
+void cip_set_async_histograms (CipState *cs, uint32_t enabled)
+{
+    enabled = enabled ? 1 : 0;
+    if (enabled == cs->asyncHistograms)
+        return;
+
+    cinterplot_wait (cs);
+    if (enabled)
+    {
+        // have every histogram published anew
+        for (uint32_t wi=0; wi<cs->numSubWindows; wi++)
+        {
+            CipSubWindow *sw = & cs->subWindows[wi];
+            for (uint32_t gi=0; gi<sw->numAttachedGraphs; gi++)
+            {
+                GraphAttacher *attacher = sw->attachedGraphs[gi];
+                free (attacher->shown.bins);
+                memset (& attacher->shown, 0, sizeof (attacher->shown));
+                memset (& attacher->target, 0, sizeof (attacher->target));
+            }
+        }
+
+        atomic_store (& cs->builderQuit, 0);
+        if (pthread_create (& cs->builderThread, NULL, histogram_builder, cs))
+        {
+            print_warning ("could not start the histogram builder thread");
+            enabled = 0;
+        }
+    }
+    else
+    {
+        atomic_store (& cs->builderQuit, 1);
+        pthread_join (cs->builderThread, NULL);
+    }
+    cs->asyncHistograms = enabled & 1;
+    cinterplot_continue (cs);
+}
+
+// threads binning the histograms, 0 for one per online processor
+void cip_set_num_threads (CipState *cs, uint32_t numThreads)
+{
+    if (numThreads == 0)
+        numThreads = (uint32_t) MAX (1, sysconf (_SC_NPROCESSORS_ONLN));
+
+    cinterplot_wait (cs);
+    worker_pool_start (numThreads);
+    cs->numThreads = workerPool.nThreads;
+    cinterplot_continue (cs);
+}
+
+int cip_graph_detach (CipState *cs, CipGraph *graph, uint32_t windowIndex)
+{
+    int removed = 0;
+    cinterplot_wait (cs);
+    CipSubWindow *sw = & cs->subWindows[windowIndex];
+    uint32_t giNew = 0;
+    for (uint32_t giOld=0; giOld<sw->numAttachedGraphs; giOld++)
+    {
+        //print_debug ("giOld: %d giNew: %d sw:%p", giOld, giNew, sw);
+        GraphAttacher *attacher = sw->attachedGraphs[giOld];
+        if (attacher->graph == graph)
+        {
+            // delete this attacher
+            //print_debug ("freeing attacher %p", attacher);
+            attacher->graph = NULL;
+            free (attacher->hist.pointBins);
+            free (attacher->shown.bins);
+            delete_color_scheme (attacher->colorScheme);
+            free (attacher);
+            removed = 1;
+        }
+        else
+        {
+            // keep this attacher
+            sw->attachedGraphs[giNew++] = sw->attachedGraphs[giOld];
+        }
+    }
+    sw->numAttachedGraphs = giNew;
+    cinterplot_continue (cs);
+    return removed;
+}
+
+static size_t axis_storage_size (uint32_t type)
+{
+    switch (type)
+    {
+     case CIP_STORE_DOUBLE: return sizeof (double);
+     case CIP_STORE_FLOAT:  return sizeof (float);
+     case CIP_STORE_INT16:  return sizeof (int16_t);
+     case CIP_STORE_INT32:  return sizeof (int32_t);
+     case CIP_STORE_UINT8:  return sizeof (uint8_t);
+    }
+    exit_error ("unknown axis storage type %u", type);
+    return 0;
+}
+
+// Converts a double to the storage type of an axis, clamping integers to
+// their range. Integer axes reserve one raw value for NaN.
+static void axis_encode (const CipAxisStorage *storage, double v, uint8_t *dst)
+{
+    if (storage->type == CIP_STORE_DOUBLE)
+    {
+        memcpy (dst, & v, sizeof (v));
+        return;
+    }
+    if (storage->type == CIP_STORE_FLOAT)
+    {
+        float f = (float) v;
+        memcpy (dst, & f, sizeof (f));
+        return;
+    }
+
+    double raw = round ((v - storage->offset) / storage->scale);
+
+    switch (storage->type)
+    {
+     case CIP_STORE_INT16:
+     {
+         int16_t i = INT16_MIN;
+         if (!isnan (v))
+             i = (int16_t) MAX (INT16_MIN + 1, MIN (INT16_MAX, raw));
+         memcpy (dst, & i, sizeof (i));
+         break;
+     }
+
+     case CIP_STORE_INT32:
+     {
+         int32_t i = INT32_MIN;
+         if (!isnan (v))
+             i = (int32_t) MAX (INT32_MIN + 1.0, MIN (INT32_MAX, raw));
+         memcpy (dst, & i, sizeof (i));
+         break;
+     }
+
+     case CIP_STORE_UINT8:
+     {
+         uint8_t u = UINT8_MAX;
+         if (!isnan (v))
+             u = (uint8_t) MAX (0, MIN (UINT8_MAX - 1, raw));
+         memcpy (dst, & u, sizeof (u));
+         break;
+     }
+    }
+}
+
+// Producer threads batch single point adds in a staging slot picked by
+// thread, a full or aged batch is published with one insert. Threads
+// sharing a slot serialise on its flag, the slots are cache line sized
+// so that producers don't write to each other's lines.
+#define CIP_STAGING_SLOTS 16
+#define STAGING_MAX_AGE   0.01
+
+typedef struct CipStagingSlot
+{
+    atomic_flag access;
+    uint32_t n;
+    double firstTime;
+    double *items;
+} __attribute__ ((aligned (64))) CipStagingSlot;
+
+static atomic_uint stagingThreadCount;
+static _Thread_local int stagingThreadSlot = -1;
+
+static CipStagingSlot *staging_create (uint32_t len, uint32_t dim)
+{
+    CipStagingSlot *staging = aligned_alloc (64, CIP_STAGING_SLOTS * sizeof (CipStagingSlot));
+    if (!staging)
+        exit_error ("can't allocate staging slots");
+
+    for (int i=0; i<CIP_STAGING_SLOTS; i++)
+    {
+        atomic_flag_clear (& staging[i].access);
+        staging[i].n = 0;
+        staging[i].firstTime = 0;
+        staging[i].items = safe_calloc ((size_t) len * dim, sizeof (double));
+    }
+    return staging;
+}
+
+static void staging_destroy (CipStagingSlot *staging)
+{
+    for (int i=0; i<CIP_STAGING_SLOTS; i++)
+        free (staging[i].items);
+    free (staging);
+}
+
+// what the items of a graph file hold, checked when the file is reopened
+typedef struct GraphFileLayout
+{
+    uint32_t dim;
+    uint32_t implicitX;
+    uint32_t columnar;
+    uint32_t axisType[3];
+    double   axisScale[3];
+    double   axisOffset[3];
+} GraphFileLayout;
+
+CipGraph *cip_graph_new_ex (int dim, uint32_t len, const CipGraphOptions *options)
+{
+    if (dim < 2 || dim > 3)
+        exit_error ("dimension not supported");
+
+    CipGraphOptions defaultOptions = {0};
+    if (!options)
+        options = & defaultOptions;
+
+    CipGraph *graph = safe_calloc (1, sizeof (*graph));
+    graph->len = len;
+    atomic_flag_clear (& graph->insertAccess);
+    atomic_flag_clear (& graph->logAccess);
+    atomic_flag_clear (& graph->lodAccess);
+    atomic_flag_clear (& graph->gridAccess);
+
+    graph->dim = (uint32_t) dim;
+    graph->columnar = options->columnar;
+    graph->spatialIndex = options->spatialIndex && dim == 2;
+
+    // a row graph stores each row as one item of floats, len is in rows
+    if (options->rowWidth)
+    {
+        if (dim != 2 || len == 0)
+            exit_error ("row graphs need two dimensions and a non zero length");
+
+        graph->rowWidth = options->rowWidth;
+        graph->x0 = options->x0;
+        graph->dx = options->dx != 0 ? options->dx : 1;
+        graph->columnar = 0;
+        graph->spatialIndex = 0;
+        graph->lastX = -INFINITY;
+
+        uint32_t flags = options->hugePages ? STREAM_BUFFER_HUGE_PAGES : 0;
+        graph->sb = stream_buffer_create_ex (len, graph->rowWidth * sizeof (float), flags);
+        return graph;
+    }
+
+    if (options->implicitX)
+    {
+        if (options->dx == 0)
+            exit_error ("implicit x graphs need a non zero dx");
+
+        graph->implicitX = 1;
+        graph->x0 = options->x0;
+        graph->dx = options->dx;
+    }
+
+    // x is not stored for implicit x graphs
+    uint32_t a0 = graph->implicitX;
+    size_t itemSize = 0;
+    size_t columnSizes[3];
+    for (uint32_t a=a0; a<graph->dim; a++)
+    {
+        CipAxisStorage *storage = & graph->axes[a];
+        *storage = options->axes[a];
+        if (storage->scale == 0)
+            storage->scale = 1;
+        if (storage->type != CIP_STORE_DOUBLE)
+            graph->quantized = 1;
+
+        columnSizes[a - a0] = axis_storage_size (storage->type);
+        graph->axisOffset[a] = itemSize;
+        itemSize += columnSizes[a - a0];
+    }
+
+    uint32_t flags = options->hugePages ? STREAM_BUFFER_HUGE_PAGES : 0;
+
+    uint32_t nColumns = graph->columnar ? graph->dim - a0 : 1;
+    const size_t *sizes = graph->columnar ? columnSizes : & itemSize;
+
+    if (options->file)
+    {
+        // recorded in the file, so that it is not reopened with other axis types
+        GraphFileLayout layout = {0};
+        layout.dim       = graph->dim;
+        layout.implicitX = graph->implicitX;
+        layout.columnar  = graph->columnar;
+        for (uint32_t a=a0; a<graph->dim; a++)
+        {
+            layout.axisType[a]   = graph->axes[a].type;
+            layout.axisScale[a]  = graph->axes[a].scale;
+            layout.axisOffset[a] = graph->axes[a].offset;
+        }
+
+        // grows like an unbounded graph, len limits the points kept in the file
+        uint32_t maxLen = graph->len ? len : MAX_VARIABLE_LENGTH;
+        graph->sb = stream_buffer_open_file (options->file, FILE_SEGMENT_LENGTH, maxLen, nColumns, sizes,
+                                             sizeof (SegmentZone), & layout, sizeof (layout), flags);
+        if (!graph->sb)
+            exit_error ("could not open graph file %s", options->file);
+    }
+    else if (graph->len == 0)
+    {
+        // lazy infinite length, grows segment by segment up to MAX_VARIABLE_LENGTH
+        uint32_t segmentLen = options->hugePages ? HUGE_SEGMENT_LENGTH : INITIAL_VARIABLE_LENGTH;
+        graph->sb = stream_buffer_create_segmented (segmentLen, MAX_VARIABLE_LENGTH, nColumns, sizes,
+                                                    sizeof (SegmentZone), flags);
+    }
+    else
+    {
+        graph->sb = stream_buffer_create_columns (len, nColumns, sizes, flags);
+    }
+
+    // the order of the points already in a graph file is not known
+    graph->xDisorder = graph->sb->counter + 1;
+    graph->lastX = -INFINITY;
+
+    if (options->stagingLen)
+    {
+        graph->stagingLen = options->stagingLen;
+        graph->stagingMaxAge = options->stagingMaxAge > 0 ? options->stagingMaxAge : STAGING_MAX_AGE;
+        graph->staging = staging_create (graph->stagingLen, graph->dim);
+    }
+
+    return graph;
+}
+
+CipGraph *cip_graph_new (int dim, uint32_t len)
+{
+    return cip_graph_new_ex (dim, len, NULL);
+}
+
+void cip_graph_delete (CipGraph *graph)
+{
+    if (!graph)
+        return;
+
+    if (graph->staging)
+    {
+        cip_graph_flush (graph);
+        staging_destroy (graph->staging);
+    }
+
+    free_log_cache (graph);
+    free_line_lod (graph);
+    free_grid_index (graph);
+    free_spectrum (graph);
+    stream_buffer_destroy (graph->sb);
+    if (graph->name)
+        free (graph->name);
+    free (graph);
+}
+
+#define GRAPH_INSERT_CHUNK_LEN 1024
+
+static void segment_zone_add (SegmentZone *zone, uint32_t a0, uint32_t dim, double (*v)[GRAPH_BLOCK_LEN], uint32_t i)
+{
+    for (uint32_t a=a0; a<dim; a++)
+        if (!isfinite (v[a][i]))
+            return;
+
+    for (uint32_t a=a0; a<dim; a++)
+    {
+        if (zone->min[a] > v[a][i]) zone->min[a] = v[a][i];
+        if (zone->max[a] < v[a][i]) zone->max[a] = v[a][i];
+    }
+}
+
+// Extends the zone maps with n packed items about to be inserted. Called
+// with insert access, before the items are published. The zone of a reused
+// segment is only reset once the overwrite is announced, readers of the old
+// segment that see the reset zone then also see their points overwritten.
+static void graph_update_zones (CipGraph *graph, const uint8_t *items, uint32_t n)
+{
+    StreamBuffer *sb = graph->sb;
+    uint64_t position = sb->counter;
+    uint64_t ringLen  = (uint64_t) sb->maxSegments * sb->segmentLen;
+    uint32_t total    = n;
+    uint32_t a0 = graph->implicitX;
+    double v[3][GRAPH_BLOCK_LEN];
+
+    while (n)
+    {
+        uint32_t offset = (uint32_t) position & (sb->segmentLen - 1);
+        uint32_t run = MIN (MIN (n, GRAPH_BLOCK_LEN), sb->segmentLen - offset);
+
+        for (uint32_t a=a0; a<graph->dim; a++)
+            decode_axis (& graph->axes[a], items + graph->axisOffset[a], sb->itemSize, run, v[a]);
+
+        SegmentZone *zone = stream_buffer_segment_meta (sb, position);
+        if (offset == 0)
+        {
+            if (position >= ringLen)
+                stream_buffer_announce (sb, total);
+            segment_zone_reset (graph, zone);
+            if (position)
+                segment_zone_add (stream_buffer_segment_meta (sb, position - 1), a0, graph->dim, v, 0);
+        }
+
+        for (uint32_t i=0; i<run; i++)
+            segment_zone_add (zone, a0, graph->dim, v, i);
+
+        items    += sb->itemSize * run;
+        position += run;
+        n        -= run;
+    }
+}
+
+// Keeps track of the x order of n packed items about to be inserted, for
+// graph_view_x_range. A point with x below the one before it starts a new
+// sorted run, a NaN x breaks the run until the point after it. Called with
+// insert access, before the items are published.
+static void graph_update_x_order (CipGraph *graph, const uint8_t *items, uint32_t n)
+{
+    StreamBuffer *sb = graph->sb;
+    uint64_t c = sb->counter + 1;
+    uint64_t disorder = graph->xDisorder;
+    double lastX = graph->lastX;
+    double xs[GRAPH_BLOCK_LEN];
+
+    while (n)
+    {
+        uint32_t run = MIN (n, GRAPH_BLOCK_LEN);
+        decode_axis (& graph->axes[0], items + graph->axisOffset[0], sb->itemSize, run, xs);
+
+        for (uint32_t i=0; i<run; i++, c++)
+        {
+            double x = xs[i];
+            if (isnan (x))
+            {
+                disorder = c + 1;
+                lastX = -INFINITY;
+            }
+            else
+            {
+                if (x < lastX)
+                    disorder = c;
+                lastX = x;
+            }
+        }
+
+        items += sb->itemSize * run;
+        n     -= run;
+    }
+
+    graph->lastX = lastX;
+    __atomic_store_n (& graph->xDisorder, disorder, __ATOMIC_RELAXED);
+}
+
+// inserts n items already packed in the storage format of the graph
+static void graph_insert_packed (CipGraph *graph, const void *items, size_t n)
+{
+    StreamBuffer *sb = graph->sb;
+    const uint8_t *src = items;
+
+    if (graph->rowWidth)
+        exit_error ("points can not be added to row graphs, use cip_graph_add_row");
+
+    while (n)
+    {
+        // the buffer can not hold more than MAX_VARIABLE_LENGTH items anyway,
+        // insert in chunks that fit in an uint32_t
+        uint32_t chunkLen = (uint32_t) MIN (n, MAX_VARIABLE_LENGTH);
+
+        wait_for_insert_access (graph);
+        if (sb->meta)
+            graph_update_zones (graph, src, chunkLen);
+        if (!graph->implicitX)
+            graph_update_x_order (graph, src, chunkLen);
+        stream_buffer_insert_n (sb, src, chunkLen);
+        release_insert_access (graph);
+
+        src += sb->itemSize * chunkLen;
+        n   -= chunkLen;
+    }
+}
+
+// Inserts n items of itemDim doubles each, holding the last itemDim axes of
+// the graph. Axes in front of them are not stored, i.e. x of implicit x graphs.
+static void graph_encode_items (CipGraph *graph, const double *items, uint32_t itemDim, size_t n)
+{
+    size_t itemSize = graph->sb->itemSize;
+    uint32_t a0 = graph->dim - itemDim;
+    uint8_t chunk[GRAPH_INSERT_CHUNK_LEN * 3 * sizeof (double)];
+
+    while (n)
+    {
+        uint32_t chunkLen = (uint32_t) MIN (n, GRAPH_INSERT_CHUNK_LEN);
+        for (uint32_t i=0; i<chunkLen; i++, items += itemDim)
+            for (uint32_t a=MAX (a0, graph->implicitX); a<graph->dim; a++)
+                axis_encode (& graph->axes[a], items[a - a0], & chunk[i * itemSize + graph->axisOffset[a]]);
+
+        graph_insert_packed (graph, chunk, chunkLen);
+        n -= chunkLen;
+    }
+}
+
+// inserts n items of graph->dim doubles each, x is dropped for implicit x graphs
+static void graph_insert_items (CipGraph *graph, const double *items, size_t n)
+{
+    if (!graph->quantized && !graph->implicitX)
+        graph_insert_packed (graph, items, n);
+    else
+        graph_encode_items (graph, items, graph->dim, n);
+}
+
+static CipStagingSlot *staging_thread_slot (CipGraph *graph)
+{
+    if (stagingThreadSlot < 0)
+        stagingThreadSlot = (int) (atomic_fetch_add (& stagingThreadCount, 1) % CIP_STAGING_SLOTS);
+    return & graph->staging[stagingThreadSlot];
+}
+
+// called with access to the slot
+static void staging_publish (CipGraph *graph, CipStagingSlot *slot)
+{
+    if (slot->n)
+        graph_insert_items (graph, slot->items, slot->n);
+    slot->n = 0;
+}
+
+// item holds graph->dim doubles, x is ignored for implicit x graphs
+static void staging_add (CipGraph *graph, const double *item)
+{
+    CipStagingSlot *slot = staging_thread_slot (graph);
+    uint32_t dim = graph->dim;
+
+    wait_for_access (& slot->access);
+    double now = get_time ();
+    if (slot->n == 0)
+        slot->firstTime = now;
+
+    memcpy (& slot->items[slot->n * dim], item, dim * sizeof (double));
+    slot->n++;
+
+    if (slot->n == graph->stagingLen || now - slot->firstTime >= graph->stagingMaxAge)
+        staging_publish (graph, slot);
+    release_access (& slot->access);
+}
+
+// keeps the points of a thread in order when it mixes single and batch adds
+static void staging_flush_thread (CipGraph *graph)
+{
+    if (!graph->staging)
+        return;
+
+    CipStagingSlot *slot = staging_thread_slot (graph);
+    wait_for_access (& slot->access);
+    staging_publish (graph, slot);
+    release_access (& slot->access);
+}
+
+// Publishes batches older than the max age of the graph, skipping slots a
+// producer is busy with. Returns non zero if anything was published.
+static int staging_flush_stale (CipGraph *graph, double now)
+{
+    int published = 0;
+    for (int i=0; i<CIP_STAGING_SLOTS; i++)
+    {
+        CipStagingSlot *slot = & graph->staging[i];
+        if (!try_access (& slot->access))
+            continue;
+
+        if (slot->n && now - slot->firstTime >= graph->stagingMaxAge)
+        {
+            staging_publish (graph, slot);
+            published = 1;
+        }
+        release_access (& slot->access);
+    }
+    return published;
+}
+
+// publishes the staged points of all threads, e.g. at the end of a burst, and
+// computes the pending rows of a spectrum graph
+void cip_graph_flush (CipGraph *graph)
+{
+    if (graph->spectrum)
+        spectrum_update (graph, 0);
+
+    if (!graph->staging)
+        return;
+
+    for (int i=0; i<CIP_STAGING_SLOTS; i++)
+    {
+        CipStagingSlot *slot = & graph->staging[i];
+        wait_for_access (& slot->access);
+        staging_publish (graph, slot);
+        release_access (& slot->access);
+    }
+}
+
+// publishes the aged batches of producers that went quiet
+static int flush_stale_staging (CipState *cs, double now)
+{
+    int published = 0;
+    for (uint32_t swi=0; swi<cs->numSubWindows; swi++)
+    {
+        CipSubWindow *sw = & cs->subWindows[swi];
+        for (int i=0; i<sw->numAttachedGraphs; i++)
+        {
+            CipGraph *graph = sw->attachedGraphs[i]->graph;
+            if (graph->staging)
+                published |= staging_flush_stale (graph, now);
+        }
+    }
+    return published;
+}
+
+void cip_graph_add_2d_point (CipGraph *graph, double x, double y)
+{
+    while (paused)
+        usleep (10000);
+
+    assert (graph->sb);
+    if (graph->dim != 2)
+        exit_error ("function can only be used for two dimensional graphs");
+
+    double xy[2] = {x,y};
+    if (graph->staging)
+        staging_add (graph, xy);
+    else
+        graph_insert_items (graph, xy, 1);
+}
+
+void cip_graph_add_3d_point (CipGraph *graph, double x, double y, double z)
+{
+    while (paused)
+        usleep (10000);
+
+    assert (graph->sb);
+    if (graph->dim != 3)
+        exit_error ("function can only be used for three dimensional graphs");
+
+    double xyz[3] = {x,y,z};
+    if (graph->staging)
+        staging_add (graph, xyz);
+    else
+        graph_insert_items (graph, xyz, 1);
+}
 
-                 if (cs->trackingMode == 1)
-                 {
-                     if (x0 < w && y0 < h)
-                     {
-                         int _y0 = (int) y0;
-                         int bestY = -1;
-                         for (int dy=0; dy<h; dy++)
-                         {
-                             int yy0 = _y0 + dy;
-                             int yy1 = _y0 - dy;
-                             if (yy0 >= 0 && yy0 < h && bins[w * (uint32_t) yy0 + x0])
-                             {
-                                 bestY = yy0;
-                                 break;
-                             }
-                             else if (yy1 >= 0 && yy1 < h && bins[w * (uint32_t) yy1 + x0])
-                             {
-                                 bestY = yy1;
-                                 break;
-                             }
-                         }
-                         if (bestY >= 0)
-                         {
-                             binPos.y = bestY;
-                             transform_pos (& binArea, & binPos, & activeArea, & cs->mouseWindowPos);
-                             transform_pos (& activeArea, & cs->mouseWindowPos, & sw->dataRange, & sw->mouseDataPos);
-                         }
-                     }
-                 }
-                 else if (cs->trackingMode == 2)
-                 {
-                     if (x0 < w && y0 < h)
-                     {
-                         int _x0 = (int) x0;
-                         int bestX = -1;
-                         for (int dx=0; dx<w; dx++)
-                         {
-                             int xx0 = _x0 + dx;
-                             int xx1 = _x0 - dx;
-                             if (xx0 >= 0 && xx0 < w && bins[w * y0 + (uint32_t) xx0])
-                             {
-                                 bestX = xx0;
-                                 break;
-                             }
-                             else if (xx1 >= 0 && xx1 < w && bins[w * y0 + (uint32_t) xx1])
-                             {
-                                 bestX = xx1;
-                                 break;
-                             }
-                         }
-                         if (bestX >= 0)
-                         {
-                             binPos.x = bestX;
-                             transform_pos (& binArea, & binPos, & activeArea, & cs->mouseWindowPos);
-                             transform_pos (& activeArea, & cs->mouseWindowPos, & sw->dataRange, & sw->mouseDataPos);
-                         }
-                     }
-                 }
-                 else if (cs->trackingMode == 3)
-                 {
-                     uint32_t xi, yi;
-                     if (find_closest_point (hist, x0, y0, & xi, & yi) >= 0)
-                     {
-                         binPos.x = xi;
-                         binPos.y = yi;
-                         if (xyzSums)
-                         {
-                             int cnt  = bins   [yi * w + xi];
-                             double x = xyzSums[yi * w + xi][0] / cnt;
-                             double y = xyzSums[yi * w + xi][1] / cnt;
-                             double z = xyzSums[yi * w + xi][2] / cnt;
-                             print_debug ("xyz=[%f,%f,%f]", x,y,z);
-                             cx = x;
-                             cy = y;
-                             cz = z;
-                         }
-                         transform_pos (& binArea, & binPos, & activeArea, & cs->mouseWindowPos);
-                         transform_pos (& activeArea, & cs->mouseWindowPos, & sw->dataRange, & sw->mouseDataPos);
-                     }
-                 }
-                 else
-                     exit_error ("bug: %d", cs->trackingMode);
-             }
+void cip_graph_add_2d_points (CipGraph *graph, const double *xy, size_t n)
+{
+    while (paused)
+        usleep (10000);
 
-             if (cs->app_on_mouse_motion && cs->activeSw)
-             {
-                 CipSubWindow *sw = cs->activeSw;
-                 int windowIndex = 0;
-                 for (windowIndex=0; windowIndex<cs->numSubWindows; windowIndex++)
-                     if (& cs->subWindows[windowIndex] == sw)
-                         break;
+    assert (graph->sb);
+    if (graph->dim != 2)
+        exit_error ("function can only be used for two dimensional graphs");
+
+    staging_flush_thread (graph);
+    graph_insert_items (graph, xy, n);
+}
+
+void cip_graph_add_3d_points (CipGraph *graph, const double *xyz, size_t n)
+{
+    while (paused)
+        usleep (10000);
+
+    assert (graph->sb);
+    if (graph->dim != 3)
+        exit_error ("function can only be used for three dimensional graphs");
+
+    staging_flush_thread (graph);
+    graph_insert_items (graph, xyz, n);
+}
+
+// items are packed in the storage format of the graph: the axes back-to-back,
+// each in the type given in CipGraphOptions, without padding
+void cip_graph_add_raw_points (CipGraph *graph, const void *items, size_t n)
+{
+    while (paused)
+        usleep (10000);
+
+    assert (graph->sb);
+    staging_flush_thread (graph);
+    graph_insert_packed (graph, items, n);
+}
+
+void cip_graph_add_sample (CipGraph *graph, double y)
+{
+    while (paused)
+        usleep (10000);
+
+    if (graph->dim != 2)
+        exit_error ("function can only be used for two dimensional graphs");
+
+    if (graph->staging)
+    {
+        if (!graph->implicitX)
+            exit_error ("function can only be used for implicit x graphs");
+
+        double item[2] = {0, y};
+        staging_add (graph, item);
+        return;
+    }
+
+    cip_graph_add_samples (graph, & y, 1);
+}
+
+// values holds n items of y (and z for three dimensional graphs)
+void cip_graph_add_samples (CipGraph *graph, const double *values, size_t n)
+{
+    while (paused)
+        usleep (10000);
+
+    assert (graph->sb);
+    if (!graph->implicitX)
+        exit_error ("function can only be used for implicit x graphs");
+
+    staging_flush_thread (graph);
+    if (!graph->quantized)
+        graph_insert_packed (graph, values, n);
+    else
+        graph_encode_items (graph, values, graph->dim - 1, n);
+}
+
+// adds a row to a row graph, width must be the row width of the graph
+void cip_graph_add_row (CipGraph *graph, const float *row, uint32_t width)
+{
+    while (paused)
+        usleep (10000);
+
+    assert (graph->sb);
+    if (!graph->rowWidth)
+        exit_error ("function can only be used for row graphs");
+    if (width != graph->rowWidth)
+        exit_error ("row of %u samples added to a graph of %u sample rows", width, graph->rowWidth);
+
+    wait_for_insert_access (graph);
+    stream_buffer_insert_n (graph->sb, row, 1);
+    release_insert_access (graph);
+}
+
+void cip_graph_add_points_strided (CipGraph *graph, const void *base, size_t stride, size_t n,
+                                   size_t xOffset, size_t yOffset, size_t zOffset)
+{
+    while (paused)
+        usleep (10000);
+
+    assert (graph->sb);
+
+    uint32_t dim = graph->dim;
+    size_t offsets[3] = {xOffset, yOffset, zOffset};
+    double chunk[GRAPH_INSERT_CHUNK_LEN][3];
+    const uint8_t *src = base;
+
+    staging_flush_thread (graph);
+    while (n)
+    {
+        uint32_t chunkLen = (uint32_t) MIN (n, GRAPH_INSERT_CHUNK_LEN);
+        double *dst = & chunk[0][0];
+        for (uint32_t i=0; i<chunkLen; i++, src += stride)
+            for (uint32_t d=0; d<dim; d++)
+                memcpy (dst++, & src[offsets[d]], sizeof (double));
+
+        graph_insert_items (graph, & chunk[0][0], chunkLen);
+        n -= chunkLen;
+    }
+}
+
+void cip_graph_remove_points (CipGraph *graph)
+{
+    while (paused)
+        usleep (10000);
+
+    StreamBuffer *sb = graph->sb;
+    assert (sb);
+
+    // Points staged before the reset are dropped with the others. The slots
+    // are taken first, publishing a slot takes insert access while holding it.
+    if (graph->staging)
+        for (int i=0; i<CIP_STAGING_SLOTS; i++)
+            wait_for_access (& graph->staging[i].access);
+
+    // readers are not waited for, they see their snapshots as overwritten
+    wait_for_insert_access (graph);
+    stream_buffer_reset (sb);
+    graph->xDisorder = 0;
+    graph->lastX = -INFINITY;
+    if (graph->staging)
+        for (int i=0; i<CIP_STAGING_SLOTS; i++)
+            graph->staging[i].n = 0;
+    release_insert_access (graph);
+
+    if (graph->staging)
+        for (int i=0; i<CIP_STAGING_SLOTS; i++)
+            release_access (& graph->staging[i].access);
+}
+
+typedef struct RegionQuery
+{
+    const GraphView *view;
+    double x0;
+    double x1;
+    double y0;
+    double y1;
+    double *xy;
+    uint32_t maxPoints;
+    uint32_t n;              // points found so far
+} RegionQuery;
+
+static void region_query_add (RegionQuery *q, const double *xs, const double *ys, uint32_t n)
+{
+    for (uint32_t i=0; i<n; i++)
+    {
+        if (!(q->x0 <= xs[i] && xs[i] <= q->x1 && q->y0 <= ys[i] && ys[i] <= q->y1))
+            continue;
+
+        if (q->n < q->maxPoints)
+        {
+            q->xy[2 * q->n]     = xs[i];
+            q->xy[2 * q->n + 1] = ys[i];
+        }
+        q->n++;
+    }
+}
+
+// GridFun of region queries
+static void region_query_points (void *arg, const uint32_t *is, uint32_t n)
+{
+    RegionQuery *q = arg;
+    double xs[GRID_VISIT_LEN];
+    double ys[GRID_VISIT_LEN];
+    graph_view_gather (q->view, 0, 0, is, n, xs);
+    graph_view_gather (q->view, 1, 0, is, n, ys);
+    region_query_add (q, xs, ys, n);
+}
+
+// Copies the points of a 2D graph within the area, corners included and in
+// either order, to xy as x,y pairs, up to maxPoints of them. Returns how many
+// points are within the area, which can be more than maxPoints. Graphs with a
+// spatial index return them in no particular order, others in the order they
+// were added.
+uint32_t cip_graph_query_region (CipGraph *graph, const CipArea *area, double *xy, uint32_t maxPoints)
+{
+    if (graph->dim != 2 || graph->rowWidth)
+    {
+        print_warning ("region queries need a 2D graph of points");
+        return 0;
+    }
+
+    GraphView view;
+    graph_view_open (graph, & view);
+
+    RegionQuery q = {.view = & view, .xy = xy, .maxPoints = maxPoints};
+    q.x0 = MIN (area->x0, area->x1);
+    q.x1 = MAX (area->x0, area->x1);
+    q.y0 = MIN (area->y0, area->y1);
+    q.y1 = MAX (area->y0, area->y1);
+
+    if (graph->spatialIndex)
+    {
+        CipGridIndex *grid = graph_view_lock_grid (& view);
+        grid_index_visit (grid, & view, q.x0, q.x1, q.y0, q.y1, region_query_points, & q);
+        release_access (& graph->gridAccess);
+    }
+    else
+    {
+        uint32_t i0, i1;
+        graph_view_x_range (& view, q.x0, q.x1, & i0, & i1);
+
+        double xs[GRAPH_BLOCK_LEN];
+        double ys[GRAPH_BLOCK_LEN];
+        uint32_t n;
+        for (uint32_t b=i0; b<i1; b+=n)
+        {
+            n = MIN (GRAPH_BLOCK_LEN, i1 - b);
+            graph_view_fetch (& view, 0, b, n, xs);
+            graph_view_fetch (& view, 1, b, n, ys);
+            region_query_add (& q, xs, ys, n);
+        }
+    }
+
+    graph_view_close (& view);
+    return q.n;
+}
+
+void cip_graph_set_single_producer (CipGraph *graph, uint32_t enabled)
+{
+    graph->singleProducer = enabled & 1;
+}
+
+// levels the values of waterfall and row graphs are scaled to
+#define WATERFALL_LEVELS 1000 // FIXME: should be the resolution of the color scheme
+
+static uint64_t make_histogram_2d_waterfall (CipHistogram *hist, CipGraph *graph, uint32_t logMode, char plotType, uint64_t lastGraphCounter)
+{
+    int    *bins   = hist->bins;
+    double *sums   = hist->sums;
+    double *counts = hist->counts;
+
+    uint32_t w = hist->w;
+    uint32_t h = hist->h;
+
+    GraphView view;
+    uint32_t len = graph_view_open (graph, & view);
+    uint64_t retCounter = view.counter;
+    uint64_t firstCounter = view.counter - len + 1;
+    int i0 = 0;
+
+    if (lastGraphCounter && lastGraphCounter + 1 < firstCounter)
+    {
+        lastGraphCounter = 0;
+        print_warning ("lastGraphCounter is behind, truncating");
+    }
+
+    if (lastGraphCounter)
+    {
+        if (lastGraphCounter >= view.counter)
+        {
+            graph_view_close (& view);
+            return lastGraphCounter;
+        }
+        i0 = (int) (lastGraphCounter + 1 - firstCounter);
+    }
+
+    if (lastGraphCounter == 0)
+    {
+        i0 = len - 1;
+        int nRows = 0;
+        while (i0 > 0 && nRows <= h)
+        {
+            double x = graph_view_value (& view, 0, (uint32_t) i0);
+            double y = graph_view_value (& view, 1, (uint32_t) i0);
+            if (isnan (x) || isnan (y))
+                nRows++;
+            i0--;
+        }
+        memset (bins, 0x00, w*h*sizeof (bins[0]));
+        hist->topRow = 0;
+    }
+
+    // NaN points in the stored values start a new row, the log scale
+    // values are only used for binning
+    graph_view_use_log (& view, logMode);
+
+    double xs[GRAPH_BLOCK_LEN];
+    double ys[GRAPH_BLOCK_LEN];
+    double logXs[GRAPH_BLOCK_LEN];
+    double logYs[GRAPH_BLOCK_LEN];
+    const double *binXs = (logMode & 1) ? logXs : xs;
+    const double *binYs = (logMode & 2) ? logYs : ys;
+
+    for (uint32_t b=(uint32_t) i0; b<len; b+=GRAPH_BLOCK_LEN)
+    {
+        uint32_t n = MIN (GRAPH_BLOCK_LEN, len - b);
+        graph_view_fetch (& view, 0, b, n, xs);
+        graph_view_fetch (& view, 1, b, n, ys);
+        if (logMode & 1) graph_view_fetch_log (& view, 0, b, n, logXs);
+        if (logMode & 2) graph_view_fetch_log (& view, 1, b, n, logYs);
+
+        for (uint32_t i=0; i<n; i++)
+        {
+            if (isnan (xs[i]) || isnan (ys[i]))
+            {
+                // flush row, the new one starts out as a copy of the last
+                // and the oldest one is dropped
+                uint32_t lastRow = hist->topRow;
+                hist->topRow = (lastRow + h - 1) % h;
+                int *row = & bins[hist->topRow * w];
+                if (hist->topRow != lastRow)
+                    memcpy (row, & bins[lastRow * w], w * sizeof (bins[0]));
+
+                // construct new row
+                int lastNonZeroXi = -1;
+                for (uint32_t xi=0; xi<w; xi++)
+                {
+                    if (hist->counts[xi] > 1e-5)
+                    {
+                        double avg = sums[xi] / counts[xi];
+                        double yMin = hist->dataRange.y1;
+                        double yMax = hist->dataRange.y0;
+                        double w = (avg - yMin) / (yMax - yMin);
+
+                        if (lastNonZeroXi < 0)
+                            lastNonZeroXi = xi-1;
+                        for (int xik=lastNonZeroXi+1; xik<=xi; xik++)
+                            row[xik] = w * WATERFALL_LEVELS;
+
+                        //print_debug ("sums[xi]: %f counts[xi]: %f yMin: %f, yMax: %f avg: %f => w: %f => bins[%d]: %d",
+                        //sums[xi], counts[xi], yMin, yMax, avg, w, xi, bins[xi]);
+                        sums[xi]   = 0.0;
+                        counts[xi] = 0.0;
+                        lastNonZeroXi = xi;
+                    }
+                }
+            }
+            else
+            {
+                double x = binXs[i];
+                double y = binYs[i];
 
-                 cs->app_on_mouse_motion (cs, windowIndex, sw->mouseDataPos.x, sw->mouseDataPos.y);
-             }
+#define GET_XI(hist, xf) ((int) ((xf - hist->dataRange.x0) / (hist->dataRange.x1 - hist->dataRange.x0) * (hist->w-1)))
+                int xi = GET_XI (hist, x);
 
-             break;
-         }
-     case MOUSE_STATE_MOVING:
-         {
-             CipPosition oldPos = {cs->mouseWindowPos.x, cs->mouseWindowPos.y};
-             uint32_t w = cs->windowWidth;
-             uint32_t h = cs->windowHeight - cs->statuslineEnabled * STATUSLINE_HEIGHT;
-             cs->mouseWindowPos.x = (double) xi / w;
-             cs->mouseWindowPos.y = (double) yi / h;
-             CipSubWindow *sw = cs->activeSw;
-             CipArea *dr = & sw->dataRange;
-             double dx = (cs->mouseWindowPos.x - oldPos.x);
-             double dy = (cs->mouseWindowPos.y - oldPos.y);
-             if (!cs->zoomEnabled)
-             {
-                 dx /= (sw->windowArea.x1 - sw->windowArea.x0);
-                 dy /= (sw->windowArea.y1 - sw->windowArea.y0);
-             }
-             dx *= dr->x1 - dr->x0;
-             dy *= dr->y1 - dr->y0;
+                if (xi >= 0 && xi < w)
+                {
+                    sums[xi]   += y;
+                    counts[xi] += 1.0;
+                }
+            }
+        }
+    }
 
-             //printn ("moving window [%f, %f] < [%f, %f] => ", dr->x0, dr->y0, dr->x1, dr->y1);
-             dr->x0 -= dx;
-             dr->x1 -= dx;
-             dr->y0 -= dy;
-             dr->y1 -= dy;
-             //print ("[%f, %f] < [%f, %f] => ", dr->x0, dr->y0, dr->x1, dr->y1);
+    if (graph_view_overwritten (& view))
+        retCounter = 0;
 
-             break;
-         }
-     case MOUSE_STATE_SELECTING:
-         {
-             uint32_t w = cs->windowWidth;
-             uint32_t h = cs->windowHeight - cs->statuslineEnabled * STATUSLINE_HEIGHT;
-             cs->mouseWindowPos.x = (double) xi / w;
-             cs->mouseWindowPos.y = (double) yi / h;
-             CipArea *swa0 = & cs->activeSw->selectedWindowArea0;
-             CipArea *swa1 = & cs->activeSw->selectedWindowArea1;
-             swa0->x1 = cs->mouseWindowPos.x;
-             swa0->y1 = cs->mouseWindowPos.y;
-             if (swa0->x0 < swa0->x1)
-             {
-                 swa1->x0 = swa0->x0;
-                 swa1->x1 = swa0->x1;
-             }
-             else
-             {
-                 swa1->x0 = swa0->x1;
-                 swa1->x1 = swa0->x0;
-             }
-             if (swa0->y0 < swa0->y1)
-             {
-                 swa1->y0 = swa0->y0;
-                 swa1->y1 = swa0->y1;
-             }
-             else
-             {
-                 swa1->y0 = swa0->y1;
-                 swa1->y1 = swa0->y0;
-             }
+    graph_view_close (& view);
+    return retCounter;
+}
 
-             double minDiffX = 16.0 / w;
-             double minDiffY = 16.0 / h;
+// Samples [s0[xi], s1[xi]) of a row of a row graph that column xi of a
+// histogram shows: the ones binned to it, or the nearest one to its centre
+// when there are none. Columns off the row show none. In log x the columns
+// are spaced by LOGFUN of the sample positions, samples at or below zero
+// are not shown.
+static void row_columns (const CipHistogram *hist, const CipGraph *graph, int logX, uint32_t *s0, uint32_t *s1)
+{
+    uint32_t w = hist->w;
+    double xmin  = hist->dataRange.x0;
+    double xstep = (hist->dataRange.x1 - hist->dataRange.x0) / MAX (w - 1, 1);
 
-             double dx = swa1->x1 - swa1->x0;
-             double dy = swa1->y1 - swa1->y0;
+#define ROW_X(b) (logX ? EXPFUN (xmin + (b) * xstep) : xmin + (b) * xstep)
+#define ROW_SAMPLE(b) ((ROW_X (b) - graph->x0) / graph->dx)
+    for (uint32_t xi=0; xi<w; xi++)
+    {
+        double lo = ROW_SAMPLE (xi);
+        double hi = ROW_SAMPLE (xi + 1);
+        double a = MIN (MAX (ceil (MIN (lo, hi)), 0), graph->rowWidth);
+        double b = MIN (MAX (ceil (MAX (lo, hi)), 0), graph->rowWidth);
+        if (a < b)
+        {
+            s0[xi] = (uint32_t) a;
+            s1[xi] = (uint32_t) b;
+            continue;
+        }
 
-             if (dx >= minDiffX || dy >= minDiffY)
-             {
-                 CipArea zoomWindowArea = {0,0,1,1};
-                 CipArea *wa = cs->zoomEnabled ? & zoomWindowArea : & cs->activeSw->windowArea;
-                 if (dx < minDiffX)
-                 {
-                     swa1->x0 = wa->x0;
-                     swa1->x1 = wa->x1;
-                 }
-                 if (dy < minDiffY)
-                 {
-                     swa1->y0 = wa->y0;
-                     swa1->y1 = wa->y1;
-                 }
-             }
-             break;
-         }
-     case MOUSE_STATE_RESIZING_L:
-         {
-             break;
-         }
-     case MOUSE_STATE_RESIZING_R:
-         {
-             break;
-         }
-     case MOUSE_STATE_RESIZING_T:
-         {
-             break;
-         }
-     case MOUSE_STATE_RESIZING_B:
-         {
-             break;
-         }
-     case MOUSE_STATE_RESIZING_TL:
-         {
-             break;
-         }
-     case MOUSE_STATE_RESIZING_TR:
-         {
-             break;
-         }
-     case MOUSE_STATE_RESIZING_BL:
-         {
-             break;
-         }
-     case MOUSE_STATE_RESIZING_BR:
-         {
-             break;
-         }
-     default:
-         exit_error ("bug");
+        double nearest = floor (ROW_SAMPLE (xi + 0.5) + 0.5);
+        int inside = nearest >= 0 && nearest < graph->rowWidth;
+        s0[xi] = inside ? (uint32_t) nearest : 0;
+        s1[xi] = inside ? (uint32_t) nearest + 1 : 0;
     }
-    cs->mouse.x = xi;
-    cs->mouse.y = yi;
-    return 1;
+#undef ROW_SAMPLE
+#undef ROW_X
 }
 
-static void cycle_line_type (CipSubWindow *sw, int dir)
+// the average of the samples of each column, scaled to levels like waterfall
+// rows are, NaN samples left out, in log y averages at or below zero too
+static void resample_row (const float *src, const uint32_t *s0, const uint32_t *s1, uint32_t w,
+                          int logY, double vmin, double levelScale, int *dst)
 {
-    if (!sw)
-        return;
-
-    if (dir > 0)
+    for (uint32_t xi=0; xi<w; xi++)
     {
-        for (int i=0; i<sw->numAttachedGraphs; i++)
+        float sum = 0;
+        uint32_t n = 0;
+        for (uint32_t si=s0[xi]; si<s1[xi]; si++)
         {
-            GraphAttacher *attacher = sw->attachedGraphs[i];
-            switch (attacher->plotType)
-            {
-             case 'p': attacher->plotType = '+'; break;
-             case '+': attacher->plotType = 'l'; break;
-             case 'l': attacher->plotType = 't'; break;
-             case 't': attacher->plotType = 's'; break;
-             case 's': attacher->plotType = 'w'; break;
-             case 'w': attacher->plotType = 'p'; break;
-             default: print_error ("unknown line type '%c'", attacher->plotType); break;
-            }
+            int valid = !isnan (src[si]);
+            sum += valid ? src[si] : 0.0f;
+            n   += (uint32_t) valid;
         }
+
+        double mean = n ? sum / (float) n : NaN;
+        if (logY)
+            mean = mean > 0 ? LOGFUN (mean) : NaN;
+
+        double level = (mean - vmin) * levelScale;
+        dst[xi] = level > 0 ? (int) MIN (level, INT32_MAX) : 0;
     }
-    else
+}
+
+// Histogram of a row graph: the newest row at the top and older ones below,
+// kept as a ring of rows like waterfall plots are so that only new rows are
+// resampled. Values are scaled with the y range of the view. The log mode
+// applies to sample positions and values like it does to the points of
+// other graphs.
+static uint64_t make_histogram_rows (CipHistogram *hist, CipGraph *graph, uint32_t logMode, char plotType, uint64_t lastGraphCounter)
+{
+    uint32_t w = hist->w;
+    uint32_t h = hist->h;
+
+    GraphView view;
+    uint32_t len = graph_view_open (graph, & view);
+    uint64_t counter = view.counter;
+
+    // rows that came in since the last pass, start over when they fill the
+    // histogram anyway
+    uint64_t nRows = counter - lastGraphCounter;
+    if (lastGraphCounter == 0 || lastGraphCounter > counter || nRows >= h)
     {
-        for (int i=0; i<sw->numAttachedGraphs; i++)
+        memset (hist->bins, 0, w * h * sizeof (hist->bins[0]));
+        hist->topRow = 0;
+        nRows = h;
+    }
+    nRows = MIN (nRows, len);
+
+    uint32_t *s0 = safe_calloc (2 * w, sizeof (s0[0]));
+    uint32_t *s1 = s0 + w;
+    row_columns (hist, graph, logMode & 1, s0, s1);
+
+    double vmin = hist->dataRange.y1;
+    double vmax = hist->dataRange.y0;
+    double levelScale = WATERFALL_LEVELS / (vmax - vmin);
+
+    // oldest first, each one going on top, the rows no longer in the graph
+    // are cleared as they move down
+    for (uint32_t r=len - (uint32_t) nRows; r<len; r++)
+    {
+        hist->topRow = (hist->topRow + h - 1) % h;
+        resample_row (graph_view_row (& view, r), s0, s1, w, logMode & 2, vmin, levelScale, & hist->bins[hist->topRow * w]);
+        if (len < h)
+            memset (& hist->bins[((hist->topRow + len) % h) * w], 0, w * sizeof (hist->bins[0]));
+    }
+    free (s0);
+
+    if (graph_view_overwritten (& view))
+        counter = 0;
+
+    graph_view_close (& view);
+    return counter;
+}
+
+// bin coordinates before truncation
+#define BIN_X(hist, s, x) (((hist)->w-1) * ((x) - (s)->xmin) * (s)->invXRange)
+#define BIN_Y(hist, s, y) (((hist)->h-1) * ((y) - (s)->ymin) * (s)->invYRange)
+
+// bin_coords works on up to BIN_CHUNK_LEN points at a time
+#define BIN_CHUNK_LEN 256
+
+static void bin_points (CipHistogram *hist, const BinScale *s, const double *xs, const double *ys, uint32_t n)
+{
+    int *bins  = hist->bins;
+    uint32_t w = hist->w;
+    uint32_t h = hist->h;
+
+    int32_t xis[BIN_CHUNK_LEN];
+    int32_t yis[BIN_CHUNK_LEN];
+    for (uint32_t b=0; b<n; b+=BIN_CHUNK_LEN)
+    {
+        uint32_t m = MIN (BIN_CHUNK_LEN, n - b);
+        bin_coords (s, w, h, 0, xs + b, ys + b, m, xis, yis);
+        for (uint32_t i=0; i<m; i++)
+            if (xis[i] != BIN_OUTSIDE)
+                bins[(uint32_t) yis[i]*w + (uint32_t) xis[i]]++;
+    }
+}
+
+static void bin_crosses (CipHistogram *hist, const BinScale *s, const double *xs, const double *ys, uint32_t n)
+{
+    int *bins  = hist->bins;
+    int w = (int) hist->w;
+    int h = (int) hist->h;
+
+    int32_t xis[BIN_CHUNK_LEN];
+    int32_t yis[BIN_CHUNK_LEN];
+    for (uint32_t b=0; b<n; b+=BIN_CHUNK_LEN)
+    {
+        // the arms of a cross reach two bins out
+        uint32_t m = MIN (BIN_CHUNK_LEN, n - b);
+        bin_coords (s, hist->w, hist->h, 2, xs + b, ys + b, m, xis, yis);
+        for (uint32_t i=0; i<m; i++)
         {
-            GraphAttacher *attacher = sw->attachedGraphs[i];
-            switch (attacher->plotType)
+            if (xis[i] == BIN_OUTSIDE)
+                continue;
+
+            int xi = xis[i];
+            int yi = yis[i];
+            int xx[9] = { 0,  0, -2, -1, 0, 1, 2, 0, 0};
+            int yy[9] = {-2, -1,  0,  0, 0, 0, 0, 1, 2};
+            for (int j=0; j<9; j++)
             {
-             case 'w': attacher->plotType = 's'; break;
-             case 'p': attacher->plotType = 'w'; break;
-             case '+': attacher->plotType = 'p'; break;
-             case 'l': attacher->plotType = '+'; break;
-             case 't': attacher->plotType = 'l'; break;
-             case 's': attacher->plotType = 't'; break;
-             default: print_error ("unknown line type '%c'", attacher->plotType); break;
+                int xp = xi+xx[j];
+                int yp = yi+yy[j];
+                if (xp >= 0 && xp < w && yp >= 0 && yp < h)
+                    bins[yp*w + xp]++;
             }
         }
     }
 }
 
-void cip_set_app_keyboard_callback (CipState *cs, int (*app_on_keyboard) (CipState *cs, int key, int mod, int pressed, int repeat))
+// Point plots of bounded graphs remember the bin each point landed in, so
+// that it can be taken out of the histogram again when the point leaves the
+// graph. The bin is padded by the two bins a cross reaches outside of the
+// view, -1 stands for a point none of whose pixels can be visible.
+#define POINT_BIN_PAD 2
+
+static void point_bins (const CipHistogram *hist, const BinScale *s, const double *xs, const double *ys, uint32_t n, int32_t *dst)
 {
-    cs->app_on_keyboard = app_on_keyboard;
+    int pw = (int) hist->w + 2 * POINT_BIN_PAD;
+
+    for (uint32_t i=0; i<n; i++)
+    {
+        double x = xs[i];
+        double y = ys[i];
+        dst[i] = -1;
+
+        if (isnan (x) || isnan (y) || isinf (x) || isinf (y))
+            continue;
+
+        // same as BIN_X and BIN_Y, range checked before truncating
+        double xf = (hist->w-1) * (x - s->xmin) * s->invXRange;
+        double yf = (hist->h-1) * (y - s->ymin) * s->invYRange;
+        if (xf <= -POINT_BIN_PAD - 1 || xf >= hist->w + POINT_BIN_PAD ||
+            yf <= -POINT_BIN_PAD - 1 || yf >= hist->h + POINT_BIN_PAD)
+            continue;
+
+        int xi = (int) xf;
+        int yi = (int) yf;
+        dst[i] = (yi + POINT_BIN_PAD) * pw + xi + POINT_BIN_PAD;
+    }
 }
 
-void cip_set_app_mouse_motion (CipState *cs, int (*app_on_mouse_motion) (CipState *cs, int windowIndex, double x, double y))
+// adds (delta 1) or removes (delta -1) a point recorded by point_bins
+static void bin_point_bin (CipHistogram *hist, char plotType, int32_t pointBin, int delta)
 {
-    cs->app_on_mouse_motion = app_on_mouse_motion;
+    if (pointBin < 0)
+        return;
+
+    int *bins  = hist->bins;
+    uint32_t w = hist->w;
+    uint32_t h = hist->h;
+    int pw = (int) w + 2 * POINT_BIN_PAD;
+    int xi = pointBin % pw - POINT_BIN_PAD;
+    int yi = pointBin / pw - POINT_BIN_PAD;
+
+    if (plotType == 'p')
+    {
+        if (xi >= 0 && xi < w && yi >= 0 && yi < h)
+            bins[(uint32_t) yi*w + (uint32_t) xi] += delta;
+        return;
+    }
+
+    int xx[9] = { 0,  0, -2, -1, 0, 1, 2, 0, 0};
+    int yy[9] = {-2, -1,  0,  0, 0, 0, 0, 1, 2};
+    for (int j=0; j<9; j++)
+    {
+        int xp = xi+xx[j];
+        int yp = yi+yy[j];
+        if (xp >= 0 && xp < w && yp >= 0 && yp < h)
+            bins[(uint32_t) yp*w + (uint32_t) xp] += delta;
+    }
 }
 
-static int on_keyboard (CipState *cs, int key, int mod, int pressed, int repeat)
+// bins n points starting at the one with counter 'counter', recording their bins
+static void bin_tracked_points (CipHistogram *hist, const BinScale *s, char plotType, uint64_t counter,
+                                const double *xs, const double *ys, uint32_t n)
 {
-    static int userRedirect = 0;
-    if (key == 27 && pressed)
+    int32_t pointBins[GRAPH_BLOCK_LEN];
+    point_bins (hist, s, xs, ys, n, pointBins);
+
+    uint32_t mask = hist->pointBinsLen - 1;
+    for (uint32_t i=0; i<n; i++)
     {
-        if (cs->app_on_keyboard)
-        {
-            userRedirect ^= 1;
-            print_debug ("keyboard redirect turned %s", userRedirect ? "on" : "off");
+        bin_point_bin (hist, plotType, pointBins[i], 1);
+        hist->pointBins[(counter + i) & mask] = pointBins[i];
+    }
+}
+
+// The count for each bin of a vertical span drawn in place of n segments in
+// its column. Together the segments count travel + n, travel being the rows
+// they move up and down by, which is at least the height of the span. The
+// span spreads that evenly over its rows. Callers that do not know the
+// travel pass 0.
+static int span_weight (double y0, double y1, uint32_t n, double travel)
+{
+    double rows = fabs (trunc (y1) - trunc (y0)) + 1;
+    return (int) MAX (1, lround ((n + MAX (travel, rows - 1)) / rows));
+}
+
+// Runs of at least this many segments within one pixel column are drawn as a
+// single span from their lowest to their highest point. It lights the same
+// pixels the segments would, weighted by span_weight like the columns of
+// bin_lines_lod.
+#define COLUMN_RUN_MIN_SEGMENTS 4
+
+// a segment between two points in unrounded bin coordinates
+static void bin_segment (CipHistogram *hist, char plotType, double x0, double y0, double x1, double y1)
+{
+    if (plotType == 's')
+    {
+        raster_segment (hist->bins, hist->w, hist->h, x0, y0, x1, y0, 0);
+        raster_segment (hist->bins, hist->w, hist->h, x1, y0, x1, y1, 0);
+        return;
+    }
+
+    raster_segment (hist->bins, hist->w, hist->h, x0, y0, x1, y1, plotType == 't');
+}
+
+// n segments between n+1 consecutive points, drawn as lines ('l'), thick lines ('t') or steps ('s')
+static void bin_lines (CipHistogram *hist, const BinScale *s, char plotType, const double *xs, const double *ys, uint32_t n)
+{
+    // NOTE: A straight line between two points is moving through different points depending on log mode
+    double xf[GRAPH_BLOCK_LEN];
+    double yf[GRAPH_BLOCK_LEN];
+    for (uint32_t i=0; i<=n; i++)
+    {
+        xf[i] = BIN_X (hist, s, xs[i]);
+        yf[i] = BIN_Y (hist, s, ys[i]);
+    }
+
+    uint32_t i = 0;
+    while (i < n)
+    {
+        // the points following point i in its column, segments with NaN or
+        // infinite points are not drawn
+        uint32_t j = i;
+        double column = trunc (xf[i]);
+        double ylo = yf[i];
+        double yhi = yf[i];
+        double travel = 0;
+        if (isfinite (xf[i]) && isfinite (yf[i]))
+        {
+            while (j < n && trunc (xf[j+1]) == column && isfinite (yf[j+1]))
+            {
+                j++;
+                ylo = MIN (ylo, yf[j]);
+                yhi = MAX (yhi, yf[j]);
+                travel += fabs (trunc (yf[j]) - trunc (yf[j-1]));
+            }
         }
-        else
+
+        if (j - i >= COLUMN_RUN_MIN_SEGMENTS)
         {
-            print_debug ("call cip_set_app_keyboard_callback to enable user keyboard callback");
+            int weight = span_weight (ylo, yhi, j - i, travel);
+            raster_column (hist->bins, hist->w, hist->h, xf[i], ylo, yhi, plotType == 't', weight);
+            i = j;
+            continue;
         }
-    }
 
-    if (userRedirect && cs->app_on_keyboard)
-    {
-        return cs->app_on_keyboard (cs, key, mod, pressed, repeat);
+        for (uint32_t runEnd = MAX (j, i + 1); i < runEnd; i++)
+            if (isfinite (xf[i]) && isfinite (yf[i]) && isfinite (xf[i+1]) && isfinite (yf[i+1]))
+                bin_segment (hist, plotType, xf[i], yf[i], xf[i+1], yf[i+1]);
     }
+}
 
+// Spans of at least PARALLEL_MIN_POINTS points are binned by the worker
+// threads, in chunks of PARALLEL_CHUNK_LEN points. Each worker bins into a
+// private partial histogram, worker 0 into the histogram itself, and the
+// partials are summed up band by band afterwards.
+#define PARALLEL_MIN_POINTS (1 << 16)
+#define PARALLEL_CHUNK_LEN  (1 << 14)
 
-    // FIXME: If both the left and right key of the same modifier gets pressed at
-    // the same time and then one gets released, the state of pressedModifiers
-    // gets zeroed out
-    if (key == SDLK_LSHIFT || key == SDLK_RSHIFT)
-    {
-        if (pressed)
-            cs->pressedModifiers |= KMOD_SHIFT;
-        else
-            cs->pressedModifiers &= ~KMOD_SHIFT;
-        return 0;
-    }
-    else if (key == SDLK_LGUI || key == SDLK_RGUI)
+typedef struct PartialHistogram
+{
+    int *bins;
+    double (*xyzSums)[3];
+    uint32_t nBins;
+    uint32_t nSums;
+    uint32_t used;           // binned into during the current pass
+} PartialHistogram;
+
+static PartialHistogram partials[MAX_WORKER_THREADS];
+static atomic_flag partialsAccess = ATOMIC_FLAG_INIT;
+
+// the histogram 'worker' bins into: hist itself for worker 0, a zeroed partial otherwise
+static void partial_histogram (const CipHistogram *hist, uint32_t worker, CipHistogram *part)
+{
+    *part = *hist;
+    if (worker == 0)
+        return;
+
+    PartialHistogram *p = & partials[worker];
+    uint32_t nBins = hist->w * hist->h;
+    if (p->nBins < nBins)
     {
-        if (pressed)
-            cs->pressedModifiers |= KMOD_GUI;
-        else
-            cs->pressedModifiers &= ~KMOD_GUI;
-        return 0;
+        free (p->bins);
+        p->bins  = safe_calloc (nBins, sizeof (p->bins[0]));
+        p->nBins = nBins;
     }
-    else if (key == SDLK_LALT || key == SDLK_RALT)
+    if (hist->xyzSums && p->nSums < nBins)
     {
-        if (pressed)
-            cs->pressedModifiers |= KMOD_ALT;
-        else
-            cs->pressedModifiers &= ~KMOD_ALT;
-        return 0;
+        free (p->xyzSums);
+        p->xyzSums = safe_calloc (nBins, sizeof (p->xyzSums[0]));
+        p->nSums   = nBins;
     }
-    else if (key == SDLK_LCTRL || key == SDLK_RCTRL)
+
+    if (!p->used)
     {
-        if (pressed)
-            cs->pressedModifiers |= KMOD_CTRL;
-        else
-            cs->pressedModifiers &= ~KMOD_CTRL;
-        return 0;
+        memset (p->bins, 0, nBins * sizeof (p->bins[0]));
+        if (hist->xyzSums)
+            memset (p->xyzSums, 0, nBins * sizeof (p->xyzSums[0]));
+        p->used = 1;
     }
 
-    int unhandled = 0;
-    if (pressed)
+    part->bins = p->bins;
+    if (hist->xyzSums)
+        part->xyzSums = p->xyzSums;
+}
+
+static void reduce_partials_task (void *arg, uint32_t task, uint32_t worker)
+{
+    (void) worker;
+    CipHistogram *hist = arg;
+    uint32_t nBins = hist->w * hist->h;
+    uint32_t i0 = task * PARALLEL_CHUNK_LEN;
+    uint32_t i1 = MIN (i0 + PARALLEL_CHUNK_LEN, nBins);
+
+    for (uint32_t wi=1; wi<workerPool.nThreads; wi++)
     {
-        if (!repeat)
-        {
-           if (mod == KMOD_NONE)
-           {
-               switch (key)
-               {
-                case 'a': cip_autoscale_sw (cs->activeSw); break;
-                case 'c': cycle_graph_order (cs); break;
-                case 'f': cip_set_fullscreen (cs, ! cs->fullscreen); break;
-                case 'g': if (cs->activeSw) { cip_set_grid_mode_sw (cs->activeSw, cs->activeSw->gridMode + 1); print_debug ("grid mode %d", cs->activeSw->gridMode); } break;
-                case 'h': toggle_help (cs); break;
-                case 'i': cip_save_png (cs, ".", cs->frameCounter, 0); break;
-                case 'm': cip_set_crosshair_enabled (cs, !cs->crosshairEnabled); break;
-                case 'o': if (cs->activeSw) {cip_set_log_mode_sw (cs, cs->activeSw, cs->activeSw->logMode + 1); print_debug ("log mode %d", cs->activeSw->logMode);} break;
-                case '\t': if (cs->activeSw) {cycle_selected_graph (cs->activeSw, 1); print_debug ("graph %d", cs->activeSw->selectedGraph);cs->on_mouse_motion (cs, cs->mouse.x, cs->mouse.y);} break; 
-                case 's': cip_set_statusline_enabled (cs, !cs->statuslineEnabled); break;
-                case 'q': cip_quit (cs); break;
-                case 'u': undo_zooming (cs->activeSw); break;
-                case 'e': cip_force_refresh (cs); break;
-                case 't': cip_set_tracking_mode (cs, cs->trackingMode + 1); cs->on_mouse_motion (cs, cs->mouse.x, cs->mouse.y);break;
-                case 'l': cycle_line_type (cs->activeSw, 1); break;
-                          //case 'x': exit_zoom (cs); break;
-                case ' ': cip_toggle_paused (cs); break;
+        PartialHistogram *p = & partials[wi];
+        if (!p->used)
+            continue;
 
-                //case 'r':
-                //          {
-                //              extern int recording;
-                //              recording ^= 1;
-                //              print_debug ("recording %d", recording);
-                //              break;
-                //          }
-                case '0':
-                case '1':
-                case '2':
-                case '3':
-                case '4':
-                case '5':
-                case '6':
-                case '7':
-                case '8':
-                case '9':
-                          {
-                              if (cs->activeSw)
-                              {
-                                  int idx = key - '0';
-                                  CipSubWindow *sw = cs->activeSw;
-                                  CipArea *dstArea = & sw->dataRange;
-                                  CipArea *srcArea = & storedDataRanges[idx];
-                                  if (srcArea->x0 != srcArea->x1 && srcArea->y0 != srcArea->y1)
-                                  {
-                                      memcpy (dstArea, srcArea, sizeof (*srcArea));
-                                      print_debug ("restore range from %d", idx);
-                                  }
-                                  else
-                                      print_debug ("no range stored at %d", idx);
-                              }
-                              break;
-                          }
-                          //{
-                          //    int index = key - '1';
-                          //    if (index < 0)
-                          //        index = 9;
-                          //    float shades[10] = {0.0f, 0.04f, 0.06f, 0.08f, 0.10f, 0.14f, 0.2f, 0.4f, 0.7f, 1.0f};
-                          //    cs->bgShade = shades[index];
-                          //    break;
-                          //}
-                case 27:
-                          {
-                              cs->mouseState = MOUSE_STATE_NONE;
-                              if (cs->activeSw)
-                              {
-                                  CipArea *a0 = & cs->activeSw->selectedWindowArea0;
-                                  CipArea *a1 = & cs->activeSw->selectedWindowArea1;
-                                  bzero (a0, sizeof (*a0));
-                                  bzero (a1, sizeof (*a1));
-                              }
-                              break;
-                          }
-                case 'x':
-                case 'y':
-                case 'z':
-                          {
-                              int s = key - 'x';
-                              if (cs->activeSw)
-                              {
-                                  double (*mtx)[3] = cs->activeSw->rotMatrix;
-                                  for (int i=0; i<3; i++)
-                                      for (int j=0; j<3; j++)
-                                          mtx[i][j] = (i == ((j + s) % 3));
-                              }
-                              break;
-                          }
-                default: unhandled = 1;
-               }
-           }
-           else if (mod == KMOD_LSHIFT || mod == KMOD_RSHIFT || mod == KMOD_SHIFT)
-           {
-               switch (key)
-               {
-                case '0':
-                case '1':
-                case '2':
-                case '3':
-                case '4':
-                case '5':
-                case '6':
-                case '7':
-                case '8':
-                case '9':
-                    {
-                        if (cs->activeSw)
-                        {
-                            int idx = key - '0';
-                            CipSubWindow *sw = cs->activeSw;
-                            CipArea *srcArea = & sw->dataRange;
-                            CipArea *dstArea = & storedDataRanges[idx];
-                            if (srcArea->x0 != srcArea->x1 && srcArea->y0 != srcArea->y1)
-                            {
-                                memcpy (dstArea, srcArea, sizeof (*srcArea));
-                                print_debug ("save range to %d", idx);
-                            }
-                        }
-                        break;
-                    }
-                case '\t':
-                    if (cs->activeSw)
-                    {
-                        cycle_selected_graph (cs->activeSw, cs->activeSw->numAttachedGraphs - 1);
-                        print_debug ("graph %d", cs->activeSw->selectedGraph);
-                        cs->on_mouse_motion (cs, cs->mouse.x, cs->mouse.y);
-                    }
-                    break;
-                case 'l': cycle_line_type (cs->activeSw, -1);
-                          break;
-                case 't':
-                    {
-                        cip_set_tracking_mode (cs, cs->trackingMode + 3);
-                        cs->on_mouse_motion (cs, cs->mouse.x, cs->mouse.y);
-                        break;
-                    }
-                case 'n': sub_window_change (cs, -1);
-                          break;
-                default: unhandled = 1;
-               }
-           }
-           else
-           {
-               unhandled = 1;
-           }
-        }
-        if (unhandled || repeat)
+        for (uint32_t i=i0; i<i1; i++)
+            hist->bins[i] += p->bins[i];
+
+        if (hist->xyzSums)
         {
-            unhandled = 0;
-            if (mod == KMOD_NONE)
-            {
-                double zf = 0.05;
-                double mf = 0.025;
-                switch (key)
-                {
-                 case 'n': sub_window_change (cs,  1); break;
-                 case '+': cip_zoom (cs->activeSw,  zf,  zf); break;
-                 case '-': cip_zoom (cs->activeSw, -zf, -zf); break;
-                 case ',': cip_zoom (cs->activeSw, -zf,  0.00); break;
-                 case '.': cip_zoom (cs->activeSw,  zf,  0.00); break;
-                           //case 'i': cip_zoom (cs->activeSw,  0.00, -zf); break;
-                           //case 'o': cip_zoom (cs->activeSw,  0.00,  zf); break;
-                 case SDLK_UP:    cip_move (cs->activeSw,  0.00, -mf); break;
-                 case SDLK_DOWN:  cip_move (cs->activeSw,  0.00,  mf); break;
-                 case SDLK_LEFT:  cip_move (cs->activeSw, -mf,  0.00); break;
-                 case SDLK_RIGHT: cip_move (cs->activeSw,  mf,  0.00); break;
-                 default: unhandled = 1; break;
-                }
-            }
-            else if (mod == KMOD_LSHIFT || mod == KMOD_RSHIFT || mod == KMOD_SHIFT)
+            for (uint32_t i=i0; i<i1; i++)
             {
-                switch (key)
-                {
-                 case 'n': sub_window_change (cs, -1); break;
-                 default: unhandled = 1; break;
-                }
-            }
-            else
-            {
-                unhandled = 1;
+                hist->xyzSums[i][0] += p->xyzSums[i][0];
+                hist->xyzSums[i][1] += p->xyzSums[i][1];
+                hist->xyzSums[i][2] += p->xyzSums[i][2];
             }
         }
     }
+}
+
+static void reduce_partials (CipHistogram *hist)
+{
+    uint32_t nBins = hist->w * hist->h;
+    parallel_for ((nBins + PARALLEL_CHUNK_LEN - 1) / PARALLEL_CHUNK_LEN, reduce_partials_task, hist);
+
+    for (uint32_t wi=1; wi<workerPool.nThreads; wi++)
+        partials[wi].used = 0;
+}
+
+// what bin_span needs to bin a span of points of a view
+typedef struct BinJob
+{
+    CipHistogram *hist;
+    GraphView *view;
+    BinScale s;
+    char plotType;
+    uint32_t logMode;
+    int tracked;             // record the bin of each point, see point_bins
+    int is3d;
+    double xlo, xhi, ylo, yhi;
+    uint32_t begin;
+    uint32_t end;
+    uint32_t slot;           // first chunk slot of a progressive pass
+    uint32_t slotBits;
+} BinJob;
+
+static void bin_span_3d (const BinJob *job, CipHistogram *hist, uint32_t b0, uint32_t b1)
+{
+    GraphView *view = job->view;
+    int *bins  = hist->bins;
+    double (*xyzSums)[3] = hist->xyzSums;
+    uint32_t w = hist->w;
+    uint32_t h = hist->h;
+
+    double xmin = (double) hist->dataRange.x0;
+    double xmax = (double) hist->dataRange.x1;
+    double ymin = (double) hist->dataRange.y0;
+    double ymax = (double) hist->dataRange.y1;
+    BinScale s = {xmin, ymin, 1.0 / (xmax - xmin), 1.0 / (ymax - ymin)};
+
+    double xs[GRAPH_BLOCK_LEN];
+    double ys[GRAPH_BLOCK_LEN];
+    double zs[GRAPH_BLOCK_LEN];
+    int32_t xis[GRAPH_BLOCK_LEN];
+    int32_t yis[GRAPH_BLOCK_LEN];
+
+    for (uint32_t b=b0; b<b1; b+=GRAPH_BLOCK_LEN)
+    {
+        uint32_t n = MIN (GRAPH_BLOCK_LEN, b1 - b);
+        graph_view_fetch (view, 0, b, n, xs);
+        graph_view_fetch (view, 1, b, n, ys);
+        graph_view_fetch (view, 2, b, n, zs);
+
+        bin_project (*rotMatrix, perspectiveFactor, & s, w, h, xs, ys, zs, n, xis, yis);
+        for (uint32_t i=0; i<n; i++)
+        {
+            if (xis[i] == BIN_OUTSIDE)
+                continue;
+
+            uint32_t bi = (uint32_t) yis[i]*w + (uint32_t) xis[i];
+            bins   [bi]++;
+            xyzSums[bi][0] += xs[i];
+            xyzSums[bi][1] += ys[i];
+            xyzSums[bi][2] += zs[i];
+        }
+    }
+}
 
-    if (cs->pressedModifiers == KMOD_CTRL && key == 'c')
+// bins the points b0 to b1 of the view, or for line plots the segments starting at them
+static void bin_span (const BinJob *job, CipHistogram *hist, uint32_t b0, uint32_t b1)
+{
+    if (job->is3d)
     {
-        cip_quit (cs);
-        unhandled = 0;
+        bin_span_3d (job, hist, b0, b1);
+        return;
     }
 
-    if (unhandled && (! cs->app_on_keyboard || ! cs->app_on_keyboard (cs, key, mod, pressed, repeat)))
+    GraphView *view = job->view;
+    char plotType = job->plotType;
+    uint32_t logMode = job->logMode;
+
+    // line plots fetch one extra point per block so that the segment crossing
+    // the block boundary is drawn too
+    int isLine = plotType == 'l' || plotType == 't' || plotType == 's';
+    uint32_t step = isLine ? GRAPH_BLOCK_LEN - 1 : GRAPH_BLOCK_LEN;
+
+    double xs[GRAPH_BLOCK_LEN];
+    double ys[GRAPH_BLOCK_LEN];
+
+    uint32_t n;
+    for (uint32_t b=b0; b<b1; b+=n)
     {
-        print_debug ("key: %c (%d), pressed: %d, repeat: %d", key, key, pressed, repeat);
-        return 0;
-    }
+        // segments entirely outside of the view are skipped without reading them
+        uint32_t segmentLeft;
+        const SegmentZone *zone = graph_view_zone (view, b, & segmentLeft);
+        n = MIN (segmentLeft, b1 - b);
+        if (zone && segment_zone_outside (zone, job->xlo, job->xhi, job->ylo, job->yhi))
+        {
+            if (job->tracked)
+                for (uint32_t i=0; i<n; i++)
+                    hist->pointBins[(view->firstCounter + b + i) & (hist->pointBinsLen - 1)] = -1;
+            continue;
+        }
 
-    return 1;
+        n = MIN (n, step);
+        uint32_t nFetch = isLine ? n + 1 : n;
+        graph_view_fetch_scaled (view, 0, logMode, b, nFetch, xs);
+        graph_view_fetch_scaled (view, 1, logMode, b, nFetch, ys);
+
+        if (job->tracked)
+            bin_tracked_points (hist, & job->s, plotType, view->firstCounter + b, xs, ys, n);
+        else if (plotType == 'p')
+            bin_points (hist, & job->s, xs, ys, n);
+        else if (plotType == '+')
+            bin_crosses (hist, & job->s, xs, ys, n);
+        else
+            bin_lines (hist, & job->s, plotType, xs, ys, n);
+    }
 }
 
+static void bin_span_task (void *arg, uint32_t task, uint32_t worker)
+{
+    const BinJob *job = arg;
+    CipHistogram part;
+    partial_histogram (job->hist, worker, & part);
 
-GraphAttacher *cip_graph_attach (CipState *cs, CipGraph *graph, uint32_t windowIndex, HistogramFun histogramFun, char plotType, char *colorSpec, uint32_t numColors)
+    uint32_t b0 = job->begin + task * PARALLEL_CHUNK_LEN;
+    bin_span (job, & part, b0, MIN (b0 + PARALLEL_CHUNK_LEN, job->end));
+}
+
+// bins the span from begin to end, split over the worker threads if it is
+// large and no other pass has them
+static void bin_range (BinJob *job, uint32_t begin, uint32_t end)
 {
-    if (windowIndex >= cs->numSubWindows)
-    {
-        print_error ("windowIndex %d out of range", windowIndex);
-        return NULL;
-    }
+    if (end <= begin)
+        return;
 
-    CipSubWindow *sw = & cs->subWindows[windowIndex];
-    if (sw->numAttachedGraphs >= sw->maxNumAttachedGraphs)
+    if (workerPool.nThreads == 1 || end - begin < PARALLEL_MIN_POINTS || !try_access (& partialsAccess))
     {
-        print_error ("maximum number of attached graphs reached");
-        return NULL;
+        bin_span (job, job->hist, begin, end);
+        return;
     }
 
-    int is3d = graph->sb->itemSize == sizeof (double) * 3;
-    GraphAttacher *attacher = safe_calloc (1, sizeof (*attacher));
-    attacher->graph = graph;
-    attacher->plotType = plotType;
-    attacher->hist.w = 0;
-    attacher->hist.h = 0;
-    attacher->hist.bins = NULL;
-    attacher->hist.xyzSums = NULL;
-    attacher->histogramFun = histogramFun ? histogramFun : is3d ? make_histogram_3d : make_histogram_2d;
-    attacher->colorScheme = make_color_scheme (colorSpec, numColors);
-    attacher->lastGraphCounter = 0;
+    job->begin = begin;
+    job->end   = end;
+    parallel_for ((end - begin + PARALLEL_CHUNK_LEN - 1) / PARALLEL_CHUNK_LEN, bin_span_task, job);
+    reduce_partials (job->hist);
+    release_access (& partialsAccess);
+}
 
-    sw->attachedGraphs[sw->numAttachedGraphs] = attacher;
-    sw->numAttachedGraphs++;
-    return attacher;
+// rebuilds of fewer points are not spread over several frames
+#define PROGRESSIVE_MIN_POINTS PARALLEL_MIN_POINTS
+
+static uint32_t reverse_bits (uint32_t v, uint32_t nBits)
+{
+    uint32_t r = 0;
+    for (uint32_t i=0; i<nBits; i++, v >>= 1)
+        r = (r << 1) | (v & 1);
+    return r;
 }
 
-static void cinterplot_wait (CipState *cs)
+// Span [*b0, *b1) of the view binned by a slot of a progressive rebuild,
+// returns 0 if it is empty. Points that left the view are skipped.
+static int progress_chunk (const CipProgress *p, const GraphView *view, uint32_t slot, uint32_t slotBits, uint32_t *b0, uint32_t *b1)
 {
-    cs->stopped = 1;
-    while (cs->redrawing)
-        usleep (10000);
+    uint64_t c0 = p->begin + (uint64_t) reverse_bits (slot, slotBits) * PARALLEL_CHUNK_LEN;
+    uint64_t c1 = MIN (c0 + PARALLEL_CHUNK_LEN, p->end);
+    c0 = MAX (c0, view->firstCounter);
+    c1 = MIN (c1, view->firstCounter + view->len);
+    if (c1 <= c0)
+        return 0;
+
+    *b0 = (uint32_t) (c0 - view->firstCounter);
+    *b1 = (uint32_t) (c1 - view->firstCounter);
+    return 1;
 }
 
-static void cinterplot_continue (CipState *cs)
+static void bin_chunk_task (void *arg, uint32_t task, uint32_t worker)
 {
-    cs->stopped = 0;
+    const BinJob *job = arg;
+    uint32_t b0, b1;
+    if (!progress_chunk (& job->hist->progress, job->view, job->slot + task, job->slotBits, & b0, & b1))
+        return;
+
+    CipHistogram part;
+    partial_histogram (job->hist, worker, & part);
+    bin_span (job, & part, b0, b1);
 }
 
-int cip_graph_detach (CipState *cs, CipGraph *graph, uint32_t windowIndex)
+// starts a progressive rebuild binning the points from i0 to end of the view
+static void progress_start (CipHistogram *hist, const GraphView *view, uint32_t i0, uint32_t end, int tracked)
 {
-    int removed = 0;
-    cinterplot_wait (cs);
-    CipSubWindow *sw = & cs->subWindows[windowIndex];
-    uint32_t giNew = 0;
-    for (uint32_t giOld=0; giOld<sw->numAttachedGraphs; giOld++)
+    CipProgress *p = & hist->progress;
+    p->counter = view->counter;
+    p->begin   = view->firstCounter + i0;
+    p->end     = view->firstCounter + end;
+    p->binned  = 0;
+    p->slot    = 0;
+    p->tracked = (uint32_t) tracked;
+}
+
+// returns 1 if the rebuild under way was started by the last call, on the same graph
+static int progress_resumable (const CipHistogram *hist, const GraphView *view, uint64_t lastGraphCounter)
+{
+    const CipProgress *p = & hist->progress;
+    return p->counter && lastGraphCounter == p->counter &&
+        hist->generation == view->snap.generation && view->counter >= p->counter;
+}
+
+// Bins chunks of the rebuild under way until all are binned or the budget,
+// counted from t0, is used up. The chunks are taken in bit reversed order,
+// whatever part is binned is spread over all of the points. Returns the
+// counter the histogram function hands back.
+static uint64_t bin_progressive (BinJob *job, double t0)
+{
+    CipHistogram *hist = job->hist;
+    CipProgress *p = & hist->progress;
+    const GraphView *view = job->view;
+
+    uint64_t nChunks = (p->end - p->begin + PARALLEL_CHUNK_LEN - 1) / PARALLEL_CHUNK_LEN;
+    uint32_t slotBits = 0;
+    while ((1ull << slotBits) < nChunks)
+        slotBits++;
+    uint32_t nSlots = 1u << slotBits;
+
+    // a few chunks per worker at first, twice as many every round
+    uint32_t batch = 2 * workerPool.nThreads;
+    while (p->slot < nSlots)
     {
-        //print_debug ("giOld: %d giNew: %d sw:%p", giOld, giNew, sw);
-        GraphAttacher *attacher = sw->attachedGraphs[giOld];
-        if (attacher->graph == graph)
+        uint32_t n = MIN (batch, nSlots - p->slot);
+        job->slot     = p->slot;
+        job->slotBits = slotBits;
+
+        if (workerPool.nThreads > 1 && n > 1 && try_access (& partialsAccess))
         {
-            // delete this attacher
-            //print_debug ("freeing attacher %p", attacher);
-            attacher->graph = NULL;
-            delete_color_scheme (attacher->colorScheme);
-            free (attacher);
-            removed = 1;
+            parallel_for (n, bin_chunk_task, job);
+            reduce_partials (hist);
+            release_access (& partialsAccess);
         }
         else
         {
-            // keep this attacher
-            sw->attachedGraphs[giNew++] = sw->attachedGraphs[giOld];
+            for (uint32_t t=0; t<n; t++)
+                bin_chunk_task (job, t, 0);
+        }
+
+        for (uint32_t t=0; t<n; t++)
+        {
+            uint32_t b0, b1;
+            if (progress_chunk (p, view, p->slot + t, slotBits, & b0, & b1))
+                p->binned += b1 - b0;
         }
+
+        p->slot += n;
+        batch *= 2;
+        if (p->budget > 0 && get_time () - t0 > p->budget)
+            break;
     }
-    sw->numAttachedGraphs = giNew;
-    cinterplot_continue (cs);
-    return removed;
+
+    uint64_t counter = p->counter;
+    if (p->slot >= nSlots)
+        p->counter = 0;
+
+    // points were overwritten while binning them, start over on next frame
+    if (graph_view_overwritten (view))
+    {
+        p->counter = 0;
+        counter = 0;
+    }
+    return counter;
 }
 
-CipGraph *cip_graph_new (int dim, uint32_t len)
+// Bins all n segments inside of a bucket as one vertical line, when all its
+// points fall in one column. The segments between points of one column are
+// vertical lines or dots in that column, so together they cover exactly the
+// bins from the lowest to the highest point. The line is weighted by
+// span_weight with the travel of the bucket, to keep the density near that
+// of binning every segment.
+// Returns 0 when the bucket does not collapse like that.
+static int lod_bin_column (const BinJob *job, const LodBucket *b, uint32_t n)
 {
-    if (dim < 2 || dim > 3)
-        exit_error ("dimension not supported");
+    CipHistogram *hist = job->hist;
+    const BinScale *s = & job->s;
 
-    CipGraph *graph = safe_calloc (1, sizeof (*graph));
-    graph->len = len;
-    atomic_flag_clear (& graph->readAccess);
-    atomic_flag_clear (& graph->insertAccess);
+    if (b->nonFinite)
+        return 0;
 
-    size_t itemSize = dim * sizeof (double);
+    double x0 = b->minX;
+    double x1 = b->maxX;
+    double y0 = b->minY;
+    double y1 = b->maxY;
 
-    if (graph->len == 0)
+    // the log of points at or below zero is not drawn, see bin_lines
+    if (job->logMode & 1)
     {
-        // lazy infinite length
-        graph->sb = stream_buffer_create (INITIAL_VARIABLE_LENGTH, itemSize);
+        if (x0 <= 0)
+            return 0;
+        x0 = LOGFUN (x0);
+        x1 = LOGFUN (x1);
     }
-    else
+    if (job->logMode & 2)
     {
-        uint32_t requestedLen = len;
-        graph->sb = stream_buffer_create (requestedLen, itemSize);
+        if (y0 <= 0)
+            return 0;
+        y0 = LOGFUN (y0);
+        y1 = LOGFUN (y1);
     }
 
-    return graph;
-}
-
-void cip_graph_delete (CipGraph *graph)
-{
-    if (!graph)
-        return;
+    double xf = BIN_X (hist, s, x0);
+    if (trunc (BIN_X (hist, s, x1)) != trunc (xf))
+        return 0;
 
-    stream_buffer_destroy (graph->sb);
-    if (graph->name)
-        free (graph->name);
-    free (graph);
+    // the travel in y is not known in log mode
+    double yf0 = BIN_Y (hist, s, y0);
+    double yf1 = BIN_Y (hist, s, y1);
+    double travel = job->logMode & 2 ? 0 : (hist->h-1) * b->travelY * fabs (s->invYRange);
+    raster_column (hist->bins, hist->w, hist->h, xf, yf0, yf1, job->plotType == 't', span_weight (yf0, yf1, n, travel));
+    return 1;
 }
 
-void cip_graph_add_2d_point (CipGraph *graph, double x, double y)
+// bins the segments starting at the points of bucket k of the level, the
+// first of them being point i of the view
+static void lod_bin_bucket (const BinJob *job, const CipLineLod *lod, uint32_t level, uint64_t k, uint32_t i)
 {
-    while (paused)
-        usleep (10000);
-
-    StreamBuffer *sb = graph->sb;
-    assert (sb);
-
-    if (sb->itemSize != sizeof (double) * 2)
-        exit_error ("function can only be used for two dimensional graphs");
+    uint32_t shift = LOD_SHIFT (level);
+    uint32_t size  = 1u << shift;
+    uint64_t start = k << shift;
 
-    if (graph->len == 0 &&
-        sb->counter == sb->len &&
-        sb->len <= MAX_VARIABLE_LENGTH)
+    const LodBucket *b = & lod->levels[level].buckets[k & lod->levels[level].mask];
+    if (start >= lod->first && start + size <= lod->end && lod_bin_column (job, b, size - 1))
     {
+        // the segment leaving the bucket
+        bin_span (job, job->hist, i + size - 1, i + size);
+        return;
+    }
 
-        wait_for_access (& graph->readAccess);
-        stream_buffer_resize (sb, sb->len << 1);
-        release_access (& graph->readAccess);
+    if (level == 0)
+    {
+        bin_span (job, job->hist, i, i + size);
+        return;
     }
 
-    double xy[2] = {x,y};
-    wait_for_access (& graph->insertAccess);
-    stream_buffer_insert (sb, xy);
-    release_access (& graph->insertAccess);
+    uint32_t childSize = size >> LOD_FAN_SHIFT;
+    for (uint32_t c=0; c<LOD_FAN_OUT; c++)
+        lod_bin_bucket (job, lod, level - 1, (k << LOD_FAN_SHIFT) + c, i + c * childSize);
 }
 
-void cip_graph_add_3d_point (CipGraph *graph, double x, double y, double z)
+// Bins the segments starting at the points begin to end-1 of the view,
+// collapsing whole runs of points that fall in one column. Same bins are
+// hit as by binning every segment, the bins of a collapsed run about as
+// many times.
+static void bin_lines_lod (const BinJob *job, const CipLineLod *lod, uint32_t begin, uint32_t end)
 {
-    while (paused)
-        usleep (10000);
+    uint64_t p0 = job->view->firstCounter - 1;
 
-    StreamBuffer *sb = graph->sb;
-    assert (sb);
-
-    if (sb->itemSize != sizeof (double) * 3)
-        exit_error ("function can only be used for three dimensional graphs");
-
-    if (graph->len == 0 &&
-        sb->counter == sb->len &&
-        sb->len <= MAX_VARIABLE_LENGTH)
+    uint32_t i = begin;
+    while (i < end)
     {
+        // the largest bucket starting at the point that ends within the span
+        uint64_t p = p0 + i;
+        int level = (int) lod->nLevels - 1;
+        while (level >= 0)
+        {
+            uint64_t size = 1ull << LOD_SHIFT (level);
+            if ((p & (size - 1)) == 0 && i + size <= end)
+                break;
+            level--;
+        }
 
-        wait_for_access (& graph->readAccess);
-        stream_buffer_resize (sb, sb->len << 1);
-        release_access (& graph->readAccess);
-    }
+        if (level < 0)
+        {
+            uint32_t n = (uint32_t) MIN (end - i, LOD_BASE_LEN - (p & (LOD_BASE_LEN - 1)));
+            bin_span (job, job->hist, i, i + n);
+            i += n;
+            continue;
+        }
 
-    double xyz[3] = {x,y,z};
-    wait_for_access (& graph->insertAccess);
-    stream_buffer_insert (sb, xyz);
-    release_access (& graph->insertAccess);
+        lod_bin_bucket (job, lod, (uint32_t) level, p >> LOD_SHIFT (level), i);
+        i += 1u << LOD_SHIFT (level);
+    }
 }
 
-void cip_graph_remove_points (CipGraph *graph)
+// GridFun binning the points of a point plot
+static void bin_grid_points (void *arg, const uint32_t *is, uint32_t n)
 {
-    while (paused)
-        usleep (10000);
-
-    StreamBuffer *sb = graph->sb;
-    assert (sb);
-
-    wait_for_access (& graph->readAccess);
-    stream_buffer_reset (sb);
-    release_access (& graph->readAccess);
+    const BinJob *job = arg;
+    double xs[GRID_VISIT_LEN];
+    double ys[GRID_VISIT_LEN];
+    graph_view_gather (job->view, 0, job->logMode, is, n, xs);
+    graph_view_gather (job->view, 1, job->logMode, is, n, ys);
+
+    if (job->plotType == '+')
+        bin_crosses (job->hist, & job->s, xs, ys, n);
+    else
+        bin_points (job->hist, & job->s, xs, ys, n);
 }
 
-
 static uint64_t make_histogram_3d (CipHistogram *hist, CipGraph *graph, uint32_t logMode, char plotType, uint64_t lastGraphCounter)
 {
     uint64_t counter = 0;
@@ -2257,184 +5068,73 @@ static uint64_t make_histogram_3d (CipHistogram *hist, CipGraph *graph, uint32_t
     uint32_t w = hist->w;
     uint32_t h = hist->h;
 
-    wait_for_access (& graph->readAccess);
-
-    double xmin = (double) hist->dataRange.x0;
-    double xmax = (double) hist->dataRange.x1;
-    double ymin = (double) hist->dataRange.y0;
-    double ymax = (double) hist->dataRange.y1;
-
-    double (*xyzs)[3];
-    uint32_t len;
-    wait_for_access (& graph->insertAccess);
-    stream_buffer_get (graph->sb, & xyzs, & len);
+    double t0 = get_time ();
+    GraphView view;
+    uint32_t len = graph_view_open (graph, & view);
     if (!len)
     {
-        release_access (& graph->insertAccess);
-        release_access (& graph->readAccess);
+        graph_view_close (& view);
         return 0;
     }
-    if (graph->len && graph->len < len)
-    {
-        xyzs += (len - graph->len);
-        len = graph->len;
-    }
-    counter = graph->sb->counter;
-    release_access (& graph->insertAccess);
-
-    assert (xyzSums);
-    uint32_t nBins = w * h;
-    for (uint32_t i=0; i<nBins; i++)
-    {
-        bins[i]       = 0;
-        xyzSums[i][0] = 0;
-        xyzSums[i][1] = 0;
-        xyzSums[i][2] = 0;
-    }
-
-    double invXRange = 1.0 / (xmax - xmin);
-    double invYRange = 1.0 / (ymax - ymin);
-    if (plotType == 'p')
-    {
-        for (uint32_t i=0; i<len; i++)
-        {
-            double xyz[3];
-            matrix_vector_multiply (*rotMatrix, xyzs[i], xyz);
-
-            double x2 = xyz[0];
-            double y2 = xyz[1];
-            double z2 = xyz[2];
-
-            double scale = z2 * perspectiveFactor + 1;
-
-            if (scale < 0)
-                continue;
-
-            x2 /= scale;
-            y2 /= scale;
-
+    counter = view.counter;
 
-            if (isnan (x2) || isnan (y2) || isnan (z2) || isinf (x2) || isinf (y2) || isinf (z2))
-                continue;
+    BinJob job = {.hist = hist, .view = & view, .plotType = plotType, .logMode = logMode, .is3d = 1};
 
-            int xi = (int) ((w-1) * (x2 - xmin) * invXRange);
-            int yi = (int) ((h-1) * (y2 - ymin) * invYRange);
-            if (xi >= 0 && xi < w && yi >= 0 && yi < h)
-            {
-                bins   [(uint32_t) yi*w + (uint32_t) xi]++;
-                xyzSums[(uint32_t) yi*w + (uint32_t) xi][0] += xyzs[i][0];
-                xyzSums[(uint32_t) yi*w + (uint32_t) xi][1] += xyzs[i][1];
-                xyzSums[(uint32_t) yi*w + (uint32_t) xi][2] += xyzs[i][2];
-            }
-        }
-    }
-    else
+    // a rebuild that ran out of budget on the last frame carries on
+    if (progress_resumable (hist, & view, lastGraphCounter))
     {
-        exit_error ("unknown plot type '%c'", plotType);
+        counter = bin_progressive (& job, t0);
+        graph_view_close (& view);
+        return counter;
     }
-
-    release_access (& graph->readAccess);
-    return counter;
-}
-
-static uint64_t make_histogram_2d_waterfall (CipHistogram *hist, CipGraph *graph, uint32_t logMode, char plotType, uint64_t lastGraphCounter)
-{
-    int    *bins   = hist->bins;
-    double *sums   = hist->sums;
-    double *counts = hist->counts;
-
-    uint32_t w = hist->w;
-    uint32_t h = hist->h;
-
-    double (*xys)[2];
-    uint32_t len;
-    uint64_t retCounter = 0;
-    int i0 = 0;
-
-    wait_for_access (& graph->insertAccess);
-    stream_buffer_get (graph->sb, & xys, & len);
-    if (lastGraphCounter)
-        i0 = stream_buffer_counter_to_index (graph->sb, lastGraphCounter + 1);
-    if (len)
-        retCounter = stream_buffer_index_to_counter (graph->sb, len - 1);
-    release_access (& graph->insertAccess);
-
-    if (lastGraphCounter && graph->sb->counter - lastGraphCounter > graph->sb->len)
+    int partial = hist->progress.counter != 0;
+    hist->progress.counter = 0;
+
+    // Same view and no point left the graph since the last pass: only bin
+    // the new points. Points leaving would need their coordinates to take
+    // them out of xyzSums, rebuild then.
+    uint32_t b0 = 0;
+    if (lastGraphCounter && lastGraphCounter <= view.counter && !partial &&
+        hist->generation == view.snap.generation &&
+        hist->firstCounter == view.firstCounter)
     {
-        lastGraphCounter = 0;
-        print_warning ("lastGraphCounter is behind, truncating");
+        b0 = (uint32_t) (lastGraphCounter + 1 - view.firstCounter);
     }
+    hist->firstCounter = view.firstCounter;
+    hist->generation   = view.snap.generation;
 
-    if (i0 < 0)
-        return lastGraphCounter;
-
-    if (lastGraphCounter == 0)
+    assert (xyzSums);
+    uint32_t nBins = w * h;
+    if (b0 == 0)
     {
-        i0 = len - 1;
-        int nRows = 0;
-        while (i0 > 0 && nRows <= h)
+        for (uint32_t i=0; i<nBins; i++)
         {
-            if (isnan (xys[i0][0]) || isnan (xys[i0][1]))
-                nRows++;
-            i0--;
+            bins[i]       = 0;
+            xyzSums[i][0] = 0;
+            xyzSums[i][1] = 0;
+            xyzSums[i][2] = 0;
         }
-        memset (bins, 0x00, w*h*sizeof (bins[0]));
     }
 
-    for (int i=i0; i<len; i++)
-    {
-        double *xy = xys[i];
-
-        if (isnan (xy[0]) || isnan (xy[1]))
-        {
-            // flush row
-            for (uint32_t yi=h-1; yi>0; yi--)
-                for (uint32_t xi=0; xi<w; xi++)
-                    bins[yi*w + xi] = bins[(yi-1) * w + xi];
+    if (plotType != 'p')
+        exit_error ("unknown plot type '%c'", plotType);
 
-            // construct new row
-            int lastNonZeroXi = -1;
-            for (uint32_t xi=0; xi<w; xi++)
-            {
-                if (hist->counts[xi] > 1e-5)
-                {
-                    double avg = sums[xi] / counts[xi];
-                    double yMin = hist->dataRange.y1;
-                    double yMax = hist->dataRange.y0;
-                    double w = (avg - yMin) / (yMax - yMin);
-
-                    if (lastNonZeroXi < 0)
-                        lastNonZeroXi = xi-1;
-                    for (int xik=lastNonZeroXi+1; xik<=xi; xik++)
-                        bins[xik] = w * 1000; // FIXME: 1000 is the resolution of the color scheme
-
-                    //print_debug ("sums[xi]: %f counts[xi]: %f yMin: %f, yMax: %f avg: %f => w: %f => bins[%d]: %d",
-                    //sums[xi], counts[xi], yMin, yMax, avg, w, xi, bins[xi]);
-                    sums[xi]   = 0.0;
-                    counts[xi] = 0.0;
-                    lastNonZeroXi = xi;
-                }
-            }
-        }
-        else
-        {
-            double x = xy[0];
-            double y = xy[1];
-            if (logMode & 1) x = LOGFUN (x);
-            if (logMode & 2) y = LOGFUN (y);
+    if (b0 == 0 && hist->progress.budget > 0 && len >= PROGRESSIVE_MIN_POINTS)
+    {
+        progress_start (hist, & view, 0, len, 0);
+        counter = bin_progressive (& job, t0);
+        graph_view_close (& view);
+        return counter;
+    }
 
-#define GET_XI(hist, xf) ((int) ((xf - hist->dataRange.x0) / (hist->dataRange.x1 - hist->dataRange.x0) * (hist->w-1)))
-            int xi = GET_XI (hist, x);
+    bin_range (& job, b0, len);
 
-            if (xi >= 0 && xi < w)
-            {
-                sums[xi]   += y;
-                counts[xi] += 1.0;
-            }
-        }
-    }
+    // the oldest points were overwritten while binning them, rebuild on next frame
+    if (graph_view_overwritten (& view))
+        counter = 0;
 
-    return retCounter;
+    graph_view_close (& view);
+    return counter;
 }
 
 static uint64_t make_histogram_2d (CipHistogram *hist, CipGraph *graph, uint32_t logMode, char plotType, uint64_t lastGraphCounter)
@@ -2447,188 +5147,385 @@ static uint64_t make_histogram_2d (CipHistogram *hist, CipGraph *graph, uint32_t
     uint32_t w = hist->w;
     uint32_t h = hist->h;
 
-    wait_for_access (& graph->readAccess);
+    double xmin = (double) hist->dataRange.x0;
+    double xmax = (double) hist->dataRange.x1;
+    double ymin = (double) hist->dataRange.y0;
+    double ymax = (double) hist->dataRange.y1;
+
+    double t0 = get_time ();
+    GraphView view;
+    uint32_t len = graph_view_open (graph, & view);
+    if (!len)
+    {
+        graph_view_close (& view);
+        return 0;
+    }
+    counter = view.counter;
+    graph_view_use_log (& view, logMode);
+
+    int isLine = plotType == 'l' || plotType == 't' || plotType == 's';
+    if (!isLine && plotType != 'p' && plotType != '+')
+        exit_error ("unknown plot type '%c'", plotType);
+
+    BinJob job = {.hist = hist, .view = & view, .plotType = plotType, .logMode = logMode};
+    job.s = (BinScale) {xmin, ymin, 1.0 / (xmax - xmin), 1.0 / (ymax - ymin)};
+
+    // only the points that can be visible, when the graph knows its x order.
+    // Crosses and thick lines reach two bins outside their point, and bin
+    // indices are truncated towards zero, so keep a few bins of margin.
+    double margin = 4 * (xmax - xmin) / (w-1);
+    job.xlo = xmin - margin;
+    job.xhi = xmax + margin;
+    if (logMode & 1)
+    {
+        job.xlo = EXPFUN (job.xlo);
+        job.xhi = EXPFUN (job.xhi);
+    }
+
+    margin = 4 * (ymax - ymin) / (h-1);
+    job.ylo = ymin - margin;
+    job.yhi = ymax + margin;
+    if (logMode & 2)
+    {
+        job.ylo = EXPFUN (job.ylo);
+        job.yhi = EXPFUN (job.yhi);
+    }
 
-    double xmin = (double) hist->dataRange.x0;
-    double xmax = (double) hist->dataRange.x1;
-    double ymin = (double) hist->dataRange.y0;
-    double ymax = (double) hist->dataRange.y1;
+    // sub windows keep y0 above y1, the zone checks want lo <= hi
+    if (job.xlo > job.xhi)
+    {
+        double tmp = job.xlo;
+        job.xlo = job.xhi;
+        job.xhi = tmp;
+    }
+    if (job.ylo > job.yhi)
+    {
+        double tmp = job.ylo;
+        job.ylo = job.yhi;
+        job.yhi = tmp;
+    }
 
-    double (*xys)[2];
-    uint32_t len;
-    wait_for_access (& graph->insertAccess);
-    stream_buffer_get (graph->sb, & xys, & len);
-    if (!len)
+    // a rebuild that ran out of budget on the last frame carries on
+    if (progress_resumable (hist, & view, lastGraphCounter))
     {
-        release_access (& graph->insertAccess);
-        release_access (& graph->readAccess);
-        return 0;
+        job.tracked = (int) hist->progress.tracked;
+        counter = bin_progressive (& job, t0);
+        graph_view_close (& view);
+        return counter;
     }
-    if (graph->len && graph->len < len)
+    int partial = hist->progress.counter != 0;
+    hist->progress.counter = 0;
+
+    // Same view as the last pass: bin the points added since then and take
+    // out the ones that left the graph. Points leaving the graph need their
+    // recorded bins, which only bounded graphs keep.
+    uint64_t nLeft = view.firstCounter - hist->firstCounter;
+    int incremental = lastGraphCounter && !isLine && !partial &&
+        hist->logMode == logMode &&
+        hist->generation == view.snap.generation &&
+        lastGraphCounter <= view.counter &&
+        view.firstCounter >= hist->firstCounter &&
+        (nLeft == 0 || hist->pointBins);
+
+    hist->firstCounter = view.firstCounter;
+    hist->generation   = view.snap.generation;
+    hist->logMode      = logMode;
+
+    if (incremental)
     {
-        xys += (len - graph->len);
-        len = graph->len;
+        uint32_t mask = hist->pointBinsLen - 1;
+        uint64_t leftEnd = MIN (view.firstCounter, lastGraphCounter + 1);
+        for (uint64_t c=view.firstCounter - nLeft; c<leftEnd; c++)
+            bin_point_bin (hist, plotType, hist->pointBins[c & mask], -1);
+
+        uint64_t c0 = MAX (lastGraphCounter + 1, view.firstCounter);
+        job.tracked = hist->pointBins != NULL;
+        bin_range (& job, (uint32_t) (c0 - view.firstCounter), len);
+
+        if (graph_view_overwritten (& view))
+            counter = 0;
+
+        graph_view_close (& view);
+        return counter;
     }
-    counter = graph->sb->counter;
-    release_access (& graph->insertAccess);
 
     uint32_t nBins = w * h;
     for (uint32_t i=0; i<nBins; i++)
         bins[i] = 0;
 
-    double invXRange = 1.0 / (xmax - xmin);
-    double invYRange = 1.0 / (ymax - ymin);
-    if (plotType == 'p')
+    uint32_t i0, i1;
+    graph_view_x_range (& view, job.xlo, job.xhi, & i0, & i1);
+
+    // zoomed in point plots of graphs with a spatial index visit the cells in view only
+    CipGridIndex *grid = NULL;
+    if (!isLine && graph->spatialIndex)
     {
-        for (uint32_t i=0; i<len; i++)
+        grid = graph_view_lock_grid (& view);
+        if (grid_index_count (grid, job.xlo, job.xhi, job.ylo, job.yhi) * GRID_SCAN_RATIO >= i1 - i0)
         {
-            double x = xys[i][0];
-            double y = xys[i][1];
-
-            if (logMode & 1) x = LOGFUN (x);
-            if (logMode & 2) y = LOGFUN (y);
+            release_access (& graph->gridAccess);
+            grid = NULL;
+        }
+    }
 
-            if (isnan (x) || isnan (y) || isinf (x) || isinf (y))
-                continue;
+    // room for the bins of all points in view of a bounded graph. Not when
+    // zoomed in on part of it, rebuilding the visible points is cheaper than
+    // marking all the others.
+    job.tracked = !isLine && graph->len && i0 == 0 && i1 == len && !grid;
+    if (job.tracked)
+    {
+        uint32_t ringLen = 1;
+        while (ringLen < graph->len)
+            ringLen <<= 1;
 
-            int xi = (int) ((w-1) * (x - xmin) * invXRange);
-            int yi = (int) ((h-1) * (y - ymin) * invYRange);
-            if (xi >= 0 && xi < w && yi >= 0 && yi < h)
-                bins[(uint32_t) yi*w + (uint32_t) xi]++;
+        if (hist->pointBinsLen != ringLen)
+        {
+            free (hist->pointBins);
+            hist->pointBins = safe_calloc (ringLen, sizeof (hist->pointBins[0]));
+            hist->pointBinsLen = ringLen;
         }
+        memset (hist->pointBins, 0xff, ringLen * sizeof (hist->pointBins[0]));
     }
-    else if (plotType == '+')
+    else if (hist->pointBins)
     {
-        for (uint32_t i=0; i<len; i++)
-        {
-            double x = xys[i][0];
-            double y = xys[i][1];
-
-            if (logMode & 1) x = LOGFUN (x);
-            if (logMode & 2) y = LOGFUN (y);
+        free (hist->pointBins);
+        hist->pointBins = NULL;
+        hist->pointBinsLen = 0;
+    }
 
-            if (isnan (x) || isnan (y) || isinf (x) || isinf (y))
-                continue;
+    // a line plot bins the segments starting at its points, but the last
+    uint32_t end = isLine ? (i1 > i0 ? i1 - 1 : i0) : i1;
 
-            int xi = (int) ((w-1) * (x - xmin) * invXRange);
-            int yi = (int) ((h-1) * (y - ymin) * invYRange);
-            int xx[9] = { 0,  0, -2, -1, 0, 1, 2, 0, 0};
-            int yy[9] = {-2, -1,  0,  0, 0, 0, 0, 1, 2};
-            for (int j=0; j<9; j++)
-            {
-                int xp = xi+xx[j];
-                int yp = yi+yy[j];
-                if (xp >= 0 && xp < w && yp >= 0 && yp < h)
-                    bins[(uint32_t) yp*w + (uint32_t) xp]++;
-            }
-        }
+    if (grid)
+    {
+        grid_index_visit (grid, & view, job.xlo, job.xhi, job.ylo, job.yhi, bin_grid_points, & job);
+        release_access (& graph->gridAccess);
     }
-    else if (plotType == 'l')
+    // zoomed out line plots are drawn from the min/max summary
+    else if (isLine && end - i0 > LOD_MIN_POINTS_PER_COLUMN * w)
     {
-        for (uint32_t i=0; i<len-1; i++)
-        {
-            double x0 = xys[i][0];
-            double y0 = xys[i][1];
-            double x1 = xys[i+1][0];
-            double y1 = xys[i+1][1];
+        wait_for_access (& graph->lodAccess);
+        if (!graph->lineLod)
+            graph->lineLod = safe_calloc (1, sizeof (*graph->lineLod));
+        line_lod_update (graph->lineLod, & view);
+        bin_lines_lod (& job, graph->lineLod, i0, end);
+        release_access (& graph->lodAccess);
+    }
+    else if (hist->progress.budget > 0 && end - i0 >= PROGRESSIVE_MIN_POINTS)
+    {
+        progress_start (hist, & view, i0, end, job.tracked);
+        counter = bin_progressive (& job, t0);
+        graph_view_close (& view);
+        return counter;
+    }
+    else
+        bin_range (& job, i0, end);
 
-            if (logMode & 1)
-            {
-                x0 = LOGFUN (x0);
-                x1 = LOGFUN (x1);
-            }
-            if (logMode & 2)
-            {
-                y0 = LOGFUN (y0);
-                y1 = LOGFUN (y1);
-            }
+    // the oldest points were overwritten while binning them, rebuild on next frame
+    if (graph_view_overwritten (& view))
+        counter = 0;
 
-            if (isnan (x0) || isnan (y0) || isnan (x1) || isnan (y1) ||
-                isinf (x0) || isinf (y0) || isinf (x1) || isinf (y1))
-                continue;
+    graph_view_close (& view);
+    return counter;
+}
+
+// Spectrum graphs, the rows of which are computed from their samples graph
+// as the samples come in, SPECTRUM_BATCH_LEN transforms at a time split over
+// the worker threads.
+#define SPECTRUM_BATCH_LEN 64
+// amplitudes in decibels go down to 20 log10 of this
+#define SPECTRUM_MIN_AMPLITUDE 1e-20
+
+typedef struct CipSpectrum
+{
+    CipGraph *samples;
+    uint32_t  fftSize;
+    uint32_t  hop;
+    uint32_t  decibels;
+    FftPlan  *plan;
+    double   *window;         // scaled so that a sine of amplitude a peaks at a
+    uint64_t  next;           // counter of the first sample of the next transform, 0 before the first one
+    uint64_t  seen;           // samples counter of the last update, it goes back when they are reset
+    float    *rows;           // of the batch being computed
+    double   *scratch[MAX_WORKER_THREADS]; // per worker, the samples and the bins of a transform
+    atomic_flag access;       // held while computing
+} CipSpectrum;
+
+typedef struct SpectrumJob
+{
+    CipSpectrum *sp;
+    const GraphView *view;
+    uint64_t first;           // counter of the first sample of the first transform
+} SpectrumJob;
 
-            // NOTE: A straight line between two points is moving through different points depending on log mode
-            int xi0 = (int) ((w-1) * (x0 - xmin) * invXRange);
-            int yi0 = (int) ((h-1) * (y0 - ymin) * invYRange);
-            int xi1 = (int) ((w-1) * (x1 - xmin) * invXRange);
-            int yi1 = (int) ((h-1) * (y1 - ymin) * invYRange);
-            cip_histogram_line (hist, xi0, yi0, xi1, yi1);
+static double *spectrum_window (uint32_t type, uint32_t n)
+{
+    double *window = safe_calloc (n, sizeof (window[0]));
+    double sum = 0;
+    for (uint32_t j=0; j<n; j++)
+    {
+        double t = 2 * M_PI * j / n;
+        switch (type)
+        {
+         case CIP_WINDOW_HANN:        window[j] = 0.5 - 0.5 * cos (t); break;
+         case CIP_WINDOW_RECTANGULAR: window[j] = 1; break;
+         case CIP_WINDOW_HAMMING:     window[j] = 0.54 - 0.46 * cos (t); break;
+         case CIP_WINDOW_BLACKMAN:    window[j] = 0.42 - 0.5 * cos (t) + 0.08 * cos (2 * t); break;
+         default: exit_error ("unknown window %u", type);
         }
+        sum += window[j];
     }
-    else if (plotType == 't')
+
+    for (uint32_t j=0; j<n; j++)
+        window[j] *= 2 / sum;
+    return window;
+}
+
+// ParallelFun computing row task of a batch
+static void spectrum_task (void *arg, uint32_t task, uint32_t worker)
+{
+    SpectrumJob *job = arg;
+    CipSpectrum *sp = job->sp;
+    uint32_t n = sp->fftSize;
+    uint32_t nBins = n / 2 + 1;
+
+    if (!sp->scratch[worker])
+        sp->scratch[worker] = safe_calloc (n + 2 * nBins, sizeof (double));
+    double *data = sp->scratch[worker];
+    double *re = data + n;
+    double *im = re + nBins;
+
+    // NaN samples count as 0
+    uint64_t c = job->first + (uint64_t) task * sp->hop;
+    graph_view_fetch (job->view, 1, (uint32_t) (c - job->view->firstCounter), n, data);
+    for (uint32_t j=0; j<n; j++)
+        data[j] = isfinite (data[j]) ? data[j] * sp->window[j] : 0;
+
+    fft_real (sp->plan, data, re, im);
+
+    // the window makes up for the other half of the spectrum, but for the
+    // bins at 0 and n/2 which have none
+    float *row = & sp->rows[(size_t) task * nBins];
+    for (uint32_t k=0; k<nBins; k++)
     {
-        for (uint32_t i=0; i<len-1; i++)
-        {
-            double x0 = xys[i][0];
-            double y0 = xys[i][1];
-            double x1 = xys[i+1][0];
-            double y1 = xys[i+1][1];
+        double a = sqrt (re[k] * re[k] + im[k] * im[k]);
+        if (k == 0 || k == n / 2)
+            a /= 2;
+        row[k] = (float) (sp->decibels ? 20 * log10 (MAX (a, SPECTRUM_MIN_AMPLITUDE)) : a);
+    }
+}
 
-            if (logMode & 1)
-            {
-                x0 = LOGFUN (x0);
-                x1 = LOGFUN (x1);
-            }
-            if (logMode & 2)
-            {
-                y0 = LOGFUN (y0);
-                y1 = LOGFUN (y1);
-            }
+// Adds the rows of the transforms whose samples are all in, returns whether
+// there were any. The worker threads are only used when parallel is set and
+// no other pass has them.
+static int spectrum_update (CipGraph *graph, int parallel)
+{
+    CipSpectrum *sp = graph->spectrum;
+    if (!parallel)
+        wait_for_access (& sp->access);
+    else if (!try_access (& sp->access))
+        return 0;
 
-            if (isnan (x0) || isnan (y0) || isnan (x1) || isnan (y1) ||
-                isinf (x0) || isinf (y0) || isinf (x1) || isinf (y1))
-                continue;
+    GraphView view;
+    graph_view_open (sp->samples, & view);
+    uint64_t first = view.firstCounter;
+    uint64_t last  = view.counter;
+    uint32_t n = sp->fftSize;
 
-            int xi0 = (int) ((w-1) * (x0 - xmin) * invXRange);
-            int yi0 = (int) ((h-1) * (y0 - ymin) * invYRange);
-            int xi1 = (int) ((w-1) * (x1 - xmin) * invXRange);
-            int yi1 = (int) ((h-1) * (y1 - ymin) * invYRange);
-            cip_histogram_line (hist, xi0, yi0, xi1, yi1);
-            cip_histogram_line (hist, xi0+1, yi0, xi1+1, yi1);
-            cip_histogram_line (hist, xi0-1, yi0, xi1-1, yi1);
-            cip_histogram_line (hist, xi0, yi0+1, xi1, yi1+1);
-            cip_histogram_line (hist, xi0, yi0-1, xi1, yi1-1);
-        }
+    // starts at the oldest sample, and over again when the samples are reset
+    if (sp->next == 0 || last < sp->seen)
+        sp->next = first;
+    sp->seen = last;
+
+    if (sp->next < first)
+    {
+        print_warning ("spectrum is behind its samples, skipping %" PRIu64 " of them", first - sp->next);
+        sp->next = first;
+    }
+
+    // only the last graph->len rows are kept anyway
+    uint64_t nTransforms = last + 1 >= sp->next + n ? (last + 1 - sp->next - n) / sp->hop + 1 : 0;
+    if (nTransforms > graph->len)
+    {
+        sp->next += (nTransforms - graph->len) * sp->hop;
+        nTransforms = graph->len;
     }
-    else if (plotType == 's')
+
+    int added = 0;
+    while (nTransforms)
     {
-        for (uint32_t i=0; i<len-1; i++)
+        uint32_t batch = (uint32_t) MIN (nTransforms, SPECTRUM_BATCH_LEN);
+        SpectrumJob job = {sp, & view, sp->next};
+        if (parallel && workerPool.nThreads > 1 && batch > 1 && try_access (& partialsAccess))
+        {
+            parallel_for (batch, spectrum_task, & job);
+            release_access (& partialsAccess);
+        }
+        else
         {
-            double x0 = xys[i][0];
-            double y0 = xys[i][1];
-            double x1 = xys[i+1][0];
-            double y1 = xys[i+1][1];
+            for (uint32_t t=0; t<batch; t++)
+                spectrum_task (& job, t, 0);
+        }
 
-            if (logMode & 1)
-            {
-                x0 = LOGFUN (x0);
-                x1 = LOGFUN (x1);
-            }
-            if (logMode & 2)
-            {
-                y0 = LOGFUN (y0);
-                y1 = LOGFUN (y1);
-            }
+        // samples overwritten while reading them are skipped on the next update
+        if (graph_view_overwritten (& view))
+            break;
 
-            if (isnan (x0) || isnan (y0) || isnan (x1) || isnan (y1) ||
-                isinf (x0) || isinf (y0) || isinf (x1) || isinf (y1))
-                continue;
+        wait_for_insert_access (graph);
+        stream_buffer_insert_n (graph->sb, sp->rows, batch);
+        release_insert_access (graph);
 
-            int xi0 = (int) ((w-1) * (x0 - xmin) * invXRange);
-            int yi0 = (int) ((h-1) * (y0 - ymin) * invYRange);
-            int xi1 = (int) ((w-1) * (x1 - xmin) * invXRange);
-            int yi1 = (int) ((h-1) * (y1 - ymin) * invYRange);
-            cip_histogram_line (hist, xi0, yi0, xi1, yi0);
-            cip_histogram_line (hist, xi1, yi0, xi1, yi1);
-        }
-    }
-    else
-    {
-        exit_error ("unknown plot type '%c'", plotType);
+        sp->next += (uint64_t) batch * sp->hop;
+        nTransforms -= batch;
+        added = 1;
     }
 
-    release_access (& graph->readAccess);
-    return counter;
+    graph_view_close (& view);
+    release_access (& sp->access);
+    return added;
+}
+
+static void free_spectrum (CipGraph *graph)
+{
+    CipSpectrum *sp = graph->spectrum;
+    if (!sp)
+        return;
+
+    fft_plan_delete (sp->plan);
+    free (sp->window);
+    free (sp->rows);
+    for (uint32_t i=0; i<MAX_WORKER_THREADS; i++)
+        free (sp->scratch[i]);
+    free (sp);
+    graph->spectrum = NULL;
+}
+
+// A row graph of nRows spectra of the y values of samples, which has to be
+// kept until the spectrum graph is deleted. The spectra are computed when
+// the graph is drawn, or by cip_graph_flush.
+CipGraph *cip_graph_new_spectrum (CipGraph *samples, uint32_t nRows, const CipSpectrumOptions *options)
+{
+    FftPlan *plan = options ? fft_plan_new (options->fftSize) : NULL;
+    if (!plan)
+        exit_error ("spectrum graphs need an fft size that is a power of two");
+
+    uint32_t n = options->fftSize;
+    CipGraphOptions rowOptions = {.rowWidth = n / 2 + 1};
+    rowOptions.dx = options->sampleRate > 0 ? options->sampleRate / n : 1;
+    CipGraph *graph = cip_graph_new_ex (2, nRows, & rowOptions);
+
+    CipSpectrum *sp = safe_calloc (1, sizeof (*sp));
+    sp->samples  = samples;
+    sp->fftSize  = n;
+    sp->hop      = options->hop ? options->hop : n;
+    sp->decibels = options->decibels;
+    sp->plan     = plan;
+    sp->window   = spectrum_window (options->window, n);
+    sp->rows     = safe_calloc ((size_t) SPECTRUM_BATCH_LEN * graph->rowWidth, sizeof (sp->rows[0]));
+    atomic_flag_clear (& sp->access);
+
+    graph->spectrum = sp;
+    return graph;
 }
 
 enum {
@@ -2947,6 +5844,376 @@ static void draw_grid (CipState *cs, CipSubWindow *sw, uint32_t *pixels, uint32_
     }
 }
 
+// While the user keeps moving or zooming a sub window, histograms that
+// take longer than this to rebuild are shown moved and scaled to the new
+// range instead, until the input has settled for INPUT_SETTLE_TIME.
+#define REPROJECT_MIN_BUILD_TIME 0.005
+#define INPUT_SETTLE_TIME        0.15
+
+// Old bins [*c0, *c1) shown in each of the n new bins of an axis, mapping the
+// range lo to hi onto the old range oldLo to oldHi. Zooming out, every old bin
+// goes to the new bin holding its centre; zooming in, the new bin shows the
+// old one holding its own centre.
+static void reproject_axis (uint32_t n, double lo, double hi, double oldLo, double oldHi, int32_t *c0, int32_t *c1)
+{
+    // bin k covers [k, k+1) of (n-1) * (v - lo) / (hi - lo)
+    double a = (hi - lo) / (oldHi - oldLo);
+    double b = (n - 1) * (lo - oldLo) / (oldHi - oldLo);
+
+    for (uint32_t i=0; i<n; i++)
+    {
+        c0[i] = 0;
+        c1[i] = 0;
+
+        double u = i * a + b;
+        double v = (i + 1) * a + b;
+        if (!isfinite (u) || !isfinite (v))
+            continue;
+        if (u > v)
+        {
+            double tmp = u;
+            u = v;
+            v = tmp;
+        }
+
+        // far outside of the old bins, keep the casts in range
+        u = MIN (MAX (u, -2.0), n + 2.0);
+        v = MIN (MAX (v, -2.0), n + 2.0);
+
+        int32_t k0 = (int32_t) ceil (u - 0.5);
+        int32_t k1 = (int32_t) ceil (v - 0.5);
+        if (k1 <= k0)
+        {
+            k0 = (int32_t) floor ((u + v) / 2);
+            k1 = k0 + 1;
+        }
+
+        k0 = MAX (k0, 0);
+        k1 = MIN (k1, (int32_t) n);
+        if (k0 < k1)
+        {
+            c0[i] = k0;
+            c1[i] = k1;
+        }
+    }
+}
+
+// Moves and scales the bins of hist, built for hist->dataRange, to the range,
+// each new bin summing the old ones it shows. Bins outside of the old range
+// are empty.
+static void reproject_histogram (const CipHistogram *hist, const CipArea *range, int *dst)
+{
+    uint32_t w = hist->w;
+    uint32_t h = hist->h;
+    int32_t *spans = safe_calloc (2 * (w + h), sizeof (spans[0]));
+    int32_t *c0 = spans;
+    int32_t *c1 = c0 + w;
+    int32_t *r0 = c1 + w;
+    int32_t *r1 = r0 + h;
+
+    reproject_axis (w, range->x0, range->x1, hist->dataRange.x0, hist->dataRange.x1, c0, c1);
+    reproject_axis (h, range->y0, range->y1, hist->dataRange.y0, hist->dataRange.y1, r0, r1);
+
+    for (uint32_t yi=0; yi<h; yi++)
+    {
+        for (uint32_t xi=0; xi<w; xi++)
+        {
+            int cnt = 0;
+            for (int32_t r=r0[yi]; r<r1[yi]; r++)
+                for (int32_t c=c0[xi]; c<c1[xi]; c++)
+                    cnt += hist->bins[(uint32_t) r * w + (uint32_t) c];
+            dst[yi * w + xi] = cnt;
+        }
+    }
+
+    free (spans);
+}
+
+// custom histograms are built at 1/8 of their resolution at the lowest
+#define COARSE_MAX_SHIFT 3
+
+// scratch histogram of n bins for the frame being drawn
+static int *scratch_bins (CipState *cs, uint32_t n)
+{
+    if (cs->scratchLen < n)
+    {
+        free (cs->scratchBins);
+        cs->scratchLen  = n;
+        cs->scratchBins = safe_calloc (n, sizeof (cs->scratchBins[0]));
+    }
+    return cs->scratchBins;
+}
+
+// Builds the histogram of a custom histogram function at 1 / (1 << shift) of
+// its resolution, in the same data range, and scales it up into hist.
+static void build_coarse_histogram (GraphAttacher *attacher, uint32_t logMode, char plotType, uint32_t shift)
+{
+    CipHistogram *hist = & attacher->hist;
+    CipHistogram coarse = *hist;
+    coarse.w = MAX (hist->w >> shift, 2);
+    coarse.h = MAX (hist->h >> shift, 2);
+    coarse.bins = safe_calloc (coarse.w * coarse.h, sizeof (coarse.bins[0]));
+    if (hist->xyzSums)
+        memset (hist->xyzSums, 0, hist->w * hist->h * sizeof (hist->xyzSums[0]));
+
+    attacher->histogramFun (& coarse, attacher->graph, logMode, plotType, 0);
+
+    // bin i of n covers i / (n-1) of the range, take the nearest coarse one
+    for (uint32_t yi=0; yi<hist->h; yi++)
+    {
+        uint32_t cy = hist->h > 1 ? (uint32_t) (((uint64_t) yi * (coarse.h - 1) + (hist->h - 1) / 2) / (hist->h - 1)) : 0;
+        for (uint32_t xi=0; xi<hist->w; xi++)
+        {
+            uint32_t cx = hist->w > 1 ? (uint32_t) (((uint64_t) xi * (coarse.w - 1) + (hist->w - 1) / 2) / (hist->w - 1)) : 0;
+            hist->bins[yi * hist->w + xi] = coarse.bins[cy * coarse.w + cx];
+        }
+    }
+
+    free (coarse.bins);
+}
+
+static int same_area (const CipArea *a, const CipArea *b)
+{
+    return a->x0 == b->x0 && a->x1 == b->x1 && a->y0 == b->y0 && a->y1 == b->y1;
+}
+
+// a partly binned histogram is shown with the counts it is heading for
+static void progress_scaled_bins (const CipHistogram *hist, int *dst)
+{
+    double scale = (double) (hist->progress.end - hist->progress.begin) / (double) hist->progress.binned;
+    for (uint32_t i=0; i<hist->w * hist->h; i++)
+        dst[i] = hist->bins[i] > 0 ? (int) MIN (ceil (hist->bins[i] * scale), INT32_MAX) : hist->bins[i];
+}
+
+// Brings the histogram of attacher up to date with target, rebuilding it when
+// the target has changed. budget is the time it may take, as for
+// cip_set_frame_budget. Returns whether the histogram was updated.
+static int update_histogram (GraphAttacher *attacher, CipHistogramTarget *target, double budget)
+{
+    CipHistogram *hist = & attacher->hist;
+
+    // the rows of a spectrum graph are computed first, they are drawn as they come in
+    if (attacher->graph->spectrum)
+        spectrum_update (attacher->graph, 1);
+
+    int changed =
+        (target->forceRefresh) ||
+        (attacher->lastPlotType != target->plotType) ||
+        (attacher->lastLogMode != target->logMode) ||
+        (!same_area (& hist->dataRange, & target->dataRange));
+
+    if (changed)
+        attacher->lastGraphCounter = 0;
+
+    // rebuilds spread over several frames carry on while nothing changes
+    int updateHistogram = changed || attacher->lastGraphCounter != attacher->graph->sb->counter ||
+                          hist->progress.counter || attacher->coarseShift;
+
+    if (hist->bins == NULL)
+    {
+        hist->w = target->w;
+        hist->h = target->h;
+        hist->bins   = safe_calloc (hist->w * hist->h, sizeof (hist->bins[0]));
+        hist->sums   = safe_calloc (hist->w, sizeof (hist->sums[0]));
+        hist->counts = safe_calloc (hist->w, sizeof (hist->counts[0]));
+
+        int is3d = (attacher->graph->dim == 3);
+        if (is3d)
+            hist->xyzSums = safe_calloc (hist->w * hist->h, sizeof (hist->xyzSums[0]));
+
+        attacher->lastGraphCounter = 0;
+        updateHistogram = 1;
+    }
+    else if (hist->w != target->w || hist->h != target->h)
+    {
+        free (hist->bins);
+        free (hist->sums);
+        free (hist->counts);
+        hist->w = target->w;
+        hist->h = target->h;
+        hist->bins   = safe_calloc (hist->w * hist->h, sizeof (hist->bins[0]));
+        hist->sums   = safe_calloc (hist->w, sizeof (hist->sums[0]));
+        hist->counts = safe_calloc (hist->w, sizeof (hist->counts[0]));
+
+        if (hist->xyzSums)
+        {
+            free (hist->xyzSums);
+            hist->xyzSums = safe_calloc (hist->w * hist->h, sizeof (hist->xyzSums[0]));
+        }
+
+        attacher->lastGraphCounter = 0;
+        updateHistogram = 1;
+    }
+
+    if (!updateHistogram)
+        return 0;
+
+    hist->dataRange = target->dataRange;
+    rotMatrix = & target->rotMatrix; // FIXME: implement correctly
+
+    double t0 = get_time ();
+    hist->progress.budget = budget;
+
+    // Custom histograms can't be interrupted. The ones taking longer than the
+    // budget are built at a lower resolution first, and refined one step per
+    // frame.
+    int custom = attacher->histogramFun != make_histogram_2d && attacher->histogramFun != make_histogram_3d &&
+                 attacher->histogramFun != make_histogram_rows;
+    uint32_t shift = 0;
+    if (custom && budget > 0)
+    {
+        if (changed)
+            while (shift < COARSE_MAX_SHIFT && attacher->buildTime > budget * (1u << (2 * shift)))
+                shift++;
+        else if (attacher->coarseShift)
+            shift = attacher->coarseShift - 1;
+    }
+    attacher->coarseShift = shift;
+
+    // rebuilt histograms start out with their rows in order
+    if (attacher->lastGraphCounter == 0)
+        hist->topRow = 0;
+
+    if (shift)
+    {
+        build_coarse_histogram (attacher, target->logMode, target->plotType, shift);
+        attacher->lastGraphCounter = 0;
+    }
+    else
+    {
+        int rebuild = attacher->lastGraphCounter == 0;
+        attacher->lastGraphCounter = attacher->histogramFun (hist, attacher->graph, target->logMode, target->plotType, attacher->lastGraphCounter);
+        if (rebuild)
+            attacher->buildTime = get_time () - t0;
+    }
+    attacher->lastPlotType = target->plotType;
+    attacher->lastLogMode  = target->logMode;
+    return 1;
+}
+
+// time the builder thread spends on a histogram before it looks for a newer
+// target, when no frame budget is set
+#define ASYNC_SLICE_TIME 0.01
+// how long it sleeps when there is no rebuild under way
+#define ASYNC_IDLE_TIME  0.005
+
+// Posts the target of attacher to the builder thread. Returns the bins to
+// draw, the last histogram it finished moved along to the target range, or
+// NULL when there is none yet. The row drawn at the top goes to topRow.
+static int *async_histogram_bins (CipState *cs, GraphAttacher *attacher, const CipHistogramTarget *target, uint32_t *topRow)
+{
+    CipHistogram *shown = & attacher->shown;
+    int *bins = NULL;
+
+    wait_for_access (& attacher->asyncAccess);
+    // a refresh stays asked for until the builder takes it
+    uint32_t forceRefresh = attacher->target.forceRefresh | target->forceRefresh;
+    attacher->target = *target;
+    attacher->target.forceRefresh = forceRefresh;
+
+    if (shown->bins && shown->w == target->w && shown->h == target->h)
+    {
+        bins = scratch_bins (cs, target->w * target->h);
+        int movable = attacher->shownPlotType == target->plotType && attacher->shownLogMode == target->logMode &&
+                      target->plotType != 'w' && attacher->graph->dim == 2 && !attacher->graph->rowWidth;
+        *topRow = 0;
+        if (movable && !same_area (& shown->dataRange, & target->dataRange))
+        {
+            reproject_histogram (shown, & target->dataRange, bins);
+        }
+        else
+        {
+            memcpy (bins, shown->bins, target->w * target->h * sizeof (bins[0]));
+            *topRow = shown->topRow;
+        }
+    }
+    release_access (& attacher->asyncAccess);
+    return bins;
+}
+
+// Takes the histogram of attacher one slice further towards its target and
+// publishes it, returns whether there was anything to do.
+static int async_build (GraphAttacher *attacher, double budget)
+{
+    CipHistogram *hist  = & attacher->hist;
+    CipHistogram *shown = & attacher->shown;
+
+    wait_for_access (& attacher->asyncAccess);
+    CipHistogramTarget target = attacher->target;
+    attacher->target.forceRefresh = 0;
+    int unpublished = shown->bins == NULL || shown->w != target.w || shown->h != target.h;
+    release_access (& attacher->asyncAccess);
+
+    // not drawn yet
+    if (target.w == 0 || target.h == 0)
+        return 0;
+
+    if (!update_histogram (attacher, & target, budget) && !unpublished)
+        return 0;
+
+    wait_for_access (& attacher->asyncAccess);
+    if (shown->w != hist->w || shown->h != hist->h)
+    {
+        free (shown->bins);
+        shown->w = hist->w;
+        shown->h = hist->h;
+        shown->bins = safe_calloc (shown->w * shown->h, sizeof (shown->bins[0]));
+    }
+    if (hist->progress.counter && hist->progress.binned)
+        progress_scaled_bins (hist, shown->bins);
+    else
+        memcpy (shown->bins, hist->bins, hist->w * hist->h * sizeof (hist->bins[0]));
+    shown->dataRange = hist->dataRange;
+    shown->topRow    = hist->topRow;
+    attacher->shownLogMode  = target.logMode;
+    attacher->shownPlotType = target.plotType;
+    release_access (& attacher->asyncAccess);
+    return 1;
+}
+
+static void *histogram_builder (void *arg)
+{
+    CipState *cs = arg;
+    while (!atomic_load (& cs->builderQuit))
+    {
+        int pending = 0;
+        atomic_store (& cs->building, 1);
+        if (!atomic_load (& cs->builderHeld))
+        {
+            release_view_caches (cs);
+            double budget = cs->frameBudget > 0 ? cs->frameBudget : ASYNC_SLICE_TIME;
+            for (uint32_t wi=0; wi<cs->numSubWindows; wi++)
+            {
+                CipSubWindow *sw = & cs->subWindows[wi];
+                for (uint32_t gi=0; gi<sw->numAttachedGraphs; gi++)
+                {
+                    GraphAttacher *attacher = sw->attachedGraphs[gi];
+                    if (async_build (attacher, budget))
+                        atomic_store (& cs->published, 1);
+                    pending |= attacher->hist.progress.counter || attacher->coarseShift;
+                }
+            }
+        }
+        atomic_store (& cs->building, 0);
+
+        if (!pending)
+            usleep ((useconds_t) (ASYNC_IDLE_TIME * 1e6));
+    }
+    return NULL;
+}
+
+static void target_from_sub_window (CipHistogramTarget *target, const CipSubWindow *sw, const GraphAttacher *attacher,
+                                    uint32_t w, uint32_t h, uint32_t forceRefresh)
+{
+    target->dataRange    = sw->dataRange;
+    target->w            = w;
+    target->h            = h;
+    target->logMode      = sw->logMode;
+    target->forceRefresh = forceRefresh;
+    target->plotType     = attacher->plotType;
+    memcpy (target->rotMatrix, sw->rotMatrix, sizeof (target->rotMatrix));
+}
+
 #define HELP_TEXT(text) \
 draw_text (pixels, cs->windowWidth, cs->windowHeight, x0, y0, textColor, transparent, text, 2, ALIGN_TL); y0+=16
 
@@ -2961,6 +6228,9 @@ static void plot_data (CipState *cs, uint32_t *pixels)
     uint32_t forceRefresh = cs->forceRefresh;
     cs->forceRefresh = 0;
 
+    double frameStart = get_time ();
+    int interacting = frameStart - cs->lastInputTsp < INPUT_SETTLE_TIME;
+
     uint32_t w = cs->windowWidth;
     uint32_t h = cs->windowHeight - cs->statuslineEnabled * STATUSLINE_HEIGHT;
 
@@ -3021,71 +6291,54 @@ static void plot_data (CipState *cs, uint32_t *pixels)
             GraphAttacher *attacher = sw->attachedGraphs[(gi + cs->graphOrder) % (sw->numAttachedGraphs)];
             CipHistogram *hist = & attacher->hist;
 
-            int updateHistogram =
-                (forceRefresh) ||
-                (attacher->lastPlotType != attacher->plotType) ||
-                (hist->dataRange.x0 != sw->dataRange.x0) ||
-                (hist->dataRange.x1 != sw->dataRange.x1) ||
-                (hist->dataRange.y0 != sw->dataRange.y0) ||
-                (hist->dataRange.y1 != sw->dataRange.y1);
-
-            if (updateHistogram)
-                attacher->lastGraphCounter = 0;
-
-            updateHistogram |= (attacher->lastGraphCounter != attacher->graph->sb->counter);
+            CipHistogramTarget target;
+            target_from_sub_window (& target, sw, attacher, subWidth, subHeight, forceRefresh);
 
-            if (hist->bins == NULL)
+            int *bins;
+            uint32_t topRow = 0;
+            if (cs->asyncHistograms)
             {
-                hist->w = subWidth;
-                hist->h = subHeight;
-                hist->bins   = safe_calloc (hist->w * hist->h, sizeof (hist->bins[0]));
-                hist->sums   = safe_calloc (hist->w, sizeof (hist->sums[0]));
-                hist->counts = safe_calloc (hist->w, sizeof (hist->counts[0]));
-
-                int is3d = (attacher->graph->sb->itemSize == sizeof (double) * 3);
-                if (is3d)
-                    hist->xyzSums = safe_calloc (hist->w * hist->h, sizeof (hist->xyzSums[0]));
-
-                attacher->lastGraphCounter = 0;
-                updateHistogram = 1;
+                bins = async_histogram_bins (cs, attacher, & target, & topRow);
+                if (!bins)
+                    continue;
             }
-            else if (hist->w != subWidth || hist->h != subHeight)
+            else
             {
-                free (hist->bins);
-                free (hist->sums);
-                free (hist->counts);
-                hist->w = subWidth;
-                hist->h = subHeight;
-                hist->bins   = safe_calloc (hist->w * hist->h, sizeof (hist->bins[0]));
-                hist->sums   = safe_calloc (hist->w, sizeof (hist->sums[0]));
-                hist->counts = safe_calloc (hist->w, sizeof (hist->counts[0]));
-
-                if (hist->xyzSums)
+                // a slow histogram is moved along with the range while the
+                // user is still moving it, and rebuilt once the input settles
+                int reproject = !same_area (& hist->dataRange, & sw->dataRange) && !forceRefresh && interacting &&
+                    attacher->buildTime > REPROJECT_MIN_BUILD_TIME &&
+                    attacher->lastPlotType == attacher->plotType && attacher->plotType != 'w' &&
+                    attacher->lastLogMode == sw->logMode && attacher->graph->dim == 2 && !attacher->graph->rowWidth &&
+                    !sw->continuousScroll &&
+                    hist->bins && hist->w == subWidth && hist->h == subHeight;
+
+                if (reproject)
                 {
-                    free (hist->xyzSums);
-                    hist->xyzSums = safe_calloc (hist->w * hist->h, sizeof (hist->xyzSums[0]));
+                    bins = scratch_bins (cs, subWidth * subHeight);
+                    reproject_histogram (hist, & sw->dataRange, bins);
+                    cs->redraw = 1;
                 }
+                else
+                {
+                    // what is left of the frame budget, but at least a share of it for every graph
+                    double budget = 0;
+                    if (cs->frameBudget > 0)
+                        budget = MAX (cs->frameBudget - (get_time () - frameStart), cs->frameBudget / 8);
 
-                attacher->lastGraphCounter = 0;
-                updateHistogram = 1;
-            }
+                    if (update_histogram (attacher, & target, budget) && (hist->progress.counter || attacher->coarseShift))
+                        cs->redraw = 1;
 
-            if (updateHistogram)
-            {
-                hist->dataRange.x0 = sw->dataRange.x0;
-                hist->dataRange.x1 = sw->dataRange.x1;
-                hist->dataRange.y0 = sw->dataRange.y0;
-                hist->dataRange.y1 = sw->dataRange.y1;
-                rotMatrix = & sw->rotMatrix; // FIXME: implement correctly
-                attacher->lastGraphCounter = attacher->histogramFun (hist, attacher->graph, sw->logMode, attacher->plotType, attacher->lastGraphCounter);
-                attacher->lastPlotType = attacher->plotType;
-            }
-            else
-            {
-                //foobar;
+                    bins = hist->bins;
+                    topRow = hist->topRow;
+                    if (hist->progress.counter && hist->progress.binned)
+                    {
+                        bins = scratch_bins (cs, subWidth * subHeight);
+                        progress_scaled_bins (hist, bins);
+                    }
+                }
             }
 
-            int *bins = hist->bins;
             uint32_t *colors = attacher->colorScheme->colors;
             uint32_t nLevels = attacher->colorScheme->nLevels;
 
@@ -3095,6 +6348,7 @@ static void plot_data (CipState *cs, uint32_t *pixels)
 
             for (uint32_t yi=0; yi<subHeight; yi++)
             {
+                const int *row = & bins[((yi + topRow) % subHeight) * subWidth];
                 for (uint32_t xi=0; xi<subWidth;  xi++)
                 {
                     uint32_t x = x0 + xi;
@@ -3120,7 +6374,7 @@ static void plot_data (CipState *cs, uint32_t *pixels)
                     }
 
                     uint32_t *pixel = & pixels[y*w + x];
-                    int cnt = bins[yi * subWidth + xi];
+                    int cnt = row[xi];
                     if (cs->crosshairEnabled && sw == cs->activeSw && (x == mousePosX || y == mousePosY))
                         *pixel = crossHairColor;
                     else if (cnt > 0)
@@ -3491,6 +6745,7 @@ static CipState *cip_init (void)
     cs->showHelp          = 0;
 
     cs->graphOrder        = 0;
+    cs->numThreads        = 1;
     cs->frameCounter      = 0;
     cs->pressedModifiers  = 0;
 
@@ -3502,6 +6757,7 @@ static CipState *cip_init (void)
     cs->mouseState = MOUSE_STATE_NONE;
 
     signal (SIGINT, signal_handler);
+    bin_kernels_init ();
 
     if (SDL_Init (SDL_INIT_VIDEO) < 0)
         exit_error ("SDL could not initialize! SDL Error: %s\n", SDL_GetError ());
@@ -3584,25 +6840,41 @@ static int cinterplot_run_until_quit (CipState *cs)
                  break;
             }
         }
+        double tsp = get_time ();
         if (redraw)
+        {
             cs->redraw = 1;
+            cs->lastInputTsp = tsp;
+        }
 
-        double tsp = get_time ();
         while (cs->stopped)
         {
             usleep (10000);
         }
-        if (cs->redraw && tsp - lastFrameTsp > periodTime)
+
+        // stale batches are flushed within the redrawing window too, which
+        // cinterplot_wait waits for before graphs are detached or deleted
+        cs->redrawing = 1;
+        if (flush_stale_staging (cs, tsp))
+            cs->redraw = 1;
+
+        if (atomic_exchange (& cs->published, 0))
+            cs->redraw = 1;
+
+        int drawn = cs->redraw && tsp - lastFrameTsp > periodTime;
+        if (drawn)
         {
             cs->redraw = 0;
-            cs->redrawing = 1;
             lastFrameTsp = tsp;
+            if (!cs->asyncHistograms)
+                release_view_caches (cs);
             update_image (cs, cs->texture, 0);
             SDL_RenderCopy (cs->renderer, cs->texture, NULL, NULL);
             SDL_RenderPresent (cs->renderer);
-            cs->redrawing = 0;
         }
-        else
+        cs->redrawing = 0;
+
+        if (!drawn)
             usleep (100);
     }
 
@@ -3611,6 +6883,10 @@ static int cinterplot_run_until_quit (CipState *cs)
 
 static void cinterplot_cleanup (CipState *cs)
 {
+    cip_set_async_histograms (cs, 0);
+    worker_pool_stop ();
+    free (cs->scratchBins);
+    cs->scratchBins = NULL;
     SDL_DestroyRenderer (cs->renderer);
     SDL_DestroyWindow (cs->window);
     SDL_Quit();
@@ -3732,6 +7008,8 @@ int main (int argc, char **argv)
     if (!cs)
         return 1;
 
+    cip_set_num_threads (cs, 0);
+
     UserData data = {argc, argv, cs};
     pthread_t userThread;
     if (pthread_create (& userThread, NULL, userMainCaller, & data))
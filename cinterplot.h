@@ -8,9 +8,12 @@ extern "C" {
 #include <stdatomic.h>
 #include <SDL2/SDL.h>
 #include "stream_buffer.h"
+#include "raster.h"
 
 #define INITIAL_VARIABLE_LENGTH 16384
-#define MAX_VARIABLE_LENGTH     16777216
+#define HUGE_SEGMENT_LENGTH     262144     // 2 MB of doubles
+#define FILE_SEGMENT_LENGTH     1048576
+#define MAX_VARIABLE_LENGTH     1073741824
 #define MAX_NUM_ATTACHED_GRAPHS 4096
 #define MAX_NUM_VERTICES        16
 #define CINTERPLOT_INIT_WIDTH   1000
@@ -24,12 +27,90 @@ typedef struct CipColorScheme
     uint32_t *colors;
 } CipColorScheme;
 
+// storage types for the axes of a graph
+enum {
+    CIP_STORE_DOUBLE,
+    CIP_STORE_FLOAT,
+    CIP_STORE_INT16, // INT16_MIN is stored for NaN
+    CIP_STORE_INT32, // INT32_MIN is stored for NaN
+    CIP_STORE_UINT8  // UINT8_MAX is stored for NaN
+};
+
+// Integer axes hold raw values, the plotted value is raw * scale + offset.
+// A scale of 0 is taken as 1.
+typedef struct CipAxisStorage
+{
+    uint32_t type;
+    double   scale;
+    double   offset;
+} CipAxisStorage;
+
+typedef struct CipGraphOptions
+{
+    CipAxisStorage axes[3]; // x, y and z, all doubles when zeroed
+    uint32_t hugePages : 1; // request transparent huge pages for large buffers
+    uint32_t columnar  : 1; // store x, y and z in separate rings instead of interleaved
+    uint32_t implicitX : 1; // uniformly sampled, x is not stored but x0 + dx * point number
+    uint32_t spatialIndex : 1; // keep a grid index of a 2D graph, for zoomed in point plots and region queries
+    double   x0;
+    double   dx;
+    const char *file;       // keep the points in this memory mapped file, reopened if it exists with the same axes.
+                            // It holds the last len points, at most 2^31, or MAX_VARIABLE_LENGTH (1G) for len 0
+    uint32_t stagingLen;    // points each producer thread batches up before publishing them, 0 (the default) disables
+    double   stagingMaxAge; // seconds a staged point may wait for its batch, 0 for the default
+    uint32_t rowWidth;      // store rows of this many samples instead of points, sample i at x0 + dx * i, see cip_graph_add_row
+} CipGraphOptions;
+
+// windows of spectrum graphs
+enum {
+    CIP_WINDOW_HANN,
+    CIP_WINDOW_RECTANGULAR,
+    CIP_WINDOW_HAMMING,
+    CIP_WINDOW_BLACKMAN
+};
+
+// A spectrum graph is a row graph of the amplitude spectra of the y values of
+// a graph of samples, a transform of fftSize samples every hop samples.
+typedef struct CipSpectrumOptions
+{
+    uint32_t fftSize;       // samples per transform, a power of two
+    uint32_t hop;           // samples from one transform to the next, fftSize when 0
+    uint32_t window;        // CIP_WINDOW_*, Hann when zeroed
+    uint32_t decibels : 1;  // 20 log10 of the amplitudes instead of the amplitudes
+    double   sampleRate;    // x of bin k is k * sampleRate / fftSize, k when 0
+} CipSpectrumOptions;
+
+struct CipStagingSlot;
+struct CipSpectrum;
+
 typedef struct CipGraph
 {
     StreamBuffer *sb;
     uint32_t len;
-    atomic_flag readAccess;
+    uint32_t dim;
     atomic_flag insertAccess;
+    uint32_t singleProducer : 1;
+    uint32_t columnar : 1;
+    uint32_t quantized : 1;    // some axis is not stored as double
+    uint32_t implicitX : 1;    // only y (and z) are stored, x of the n:th point is x0 + dx * (n-1)
+    uint32_t spatialIndex : 1;
+    double x0;
+    double dx;
+    CipAxisStorage axes[3];
+    size_t axisOffset[3];      // offset of each axis within a packed item
+    struct CipStagingSlot *staging; // per-thread batches of single point adds, NULL when disabled
+    uint32_t stagingLen;
+    double stagingMaxAge;
+    uint64_t xDisorder;        // points in view from this counter on have non-decreasing x, see graph_view_x_range
+    double lastX;              // x of the newest point, for keeping xDisorder up to date
+    atomic_flag logAccess;
+    struct CipLogCache *logCache; // log of the axes while some view is in log scale, NULL otherwise
+    atomic_flag lodAccess;
+    struct CipLineLod *lineLod;   // min/max summary while some view draws lines, NULL otherwise
+    atomic_flag gridAccess;
+    struct CipGridIndex *gridIndex; // of graphs with a spatial index, built on first use
+    uint32_t rowWidth;         // samples per row of a row graph, 0 for graphs of points
+    struct CipSpectrum *spectrum; // computes the rows of a spectrum graph, NULL otherwise
     char *name;
 } CipGraph;
 
@@ -47,6 +128,19 @@ typedef struct CipPosition
     double y;
 } CipPosition;
 
+// A rebuild of a histogram spread over several calls of its histogram
+// function, see cip_set_frame_budget
+typedef struct CipProgress
+{
+    double   budget;        // seconds the histogram function may spend, 0 for no limit, set by the caller
+    uint64_t counter;       // graph counter of the rebuild under way, 0 when there is none
+    uint64_t begin;         // counters of the points to bin
+    uint64_t end;
+    uint64_t binned;        // points binned so far
+    uint32_t slot;          // chunk slots done, chunks are binned in bit reversed order
+    uint32_t tracked;
+} CipProgress;
+
 typedef struct CipHistogram
 {
     CipArea dataRange;
@@ -57,10 +151,35 @@ typedef struct CipHistogram
     double (*xyzSums)[3];
     double *counts;
     double *sums;
+
+    // state of the last pass, for updating point plots incrementally
+    uint64_t firstCounter;  // first point of the graph in view
+    uint32_t generation;    // of the stream buffer, changes when the graph is reset
+    uint32_t logMode;
+    int32_t *pointBins;     // ring of the bin each point in view landed in, by counter
+    uint32_t pointBinsLen;
+    CipProgress progress;
+
+    // row of bins drawn at the top, waterfall histograms keep their rows as a
+    // ring and add new ones by moving it up
+    uint32_t topRow;
 } CipHistogram;
 
 typedef uint64_t (*HistogramFun) (CipHistogram *hist, CipGraph *graph, uint32_t logMode, char plotType, uint64_t lastGraphCounter);
 
+// what the histogram of an attacher is to be built for, taken from its sub
+// window each frame
+typedef struct CipHistogramTarget
+{
+    CipArea  dataRange;
+    uint32_t w;
+    uint32_t h;
+    uint32_t logMode;
+    uint32_t forceRefresh;
+    char     plotType;
+    double   rotMatrix[3][3];
+} CipHistogramTarget;
+
 typedef struct GraphAttacher
 {
     CipGraph *graph;
@@ -69,7 +188,18 @@ typedef struct GraphAttacher
     uint64_t     lastGraphCounter;
     char         plotType;
     char         lastPlotType;
+    uint32_t     lastLogMode;
+    double       buildTime;     // seconds the last full rebuild of hist took
+    uint32_t     coarseShift;   // a custom histogram shown at 1 / (1 << coarseShift) of its resolution, being refined
     HistogramFun histogramFun;
+
+    // with cip_set_async_histograms, hist is built by the builder thread for
+    // target, and copied to shown, which is what gets drawn
+    CipHistogramTarget target;
+    CipHistogram shown;
+    uint32_t     shownLogMode;
+    char         shownPlotType;
+    atomic_flag  asyncAccess;   // guards target and shown
 } GraphAttacher;
 
 typedef struct CipSubWindow
@@ -139,12 +269,25 @@ int  cip_force_refresh (CipState *cs);
 void cip_graph_set_name (CipGraph *graph, char *name);
 
 CipGraph *cip_graph_new (int dim, uint32_t len);
+CipGraph *cip_graph_new_ex (int dim, uint32_t len, const CipGraphOptions *options);
 void cip_graph_delete (CipGraph *graph);
 void cip_graph_add_2d_point (CipGraph *graph, double x, double y);
 void cip_graph_add_3d_point (CipGraph *graph, double x, double y, double z);
+void cip_graph_add_2d_points (CipGraph *graph, const double *xy, size_t n);
+void cip_graph_add_3d_points (CipGraph *graph, const double *xyz, size_t n);
+void cip_graph_add_raw_points (CipGraph *graph, const void *items, size_t n);
+void cip_graph_add_sample (CipGraph *graph, double y);
+void cip_graph_add_samples (CipGraph *graph, const double *values, size_t n);
+void cip_graph_add_row (CipGraph *graph, const float *row, uint32_t width);
+CipGraph *cip_graph_new_spectrum (CipGraph *samples, uint32_t nRows, const CipSpectrumOptions *options);
+void cip_graph_add_points_strided (CipGraph *graph, const void *base, size_t stride, size_t n,
+                                   size_t xOffset, size_t yOffset, size_t zOffset);
 GraphAttacher *cip_graph_attach (CipState *cs, CipGraph *graph, uint32_t windowIndex, HistogramFun histogramFun, char plotType, char *colorSpec, uint32_t numColors);
 int  cip_graph_detach (CipState *cs, CipGraph *graph, uint32_t windowIndex);
 void cip_graph_remove_points (CipGraph *graph);
+void cip_graph_set_single_producer (CipGraph *graph, uint32_t enabled);
+void cip_graph_flush (CipGraph *graph);
+uint32_t cip_graph_query_region (CipGraph *graph, const CipArea *area, double *xy, uint32_t maxPoints);
 
 int  cip_is_running (CipState *cs);
 int  cip_quit (CipState *cs);
@@ -155,6 +298,9 @@ CipSubWindow *cip_get_sub_window (CipState *cs, uint32_t windowIndex);
 void cip_set_bg_shade (CipState *cs, float bgShade);
 void cip_set_sub_window_title (CipState *cs, uint32_t windowIndex, char *title);
 int  cip_toggle_paused (CipState *cs);
+void cip_set_num_threads (CipState *cs, uint32_t numThreads);
+void cip_set_frame_budget (CipState *cs, double seconds);
+void cip_set_async_histograms (CipState *cs, uint32_t enabled);
 void cip_save_png (CipState* cs, char* imageDir, int frameCounter, int format);
 
 void cip_set_app_keyboard_callback (CipState *cs, int (*app_on_keyboard) (CipState *cs, int key, int mod, int pressed, int repeat));
@@ -33,13 +33,18 @@ int user_main (int argc, char **argv, CipState *cs)
     char plotType[6] = {'p','l','s','p','l','s'};
     for (int i=0; i<n; i++)
     {
+        // the graphs take turns on t, only y needs to be stored
+        CipGraphOptions options = {0};
+        options.implicitX = 1;
+        options.x0 = i;
+        options.dx = n + 1;
+
         cip_continuous_scroll_enable (cs, i);
-        sineGraph[i] = cip_graph_new (2, 1000000);
+        sineGraph[i] = cip_graph_new_ex (2, 1000000, & options);
         cip_graph_attach (cs, sineGraph[i], (uint32_t) i, NULL, plotType[i], colorSchemes[i % 6], 8);
     }
 
     double v = 0;
-    uint64_t t = 0;
     double a[n];
     bzero (a, sizeof (a));
 
@@ -57,10 +62,8 @@ int user_main (int argc, char **argv, CipState *cs)
             double f = 0.99;
             a[i] = f * a[i] + (1-f) * r[i] * 0.1;
             double y = a[i] * sin (2 * M_PI * v * a[i] * (i+1));
-            double x = (double) t++;
-            cip_graph_add_2d_point (sineGraph[i], x, y);
+            cip_graph_add_sample (sineGraph[i], y);
         }
-        t++;
         cip_redraw_async (cs);
     }
 
@@ -26,13 +26,16 @@ int user_main (int argc, char **argv, CipState *_cs)
     graphs[0] = cip_graph_new (2, nPoints);
     cip_graph_attach (cs, graphs[0], windowIndex++, NULL, 'p', "#ff4444 yellow", 4);
 
-    graphs[1] = cip_graph_new (2, 1000000);
+    // whole rows of samples at x = 0, 1/nPoints, 2/nPoints ...
+    CipGraphOptions rowOptions = {.rowWidth = nPoints, .x0 = 0, .dx = 1.0 / nPoints};
+    graphs[1] = cip_graph_new_ex (2, 1000, & rowOptions);
     //cip_graph_attach (cs, graphs[1], windowIndex++, NULL, 'w', "gold red black #4444ff cyan", 1000);
     cip_graph_attach (cs, graphs[1], windowIndex++, NULL, 'w', "black red yellow white", 1000);
 
     cip_set_x_range (cs, 0, 0, 1, 1);
     cip_set_y_range (cs, 0, -3, 3, 1);
 
+    float row[nPoints];
     double theta = 0;
     double y = 0;
     while (cip_is_running (cs))
@@ -44,14 +47,14 @@ int user_main (int argc, char **argv, CipState *_cs)
             y = 0.5 * y + 0.5 * z + y * (randf () * 2 - 1) * 0.1;
 
             cip_graph_add_2d_point (graphs[0], x, y);
-            cip_graph_add_2d_point (graphs[1], x, y);
+            row[ni] = (float) y;
         }
         theta += 0.0040303303;
         if (theta  > 2*M_PI)
             theta -= 2*M_PI;
 
         cip_graph_add_2d_point (graphs[0], NaN, NaN);
-        cip_graph_add_2d_point (graphs[1], NaN, NaN);
+        cip_graph_add_row (graphs[1], row, nPoints);
         CipSubWindow *sw0 = cip_get_sub_window (cs, 0);
         CipSubWindow *sw1 = cip_get_sub_window (cs, 1);
         sw1->logMode = sw0->logMode;
@@ -0,0 +1,146 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "fft.h"
+
+FftPlan *fft_plan_new (uint32_t n)
+{
+    if (n < 2 || (n & (n - 1)))
+        return NULL;
+
+    uint32_t m = n / 2;
+    uint32_t bits = 0;
+    while ((1u << bits) < m)
+        bits++;
+
+    FftPlan *plan = calloc (1, sizeof (*plan));
+    if (!plan)
+        return NULL;
+
+    plan->n = n;
+    plan->bitReverse   = calloc (m, sizeof (plan->bitReverse[0]));
+    plan->twiddles     = calloc (2 * m, sizeof (plan->twiddles[0]));
+    plan->realTwiddles = calloc (2 * (m + 1), sizeof (plan->realTwiddles[0]));
+    if (!plan->bitReverse || !plan->twiddles || !plan->realTwiddles)
+    {
+        fft_plan_delete (plan);
+        return NULL;
+    }
+
+    for (uint32_t j=0; j<m; j++)
+    {
+        uint32_t r = 0;
+        for (uint32_t b=0; b<bits; b++)
+            r |= ((j >> b) & 1) << (bits - 1 - b);
+        plan->bitReverse[j] = r;
+    }
+
+    // the ones of each pass after another, so that a pass reads them in order
+    for (uint32_t half=1; half<m; half*=2)
+    {
+        double *w = & plan->twiddles[2 * (half - 1)];
+        for (uint32_t k=0; k<half; k++)
+        {
+            w[2 * k]     =  cos (M_PI * k / half);
+            w[2 * k + 1] = -sin (M_PI * k / half);
+        }
+    }
+
+    for (uint32_t k=0; k<=m; k++)
+    {
+        plan->realTwiddles[2 * k]     =  cos (2 * M_PI * k / n);
+        plan->realTwiddles[2 * k + 1] = -sin (2 * M_PI * k / n);
+    }
+
+    return plan;
+}
+
+void fft_plan_delete (FftPlan *plan)
+{
+    if (!plan)
+        return;
+
+    free (plan->bitReverse);
+    free (plan->twiddles);
+    free (plan->realTwiddles);
+    free (plan);
+}
+
+// in place transform of the m complex values in z, real and imaginary parts interleaved
+static void fft_complex (const FftPlan *plan, double *z, uint32_t m)
+{
+    for (uint32_t j=0; j<m; j++)
+    {
+        uint32_t r = plan->bitReverse[j];
+        if (j < r)
+        {
+            double re = z[2 * j];
+            double im = z[2 * j + 1];
+            z[2 * j]     = z[2 * r];
+            z[2 * j + 1] = z[2 * r + 1];
+            z[2 * r]     = re;
+            z[2 * r + 1] = im;
+        }
+    }
+
+    // the first pass has no twiddles to multiply with
+    for (uint32_t i=0; i+1<m; i+=2)
+    {
+        double re = z[2 * i];
+        double im = z[2 * i + 1];
+        z[2 * i]     = re + z[2 * i + 2];
+        z[2 * i + 1] = im + z[2 * i + 3];
+        z[2 * i + 2] = re - z[2 * i + 2];
+        z[2 * i + 3] = im - z[2 * i + 3];
+    }
+
+    for (uint32_t half=2; half<m; half*=2)
+    {
+        const double *w = & plan->twiddles[2 * (half - 1)];
+        for (uint32_t i=0; i<m; i+=2*half)
+        {
+            double *a = & z[2 * i];
+            double *b = & z[2 * (i + half)];
+            for (uint32_t k=0; k<half; k++)
+            {
+                double wr = w[2 * k];
+                double wi = w[2 * k + 1];
+                double tr = b[2 * k] * wr - b[2 * k + 1] * wi;
+                double ti = b[2 * k] * wi + b[2 * k + 1] * wr;
+                b[2 * k]     = a[2 * k] - tr;
+                b[2 * k + 1] = a[2 * k + 1] - ti;
+                a[2 * k]     += tr;
+                a[2 * k + 1] += ti;
+            }
+        }
+    }
+}
+
+void fft_real (const FftPlan *plan, double *data, double *re, double *im)
+{
+    // the even values as the real parts and the odd ones as the imaginary
+    // parts of a transform of half the length, pulled apart again below
+    uint32_t m = plan->n / 2;
+    fft_complex (plan, data, m);
+
+    for (uint32_t k=0; k<=m; k++)
+    {
+        uint32_t k0 = k % m;
+        uint32_t k1 = (m - k) % m;
+        double a = data[2 * k0];
+        double b = data[2 * k0 + 1];
+        double c = data[2 * k1];
+        double d = data[2 * k1 + 1];
+
+        // transforms of the even and of the odd values
+        double evr = (a + c) / 2;
+        double evi = (b - d) / 2;
+        double odr = (b + d) / 2;
+        double odi = (c - a) / 2;
+
+        double wr = plan->realTwiddles[2 * k];
+        double wi = plan->realTwiddles[2 * k + 1];
+        re[k] = evr + wr * odr - wi * odi;
+        im[k] = evi + wr * odi + wi * odr;
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef _FFT_H_
+#define _FFT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+
+// Transforms of real sequences whose length is a power of two, computed as a
+// complex radix-2 transform of half the length. A plan holds the tables for
+// one length and is only read by the transforms, so threads can share it.
+typedef struct FftPlan
+{
+    uint32_t n;
+    uint32_t *bitReverse;    // of the n/2 point complex transform
+    double   *twiddles;      // cos and sin of -pi k / h, k < h, for each pass h = 1, 2, 4 ... < n/2
+    double   *realTwiddles;  // cos and sin of -2 pi k / n, k <= n/2
+} FftPlan;
+
+// plan for transforms of n points, NULL when n is not a power of two of at least 2
+FftPlan *fft_plan_new (uint32_t n);
+void fft_plan_delete (FftPlan *plan);
+
+// Bins 0 to n/2 of the discrete Fourier transform of the n real values in
+// data, sum x[j] exp (-2 pi i j k / n), to re and im. data is used as work
+// space and overwritten.
+void fft_real (const FftPlan *plan, double *data, double *re, double *im);
+
+#ifdef __cplusplus
+} /* end extern C */
+#endif
+
+#endif /* _FFT_H_ */
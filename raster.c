@@ -0,0 +1,367 @@
+#include <math.h>
+
+#include "raster.h"
+
+// Ends further than this outside of the grid are moved along the line to it
+// first, which keeps the stepping below within 64 bits.
+#define RASTER_MARGIN (1 << 24)
+
+// A line stepping t = 0..n along its major axis, p = p0 + dp * t, the minor
+// coordinate being m0 + t * dm / a rounded half up, which is
+// m0 + floor ((2 * t * dm + a) / (2 * a)). |dm| <= a.
+typedef struct RasterLine
+{
+    int64_t p0;
+    int64_t m0;
+    int64_t dp;
+    int64_t dm;
+    int64_t a;
+    int64_t n;
+    uint32_t xMajor;
+} RasterLine;
+
+// quotients rounded down, for positive divisors
+static int64_t floor_div (int64_t a, int64_t b)
+{
+    int64_t q = a / b;
+    return (a % b < 0) ? q - 1 : q;
+}
+
+static int64_t ceil_div (int64_t a, int64_t b)
+{
+    return -floor_div (-a, b);
+}
+
+static void line_setup (RasterLine *l, int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+{
+    int64_t dx = (int64_t) x1 - x0;
+    int64_t dy = (int64_t) y1 - y0;
+    int64_t xabs = dx < 0 ? -dx : dx;
+    int64_t yabs = dy < 0 ? -dy : dy;
+
+    if (xabs > yabs)
+    {
+        *l = (RasterLine) {x0, y0, dx < 0 ? -1 : 1, dy, xabs, xabs, 1};
+    }
+    else if (yabs > 0)
+    {
+        // as steep as it is wide goes by y
+        *l = (RasterLine) {y0, x0, dy < 0 ? -1 : 1, dx, yabs, yabs, 0};
+    }
+    else
+    {
+        // a single pixel
+        *l = (RasterLine) {x0, y0, 1, 0, 1, 0, 1};
+    }
+}
+
+// Range of t of the pixels with p in [plo, phi] and m in [mlo, mhi], returns 0
+// when there are none. The minor coordinate does not go backwards, so the
+// range is found by solving for its bounds.
+static int line_range (const RasterLine *l, int64_t plo, int64_t phi, int64_t mlo, int64_t mhi, int64_t *t0, int64_t *t1)
+{
+    int64_t lo = 0;
+    int64_t hi = l->n;
+    int64_t a  = l->a;
+
+    // the pixels are within the box of the ends, all of them when both are in
+    int64_t p1 = l->p0 + l->dp * l->n;
+    int64_t m1 = l->m0 + l->dm;
+    if (l->p0 >= plo && l->p0 <= phi && p1 >= plo && p1 <= phi &&
+        l->m0 >= mlo && l->m0 <= mhi && m1 >= mlo && m1 <= mhi)
+    {
+        *t0 = lo;
+        *t1 = hi;
+        return 1;
+    }
+
+    if (l->dp > 0)
+    {
+        lo = plo - l->p0 > lo ? plo - l->p0 : lo;
+        hi = phi - l->p0 < hi ? phi - l->p0 : hi;
+    }
+    else
+    {
+        lo = l->p0 - phi > lo ? l->p0 - phi : lo;
+        hi = l->p0 - plo < hi ? l->p0 - plo : hi;
+    }
+
+    if (l->dm > 0)
+    {
+        int64_t tlo = ceil_div (2 * a * (mlo - l->m0) - a, 2 * l->dm);
+        int64_t thi = floor_div (2 * a * (mhi - l->m0 + 1) - a - 1, 2 * l->dm);
+        lo = tlo > lo ? tlo : lo;
+        hi = thi < hi ? thi : hi;
+    }
+    else if (l->dm < 0)
+    {
+        int64_t tlo = floor_div (a - 2 * a * (mhi - l->m0 + 1), -2 * l->dm) + 1;
+        int64_t thi = floor_div (a - 2 * a * (mlo - l->m0), -2 * l->dm);
+        lo = tlo > lo ? tlo : lo;
+        hi = thi < hi ? thi : hi;
+    }
+    else if (l->m0 < mlo || l->m0 > mhi)
+    {
+        return 0;
+    }
+
+    *t0 = lo;
+    *t1 = hi;
+    return lo <= hi;
+}
+
+// Walks the line over t in [t0, t1], a Bresenham step at a time
+typedef struct LineWalk
+{
+    int64_t p;
+    int64_t m;
+    int64_t r;    // remainder of the minor coordinate, in [0, 2a)
+} LineWalk;
+
+static void walk_start (const RasterLine *l, int64_t t, LineWalk *wk)
+{
+    int64_t num = 2 * t * l->dm + l->a;
+    int64_t q = floor_div (num, 2 * l->a);
+    wk->p = l->p0 + l->dp * t;
+    wk->m = l->m0 + q;
+    wk->r = num - q * 2 * l->a;
+}
+
+static void walk_step (const RasterLine *l, LineWalk *wk)
+{
+    wk->p += l->dp;
+    wk->r += 2 * l->dm;
+    if (wk->r >= 2 * l->a)
+    {
+        wk->r -= 2 * l->a;
+        wk->m++;
+    }
+    else if (wk->r < 0)
+    {
+        wk->r += 2 * l->a;
+        wk->m--;
+    }
+}
+
+// moves ends far outside of the grid to RASTER_MARGIN, returns 0 when no part is left near it
+static int clip_far_ends (uint32_t w, uint32_t h, int32_t *x0, int32_t *y0, int32_t *x1, int32_t *y1)
+{
+    int64_t lo = -RASTER_MARGIN;
+    int64_t xhi = (int64_t) w + RASTER_MARGIN;
+    int64_t yhi = (int64_t) h + RASTER_MARGIN;
+    if (*x0 >= lo && *x0 <= xhi && *x1 >= lo && *x1 <= xhi &&
+        *y0 >= lo && *y0 <= yhi && *y1 >= lo && *y1 <= yhi)
+        return 1;
+
+    double xf0 = *x0;
+    double yf0 = *y0;
+    double xf1 = *x1;
+    double yf1 = *y1;
+    if (!raster_clip ((double) lo, (double) lo, (double) xhi, (double) yhi, & xf0, & yf0, & xf1, & yf1))
+        return 0;
+
+    *x0 = (int32_t) xf0;
+    *y0 = (int32_t) yf0;
+    *x1 = (int32_t) xf1;
+    *y1 = (int32_t) yf1;
+    return 1;
+}
+
+void raster_line (int *bins, uint32_t w, uint32_t h, int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+{
+    if (w == 0 || h == 0 || !clip_far_ends (w, h, & x0, & y0, & x1, & y1))
+        return;
+
+    RasterLine l;
+    line_setup (& l, x0, y0, x1, y1);
+
+    int64_t np = l.xMajor ? w : h;
+    int64_t nm = l.xMajor ? h : w;
+    int64_t ps = l.xMajor ? 1 : w;
+    int64_t ms = l.xMajor ? w : 1;
+
+    int64_t t0, t1;
+    if (!line_range (& l, 0, np - 1, 0, nm - 1, & t0, & t1))
+        return;
+
+    LineWalk wk;
+    walk_start (& l, t0, & wk);
+    for (int64_t t=t0; t<=t1; t++)
+    {
+        bins[wk.p * ps + wk.m * ms]++;
+        walk_step (& l, & wk);
+    }
+}
+
+// the pixels of a thick line at one step of its centre line, a plus sign
+static void thick_stamp (int *bins, int64_t np, int64_t nm, int64_t ps, int64_t ms, int64_t p, int64_t m, int checked)
+{
+    if (!checked)
+    {
+        int *bin = & bins[p * ps + m * ms];
+        bin[0]++;
+        bin[-ms]++;
+        bin[ms]++;
+        bin[-ps]++;
+        bin[ps]++;
+        return;
+    }
+
+    static const int dps[5] = {0,  0, 0, -1, 1};
+    static const int dms[5] = {0, -1, 1,  0, 0};
+    for (int i=0; i<5; i++)
+    {
+        int64_t pi = p + dps[i];
+        int64_t mi = m + dms[i];
+        if (pi >= 0 && pi < np && mi >= 0 && mi < nm)
+            bins[pi * ps + mi * ms]++;
+    }
+}
+
+void raster_thick_line (int *bins, uint32_t w, uint32_t h, int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+{
+    if (w == 0 || h == 0 || !clip_far_ends (w, h, & x0, & y0, & x1, & y1))
+        return;
+
+    RasterLine l;
+    line_setup (& l, x0, y0, x1, y1);
+
+    int64_t np = l.xMajor ? w : h;
+    int64_t nm = l.xMajor ? h : w;
+    int64_t ps = l.xMajor ? 1 : w;
+    int64_t ms = l.xMajor ? w : 1;
+
+    // steps with any of the stamp on the grid, and the ones with all of it
+    int64_t t0, t1, i0, i1;
+    if (!line_range (& l, -1, np, -1, nm, & t0, & t1))
+        return;
+    if (!line_range (& l, 1, np - 2, 1, nm - 2, & i0, & i1))
+    {
+        i0 = t1 + 1;
+        i1 = t1;
+    }
+
+    LineWalk wk;
+    walk_start (& l, t0, & wk);
+    for (int64_t t=t0; t<=t1; t++)
+    {
+        thick_stamp (bins, np, nm, ps, ms, wk.p, wk.m, t < i0 || t > i1);
+        walk_step (& l, & wk);
+    }
+}
+
+int raster_clip (double xmin, double ymin, double xmax, double ymax, double *x0, double *y0, double *x1, double *y1)
+{
+    if (!isfinite (*x0) || !isfinite (*y0) || !isfinite (*x1) || !isfinite (*y1))
+        return 0;
+
+    double dx = *x1 - *x0;
+    double dy = *y1 - *y0;
+    double p[4] = {-dx, dx, -dy, dy};
+    double q[4] = {*x0 - xmin, xmax - *x0, *y0 - ymin, ymax - *y0};
+    double u0 = 0;
+    double u1 = 1;
+
+    for (int i=0; i<4; i++)
+    {
+        if (p[i] == 0)
+        {
+            // parallel to the edge, and outside of it
+            if (q[i] < 0)
+                return 0;
+            continue;
+        }
+
+        double u = q[i] / p[i];
+        if (p[i] < 0)
+        {
+            if (u > u1)
+                return 0;
+            if (u > u0)
+                u0 = u;
+        }
+        else
+        {
+            if (u < u0)
+                return 0;
+            if (u < u1)
+                u1 = u;
+        }
+    }
+
+    // ends within the rectangle are left as they are
+    double xs = *x0;
+    double ys = *y0;
+    if (u1 < 1)
+    {
+        *x1 = xs + u1 * dx;
+        *y1 = ys + u1 * dy;
+    }
+    if (u0 > 0)
+    {
+        *x0 = xs + u0 * dx;
+        *y0 = ys + u0 * dy;
+    }
+    return 1;
+}
+
+void raster_segment (int *bins, uint32_t w, uint32_t h, double x0, double y0, double x1, double y1, int thick)
+{
+    double lo  = -RASTER_MARGIN;
+    double xhi = (double) w + RASTER_MARGIN;
+    double yhi = (double) h + RASTER_MARGIN;
+    int near = x0 >= lo && x0 <= xhi && x1 >= lo && x1 <= xhi &&
+               y0 >= lo && y0 <= yhi && y1 >= lo && y1 <= yhi;
+    if (!near && !raster_clip (lo, lo, xhi, yhi, & x0, & y0, & x1, & y1))
+        return;
+
+    if (thick)
+        raster_thick_line (bins, w, h, (int32_t) x0, (int32_t) y0, (int32_t) x1, (int32_t) y1);
+    else
+        raster_line (bins, w, h, (int32_t) x0, (int32_t) y0, (int32_t) x1, (int32_t) y1);
+}
+
+// adds weight to the pixels of column x from row y0 to row y1 that are on the grid
+static void add_column (int *bins, uint32_t w, uint32_t h, int64_t x, int64_t y0, int64_t y1, int weight)
+{
+    if (x < 0 || x >= w)
+        return;
+
+    if (y0 < 0)
+        y0 = 0;
+    if (y1 >= h)
+        y1 = h - 1;
+    for (int64_t y=y0; y<=y1; y++)
+        bins[y * w + x] += weight;
+}
+
+void raster_column (int *bins, uint32_t w, uint32_t h, double x, double y0, double y1, int thick, int weight)
+{
+    double lo  = -RASTER_MARGIN;
+    double yhi = (double) h + RASTER_MARGIN;
+    if (w == 0 || h == 0 || !(x >= lo && x <= (double) w + RASTER_MARGIN) || !isfinite (y0) || !isfinite (y1))
+        return;
+
+    if (y0 > y1)
+    {
+        double tmp = y0;
+        y0 = y1;
+        y1 = tmp;
+    }
+    if (y1 < lo || y0 > yhi)
+        return;
+
+    // truncated like raster_segment does with the clipped ends
+    int64_t xi = (int32_t) x;
+    int64_t r0 = (int32_t) (y0 < lo ? lo : y0);
+    int64_t r1 = (int32_t) (y1 > yhi ? yhi : y1);
+
+    add_column (bins, w, h, xi, r0, r1, weight);
+    if (thick)
+    {
+        add_column (bins, w, h, xi - 1, r0, r1, weight);
+        add_column (bins, w, h, xi + 1, r0, r1, weight);
+        add_column (bins, w, h, xi, r0 - 1, r1 - 1, weight);
+        add_column (bins, w, h, xi, r0 + 1, r1 + 1, weight);
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef _RASTER_H_
+#define _RASTER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+
+// Lines added to a w by h grid of counts, stored row by row, the pixels of a
+// line being those its x or y steps through (whichever changes most) with the
+// other coordinate rounded half up. Only the pixels on the grid are visited,
+// so a line costs what is seen of it however long it is.
+
+// Adds 1 to the pixels of the line from (x0, y0) to (x1, y1), both ends
+// included.
+void raster_line (int *bins, uint32_t w, uint32_t h, int32_t x0, int32_t y0, int32_t x1, int32_t y1);
+
+// Same for a line 3 pixels wide, counted as the line and the four lines moved
+// one pixel left, right, up and down would be.
+void raster_thick_line (int *bins, uint32_t w, uint32_t h, int32_t x0, int32_t y0, int32_t x1, int32_t y1);
+
+// Clips the segment from (x0, y0) to (x1, y1) to x in [xmin, xmax] and y in
+// [ymin, ymax], Liang-Barsky. Returns 0 when nothing is left of it, or one of
+// the ends is not finite.
+int raster_clip (double xmin, double ymin, double xmax, double ymax, double *x0, double *y0, double *x1, double *y1);
+
+// Adds a segment given in unrounded bin coordinates, the ends truncated
+// towards zero like bin coordinates are. It is clipped well outside of the
+// grid first, so far away ends do not overflow.
+void raster_segment (int *bins, uint32_t w, uint32_t h, double x0, double y0, double x1, double y1, int thick);
+
+// Adds weight to the pixels raster_segment adds 1 to for the vertical segment
+// from (x, y0) to (x, y1), for runs of segments drawn as one.
+void raster_column (int *bins, uint32_t w, uint32_t h, double x, double y0, double y1, int thick, int weight);
+
+#ifdef __cplusplus
+} /* end extern C */
+#endif
+
+#endif /* _RASTER_H_ */
@@ -1,12 +1,63 @@
+#ifdef __linux__
+#define _GNU_SOURCE // memfd_create
+#endif
+
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "cinterplot_common.h"
 #include "stream_buffer.h"
 
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+#define FILE_MAGIC   "CIPSTRM"
+#define FILE_VERSION 2
+
+// First page(s) of a file backed buffer, followed by the segment metadata and
+// then the segments, one slot of segmentLen items per segment, all columns of
+// the slot back-to-back.
+typedef struct
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t nColumns;
+    uint64_t columnSize[STREAM_BUFFER_MAX_COLUMNS];
+    uint32_t segmentLen;
+    uint32_t maxSegments;
+    uint64_t metaSize;
+    uint32_t nSegments;
+    uint32_t layoutSize;
+    uint64_t counter;        // items stored, written after the items themselves
+    uint8_t  layout[STREAM_BUFFER_MAX_LAYOUT]; // what the caller stores in the items, compared on reopening
+} FileHeader;
+
+#define FILE_META_OFFSET ((sizeof (FileHeader) + 63) & ~(size_t) 63)
+
+// entries the segment tables of a segmented buffer start with
+#define INITIAL_TABLE_LEN 16
+
+// a segment table or metadata array replaced by a larger one
+typedef struct StreamBufferTable
+{
+    void *table;
+    struct StreamBufferTable *next;
+} StreamBufferTable;
+
+static size_t round_up_to_page (size_t bytes)
+{
+    size_t pageSize = (size_t) sysconf (_SC_PAGESIZE);
+    return (bytes + pageSize - 1) / pageSize * pageSize;
+}
+
 static uint32_t next_power_of_two (uint32_t len)
 {
     if (len && !(len & (len - 1)))
@@ -22,111 +73,1023 @@ static uint32_t next_power_of_two (uint32_t len)
     return 1 << count;
 }
 
-StreamBuffer* stream_buffer_create (uint32_t requestedLen, size_t itemSize)
+#ifdef __linux__
+// Maps one physical copy of 'bytes' twice back-to-back, so that the ring can
+// be read as one contiguous chunk while every item is only written once.
+static void *map_mirrored (size_t bytes, uint32_t flags)
 {
-    StreamBuffer* sb = (StreamBuffer*) malloc (sizeof (StreamBuffer));
+    size_t pageSize = (size_t) sysconf (_SC_PAGESIZE);
+    if (bytes % pageSize)
+        return NULL;
+
+    int hugePages = (flags & STREAM_BUFFER_HUGE_PAGES) && bytes % HUGE_PAGE_SIZE == 0;
+    size_t align = hugePages ? HUGE_PAGE_SIZE : pageSize;
+
+    int fd = memfd_create ("stream_buffer", MFD_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    if (ftruncate (fd, (off_t) bytes) < 0)
+    {
+        close (fd);
+        return NULL;
+    }
+
+    // reserve address space for both halves, aligned for huge pages if asked for
+    size_t reserveBytes = 2 * bytes + align - pageSize;
+    uint8_t *reserved = mmap (NULL, reserveBytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reserved == MAP_FAILED)
+    {
+        close (fd);
+        return NULL;
+    }
+
+    uint8_t *addr = (uint8_t *) (((uintptr_t) reserved + align - 1) & ~(uintptr_t) (align - 1));
+    if (addr > reserved)
+        munmap (reserved, (size_t) (addr - reserved));
+    if (reserved + reserveBytes > addr + 2 * bytes)
+        munmap (addr + 2 * bytes, (size_t) (reserved + reserveBytes - (addr + 2 * bytes)));
+
+    void *lo = mmap (addr,         bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+    void *hi = mmap (addr + bytes, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+    close (fd);
+
+    if (lo != addr || hi != addr + bytes)
+    {
+        munmap (addr, 2 * bytes);
+        return NULL;
+    }
+
+    if (hugePages)
+        madvise (addr, 2 * bytes, MADV_HUGEPAGE);
+
+    return addr;
+}
+#endif
+
+static void alloc_storage (StreamBuffer *sb)
+{
+    sb->mirrored = 0;
+
+#ifdef __linux__
+    if (!(sb->flags & STREAM_BUFFER_NO_MIRROR))
+    {
+        uint32_t c;
+        for (c=0; c<sb->nColumns; c++)
+        {
+            sb->columnBuf[c] = map_mirrored (sb->columnSize[c] * sb->len, sb->flags);
+            if (!sb->columnBuf[c])
+                break;
+        }
+
+        if (c == sb->nColumns)
+        {
+            sb->mirrored = 1;
+            sb->buf = sb->columnBuf[0];
+            return;
+        }
+
+        // all or no columns are mirrored
+        while (c--)
+            munmap (sb->columnBuf[c], 2 * sb->columnSize[c] * sb->len);
+    }
+#endif
+
+    for (uint32_t c=0; c<sb->nColumns; c++)
+    {
+        // double buffered to continuously store data in two places,
+        // always getting a contigious chunk of data.
+        size_t bytes = 2 * sb->columnSize[c] * sb->len;
+        if ((sb->flags & STREAM_BUFFER_HUGE_PAGES) && bytes >= HUGE_PAGE_SIZE)
+        {
+            if (posix_memalign (& sb->columnBuf[c], HUGE_PAGE_SIZE, bytes))
+                sb->columnBuf[c] = NULL;
+#ifdef MADV_HUGEPAGE
+            else
+                madvise (sb->columnBuf[c], bytes, MADV_HUGEPAGE);
+#endif
+        }
+        else
+        {
+            sb->columnBuf[c] = malloc (bytes);
+        }
+        assert (sb->columnBuf[c]);
+    }
+    sb->buf = sb->columnBuf[0];
+}
+
+static void *alloc_segment (StreamBuffer *sb, uint32_t c)
+{
+    void *segment;
+    size_t bytes = sb->columnSize[c] * sb->segmentLen;
+    if ((sb->flags & STREAM_BUFFER_HUGE_PAGES) && bytes >= HUGE_PAGE_SIZE)
+    {
+        if (posix_memalign (& segment, HUGE_PAGE_SIZE, bytes))
+            segment = NULL;
+#ifdef MADV_HUGEPAGE
+        else
+            madvise (segment, bytes, MADV_HUGEPAGE);
+#endif
+    }
+    else
+    {
+        segment = malloc (bytes);
+    }
+    assert (segment);
+    return segment;
+}
+
+static void retire_table (StreamBuffer *sb, void *table)
+{
+    StreamBufferTable *retired = calloc (1, sizeof (*retired));
+    assert (retired);
+    retired->table = table;
+    retired->next  = sb->retiredTables;
+    sb->retiredTables = retired;
+}
+
+// Doubles the segment tables, and the metadata of an in memory buffer, until
+// they have an entry for 'slot'. Readers may still be looking at the old
+// ones, which are kept until the buffer is destroyed. Together they take
+// less than the tables in use.
+static void grow_tables (StreamBuffer *sb, uint32_t slot)
+{
+    if (slot < sb->tableLen)
+        return;
+
+    uint32_t newLen = sb->tableLen;
+    while (newLen <= slot)
+        newLen *= 2;
+
+    for (uint32_t c=0; c<sb->nColumns; c++)
+    {
+        void **table = calloc (newLen, sizeof (void*));
+        assert (table);
+        memcpy (table, sb->segments[c], sb->tableLen * sizeof (void*));
+        retire_table (sb, sb->segments[c]);
+        sb->segments[c] = table;
+        __atomic_store_n (& sb->storage->segments[c], table, __ATOMIC_RELEASE);
+    }
+
+    // the metadata of a file backed buffer is mapped from its header
+    if (sb->meta && !sb->fileHeader)
+    {
+        uint8_t *meta = calloc (newLen, sb->metaSize);
+        assert (meta);
+        memcpy (meta, sb->meta, sb->tableLen * sb->metaSize);
+        retire_table (sb, sb->meta);
+        sb->meta = meta;
+        __atomic_store_n (& sb->storage->meta, meta, __ATOMIC_RELEASE);
+    }
+
+    sb->tableLen = newLen;
+}
+
+// maps segment slot 'slot' of a file backed buffer, extending the file if needed
+static int map_file_segment (StreamBuffer *sb, uint32_t slot)
+{
+    off_t offset = (off_t) (sb->headerBytes + slot * sb->slotBytes);
+    struct stat st;
+    if (fstat (sb->fd, & st) < 0)
+        return -1;
+
+    if (st.st_size < offset + (off_t) sb->slotBytes &&
+        ftruncate (sb->fd, offset + (off_t) sb->slotBytes) < 0)
+        return -1;
+
+    uint8_t *base = mmap (NULL, sb->slotBytes, PROT_READ | PROT_WRITE, MAP_SHARED, sb->fd, offset);
+    if (base == MAP_FAILED)
+        return -1;
+
+    for (uint32_t c=0; c<sb->nColumns; c++)
+        sb->segments[c][slot] = base + sb->columnOffset[c] * sb->segmentLen;
+
+    return 0;
+}
+
+// Appends one segment to every column. The segment tables are published
+// before the new len, so readers that have seen it can use them without
+// locking.
+static void add_segment (StreamBuffer *sb)
+{
+    grow_tables (sb, sb->nSegments);
+
+    if (sb->fileHeader)
+    {
+        if (map_file_segment (sb, sb->nSegments) < 0)
+            exit_error ("could not grow file backed stream buffer: %s", strerror (errno));
+    }
+    else
+    {
+        for (uint32_t c=0; c<sb->nColumns; c++)
+            sb->segments[c][sb->nSegments] = alloc_segment (sb, c);
+    }
+
+    for (uint32_t c=0; c<sb->nColumns; c++)
+        sb->columnBuf[c] = sb->segments[c][0];
+    sb->buf = sb->columnBuf[0];
+    sb->nSegments++;
+    if (sb->fileHeader)
+        ((FileHeader *) sb->fileHeader)->nSegments = sb->nSegments;
+    sb->len = sb->nSegments * sb->segmentLen;
+    sb->storage->nSegments = sb->nSegments;
+    __atomic_store_n (& sb->storage->len, sb->len, __ATOMIC_RELEASE);
+}
+
+// makes room for n more items, as long as the buffer has fewer than maxSegments segments
+static void reserve_segments (StreamBuffer *sb, uint32_t n)
+{
+    while (sb->counter + n > sb->len && sb->nSegments < sb->maxSegments)
+        add_segment (sb);
+}
+
+// Records the memory the producer currently writes to, for the readers.
+static StreamBufferStorage *new_storage (StreamBuffer *sb)
+{
+    StreamBufferStorage *storage = calloc (1, sizeof (*storage));
+    assert (storage);
+
+    for (uint32_t c=0; c<sb->nColumns; c++)
+    {
+        storage->columnBuf[c] = sb->columnBuf[c];
+        storage->segments[c]  = sb->segments[c];
+    }
+    storage->meta      = sb->meta;
+    storage->len       = sb->len;
+    storage->nSegments = sb->nSegments;
+    storage->mirrored  = sb->mirrored;
+
+    return storage;
+}
+
+static void free_storage (StreamBuffer *sb, StreamBufferStorage *storage)
+{
+    if (sb->segmentLen)
+    {
+        if (sb->fileHeader)
+        {
+            // the columns of a slot share one mapping starting at column 0,
+            // the metadata lives in the file header
+            for (uint32_t i=0; i<storage->nSegments; i++)
+                munmap (storage->segments[0][i], sb->slotBytes);
+        }
+        else
+        {
+            for (uint32_t c=0; c<sb->nColumns; c++)
+                for (uint32_t i=0; i<storage->nSegments; i++)
+                    free (storage->segments[c][i]);
+            free (storage->meta);
+        }
+
+        for (uint32_t c=0; c<sb->nColumns; c++)
+            free (storage->segments[c]);
+    }
+    else
+    {
+        for (uint32_t c=0; c<sb->nColumns; c++)
+        {
+            if (storage->mirrored)
+                munmap (storage->columnBuf[c], 2 * sb->columnSize[c] * storage->len);
+            else
+                free (storage->columnBuf[c]);
+        }
+    }
+
+    free (storage);
+}
+
+static void lock_retired (StreamBuffer *sb)
+{
+    while (__atomic_exchange_n (& sb->retireLock, 1, __ATOMIC_ACQUIRE))
+        sched_yield ();
+}
+
+static void unlock_retired (StreamBuffer *sb)
+{
+    __atomic_store_n (& sb->retireLock, 0, __ATOMIC_RELEASE);
+}
+
+// Frees the replaced storage no reader can be using any more: the ones
+// retired before the epoch the oldest active reader entered.
+static void reclaim_storage (StreamBuffer *sb)
+{
+    uint64_t oldest = UINT64_MAX;
+    for (uint32_t r=0; r<STREAM_BUFFER_MAX_READERS; r++)
+    {
+        uint64_t epoch = __atomic_load_n (& sb->readerEpoch[r], __ATOMIC_SEQ_CST);
+        if (epoch && epoch < oldest)
+            oldest = epoch;
+    }
+
+    lock_retired (sb);
+    StreamBufferStorage **link = & sb->retired;
+    while (*link)
+    {
+        StreamBufferStorage *storage = *link;
+        if (storage->retiredEpoch < oldest)
+        {
+            *link = storage->nextRetired;
+            free_storage (sb, storage);
+        }
+        else
+        {
+            link = & storage->nextRetired;
+        }
+    }
+    unlock_retired (sb);
+}
+
+// Publishes the storage the producer has switched to, with 'counter' items
+// in it. Readers still using the old storage keep it until they leave their
+// epoch, their snapshots see it as it was when it got replaced.
+static void replace_storage (StreamBuffer *sb, uint64_t counter)
+{
+    // a reset before may already have invalidated all of it
+    StreamBufferStorage *old = sb->storage;
+    if (old->retiredPending < sb->pendingCounter)
+        __atomic_store_n (& old->retiredPending, sb->pendingCounter, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add (& sb->generation, 1, __ATOMIC_ACQ_REL);
+    __atomic_store_n (& sb->storage, new_storage (sb), __ATOMIC_SEQ_CST);
+    sb->pendingCounter = counter;
+    __atomic_store_n (& sb->counter, counter, __ATOMIC_RELEASE);
+    __atomic_fetch_add (& sb->generation, 1, __ATOMIC_RELEASE);
+
+    lock_retired (sb);
+    old->retiredEpoch = __atomic_fetch_add (& sb->epoch, 1, __ATOMIC_SEQ_CST);
+    old->nextRetired = sb->retired;
+    sb->retired = old;
+    unlock_retired (sb);
+
+    reclaim_storage (sb);
+}
+
+// Enters the current epoch, returns the reader slot to give to
+// stream_buffer_read_end. Storage replaced from now on is not freed before
+// the reader has left, so snapshots taken in between can be read safely.
+int stream_buffer_read_begin (StreamBuffer *sb)
+{
+    for (;;)
+    {
+        for (int r=0; r<STREAM_BUFFER_MAX_READERS; r++)
+        {
+            uint64_t expected = 0;
+            uint64_t epoch = __atomic_load_n (& sb->epoch, __ATOMIC_SEQ_CST);
+            if (__atomic_compare_exchange_n (& sb->readerEpoch[r], & expected, epoch, 0,
+                                             __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+                return r;
+        }
+        sched_yield ();
+    }
+}
+
+void stream_buffer_read_end (StreamBuffer *sb, int reader)
+{
+    assert (reader >= 0 && reader < STREAM_BUFFER_MAX_READERS);
+    __atomic_store_n (& sb->readerEpoch[reader], 0, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n (& sb->retired, __ATOMIC_ACQUIRE))
+        reclaim_storage (sb);
+}
+
+static StreamBuffer *create_common (uint32_t nColumns, const size_t *columnSizes, uint32_t flags)
+{
+    assert (nColumns >= 1 && nColumns <= STREAM_BUFFER_MAX_COLUMNS);
+
+    StreamBuffer* sb = (StreamBuffer*) calloc (1, sizeof (StreamBuffer));
     assert (sb);
 
-    sb->len      = next_power_of_two (requestedLen);
-    sb->itemSize = itemSize;
     sb->index    = 0;
     sb->counter  = 0;
+    sb->pendingCounter = 0;
+    sb->epoch    = 1; // reader slots hold 0 when free
+    sb->flags    = flags;
+    sb->nColumns = nColumns;
+    sb->itemSize = 0;
+    for (uint32_t c=0; c<nColumns; c++)
+    {
+        sb->columnOffset[c] = sb->itemSize;
+        sb->columnSize[c]   = columnSizes[c];
+        sb->itemSize       += columnSizes[c];
+    }
 
-    // double buffered to continuously store data in two places,
-    // always getting a contigious chunk of data.
-    size_t bytes = itemSize * sb->len * 2;
+    return sb;
+}
 
-    sb->buf = malloc (bytes);
-    assert (sb->buf);
+StreamBuffer* stream_buffer_create_columns (uint32_t requestedLen, uint32_t nColumns, const size_t *columnSizes, uint32_t flags)
+{
+    StreamBuffer *sb = create_common (nColumns, columnSizes, flags);
+    sb->len = next_power_of_two (requestedLen);
+    alloc_storage (sb);
+    sb->storage = new_storage (sb);
 
     return sb;
 }
 
-int stream_buffer_resize (StreamBuffer *sb, uint32_t newLen)
+static void init_segments (StreamBuffer *sb, uint32_t segmentLen, uint32_t maxLen, size_t metaSize)
 {
-    if (newLen == sb->len)
-        return 0;
+    // positions within the ring are 32 bit
+    assert (maxLen <= (1u << 31));
+
+    sb->segmentLen  = next_power_of_two (segmentLen);
+    sb->maxSegments = MAX (1, next_power_of_two (maxLen) / sb->segmentLen);
+    sb->tableLen    = MIN (sb->maxSegments, INITIAL_TABLE_LEN);
+    sb->metaSize    = metaSize;
+    while ((1u << sb->segmentShift) < sb->segmentLen)
+        sb->segmentShift++;
+
+    for (uint32_t c=0; c<sb->nColumns; c++)
+    {
+        sb->segments[c] = calloc (sb->tableLen, sizeof (void*));
+        assert (sb->segments[c]);
+    }
+}
+
+// A segmented buffer starts with one segment of segmentLen items and appends
+// segments as items are inserted, never moving the items already stored. Once
+// maxLen items are stored the oldest segment is reused, the buffer then
+// behaves like a ring of maxLen items, at most 2^31. Each segment has
+// metaSize bytes of zeroed metadata for the caller, see
+// stream_buffer_segment_meta.
+StreamBuffer* stream_buffer_create_segmented (uint32_t segmentLen, uint32_t maxLen, uint32_t nColumns, const size_t *columnSizes,
+                                              size_t metaSize, uint32_t flags)
+{
+    StreamBuffer *sb = create_common (nColumns, columnSizes, flags);
+    init_segments (sb, segmentLen, maxLen, metaSize);
+
+    if (metaSize)
+    {
+        sb->meta = calloc (sb->tableLen, metaSize);
+        assert (sb->meta);
+    }
+
+    sb->storage = new_storage (sb);
+    add_segment (sb);
+
+    return sb;
+}
+
+// A segmented buffer whose segments and metadata live in a memory mapped
+// file, so that it can be larger than memory and survives restarts. The
+// layout bytes describe what the caller stores in the items, e.g. the types
+// of its fields, they are kept in the header. An existing file is reopened
+// with its items and counter, it must have been created with the same
+// segment and column sizes and the same layout. Returns NULL if the file
+// can not be used. Like all segmented buffers it holds at most 2^31 items.
+StreamBuffer* stream_buffer_open_file (const char *path, uint32_t segmentLen, uint32_t maxLen, uint32_t nColumns,
+                                       const size_t *columnSizes, size_t metaSize,
+                                       const void *layout, size_t layoutSize, uint32_t flags)
+{
+    assert (layoutSize <= STREAM_BUFFER_MAX_LAYOUT);
+
+    StreamBuffer *sb = create_common (nColumns, columnSizes, flags);
+    init_segments (sb, segmentLen, maxLen, metaSize);
+
+    sb->slotBytes   = round_up_to_page (sb->segmentLen * sb->itemSize);
+    sb->headerBytes = round_up_to_page (FILE_META_OFFSET + sb->maxSegments * metaSize);
 
-    size_t bytes = sb->itemSize * newLen * 2;
-    void *newBuf = malloc (bytes);
-    assert (newBuf);
+    sb->fd = open (path, O_RDWR | O_CREAT, 0644);
+    if (sb->fd < 0)
+    {
+        print_error ("could not open %s: %s", path, strerror (errno));
+        for (uint32_t c=0; c<nColumns; c++)
+            free (sb->segments[c]);
+        free (sb);
+        return NULL;
+    }
 
+    struct stat st;
+    int fresh = fstat (sb->fd, & st) == 0 && st.st_size == 0;
+    if (fresh && ftruncate (sb->fd, (off_t) sb->headerBytes) < 0)
+    {
+        print_error ("could not grow %s: %s", path, strerror (errno));
+        close (sb->fd);
+        for (uint32_t c=0; c<nColumns; c++)
+            free (sb->segments[c]);
+        free (sb);
+        return NULL;
+    }
 
-    void* dst0 = newBuf;
-    void* dst1 = (void*) & ((uint8_t *) newBuf) [sb->itemSize * newLen];
+    FileHeader *header = MAP_FAILED;
+    if (fresh || st.st_size >= (off_t) sb->headerBytes)
+        header = mmap (NULL, sb->headerBytes, PROT_READ | PROT_WRITE, MAP_SHARED, sb->fd, 0);
 
-    uint32_t oldLen;
-    void *oldBuf;
-    stream_buffer_get (sb, & oldBuf, & oldLen);
-    uint32_t copyLen;
-    if (oldLen <= newLen)
+    if (header == MAP_FAILED)
     {
-        copyLen = oldLen;
-        // the content of old buffer fits into the new buffer. Copy everything.
-        memcpy (dst0, oldBuf, copyLen * sb->itemSize);
-        memcpy (dst1, oldBuf, copyLen * sb->itemSize);
+        print_error ("could not map %s", path);
+        close (sb->fd);
+        for (uint32_t c=0; c<nColumns; c++)
+            free (sb->segments[c]);
+        free (sb);
+        return NULL;
+    }
+
+    sb->fileHeader = header;
+    sb->meta = (uint8_t *) header + FILE_META_OFFSET;
+    sb->storage = new_storage (sb);
+
+    if (fresh)
+    {
+        memcpy (header->magic, FILE_MAGIC, sizeof (header->magic));
+        header->version     = FILE_VERSION;
+        header->nColumns    = nColumns;
+        header->segmentLen  = sb->segmentLen;
+        header->maxSegments = sb->maxSegments;
+        header->metaSize    = metaSize;
+        header->layoutSize  = (uint32_t) layoutSize;
+        for (uint32_t c=0; c<nColumns; c++)
+            header->columnSize[c] = sb->columnSize[c];
+        memcpy (header->layout, layout, layoutSize);
     }
     else
     {
-        // the content of old buffer is larger than the  new buffer. Copy the last
-        // data
-        copyLen = newLen;
-        void *src = (void*) & ((uint8_t *) oldBuf) [sb->itemSize * (oldLen - newLen)];
-        memcpy (dst0, src, newLen * sb->itemSize);
-        memcpy (dst1, src, newLen * sb->itemSize);
+        int compatible = memcmp (header->magic, FILE_MAGIC, sizeof (header->magic)) == 0 &&
+            header->version     == FILE_VERSION &&
+            header->nColumns    == nColumns &&
+            header->segmentLen  == sb->segmentLen &&
+            header->maxSegments == sb->maxSegments &&
+            header->metaSize    == metaSize &&
+            header->layoutSize  == layoutSize &&
+            memcmp (header->layout, layout, layoutSize) == 0 &&
+            header->nSegments   <= sb->maxSegments &&
+            st.st_size >= (off_t) (sb->headerBytes + header->nSegments * sb->slotBytes);
+        for (uint32_t c=0; c<nColumns; c++)
+            compatible = compatible && header->columnSize[c] == sb->columnSize[c];
+
+        if (!compatible)
+        {
+            print_error ("%s was not written with the same layout", path);
+            stream_buffer_destroy (sb);
+            return NULL;
+        }
+
+        for (uint32_t i=0; i<header->nSegments; i++)
+        {
+            grow_tables (sb, i);
+            if (map_file_segment (sb, i) < 0)
+            {
+                print_error ("could not map %s: %s", path, strerror (errno));
+                stream_buffer_destroy (sb);
+                return NULL;
+            }
+            sb->nSegments = sb->storage->nSegments = i + 1;
+        }
+        sb->len = sb->storage->len = sb->nSegments * sb->segmentLen;
+        sb->counter = sb->pendingCounter = header->counter;
     }
 
-    free (sb->buf);
-    sb->buf     = newBuf;
-    sb->len     = newLen;
-    sb->index   = copyLen;
-    sb->counter = copyLen;
+    if (sb->nSegments == 0)
+        add_segment (sb);
+
+    for (uint32_t c=0; c<nColumns; c++)
+        sb->columnBuf[c] = sb->segments[c][0];
+    sb->buf = sb->columnBuf[0];
+
+    return sb;
+}
+
+StreamBuffer* stream_buffer_create_ex (uint32_t requestedLen, size_t itemSize, uint32_t flags)
+{
+    return stream_buffer_create_columns (requestedLen, 1, & itemSize, flags);
+}
+
+StreamBuffer* stream_buffer_create (uint32_t requestedLen, size_t itemSize)
+{
+    return stream_buffer_create_ex (requestedLen, itemSize, 0);
+}
+
+// Writes n fields of column c, read with a stride of srcStride from src, to
+// the ring starting at index0. Both halves of the doubled ring get written
+// unless they are the same memory.
+static void write_column (StreamBuffer *sb, uint32_t c, uint32_t index0, const uint8_t *src, size_t srcStride, uint32_t n)
+{
+    size_t   cs  = sb->columnSize[c];
+    uint8_t *buf = (uint8_t *) sb->columnBuf[c];
+
+    if (srcStride == cs)
+    {
+        uint32_t nLower = MIN (n, sb->len - index0);
+        uint32_t nWrap  = n - nLower;
+
+        // as index0 + n <= 2 * len, the items land contiguously in the doubled
+        // buffer. The lower half is completed by the wrapped part and the upper
+        // half by the non-wrapped part.
+        memcpy (& buf[cs * index0], src, cs * n);
+        if (!sb->mirrored)
+        {
+            memcpy (& buf[cs * (index0 + sb->len)], src, cs * nLower);
+            if (nWrap)
+                memcpy (buf, & src[cs * nLower], cs * nWrap);
+        }
+    }
+    else
+    {
+        for (uint32_t i=0; i<n; i++, src += srcStride)
+        {
+            uint32_t index = index0 + i;
+            memcpy (& buf[cs * index], src, cs);
+            if (!sb->mirrored)
+                memcpy (& buf[cs * ((index + sb->len) & (2 * sb->len - 1))], src, cs);
+        }
+    }
+}
+
+// Writes n fields of column c of a segmented buffer, starting at the
+// position of the next item. Runs within a segment are copied in one go.
+static void write_segments (StreamBuffer *sb, uint32_t c, const uint8_t *src, size_t srcStride, uint32_t n)
+{
+    size_t   cs       = sb->columnSize[c];
+    uint64_t position = sb->counter;
+
+    while (n)
+    {
+        uint32_t offset = (uint32_t) position & (sb->segmentLen - 1);
+        uint32_t slot   = (uint32_t) (position >> sb->segmentShift) & (sb->maxSegments - 1);
+        uint32_t run    = MIN (n, sb->segmentLen - offset);
+        uint8_t *dst    = & ((uint8_t *) sb->segments[c][slot]) [cs * offset];
+
+        if (srcStride == cs)
+            memcpy (dst, src, cs * run);
+        else
+            for (uint32_t i=0; i<run; i++)
+                memcpy (& dst[cs * i], & src[srcStride * i], cs);
+
+        src      += srcStride * run;
+        position += run;
+        n        -= run;
+    }
+}
+
+// Replaces the ring of a buffer by one of newLen items, keeping the newest
+// items. Graphs no longer use it, unbounded ones are segmented and grow
+// without moving their items. It is kept for plain ring buffers, snapshots
+// taken before a resize stay readable thanks to the reader epochs.
+int stream_buffer_resize (StreamBuffer *sb, uint32_t newLen)
+{
+    if (newLen == sb->len)
+        return 0;
+
+    // segmented buffers grow by themselves
+    if (sb->segmentLen)
+        return -1;
+
+    StreamBufferSnapshot snap;
+    stream_buffer_get_snapshot (sb, & snap);
+
+    sb->len = newLen;
+    alloc_storage (sb);
+
+    // copy the last data if the content of the old buffer is larger than the
+    // new buffer
+    uint32_t copyLen = MIN (snap.len, newLen);
+    uint32_t skip    = snap.len - copyLen;
+
+    for (uint32_t c=0; c<sb->nColumns; c++)
+    {
+        const uint8_t *src = stream_buffer_snapshot_column (sb, & snap, c);
+        write_column (sb, c, 0, & src[sb->columnSize[c] * skip], sb->columnSize[c], copyLen);
+    }
+
+    sb->index = copyLen & (newLen - 1);
+    replace_storage (sb, copyLen);
     return 0;
 }
 
+// no reader may be left
 int stream_buffer_destroy (StreamBuffer* sb)
 {
-    free (sb->buf);
+    while (sb->retired)
+    {
+        StreamBufferStorage *storage = sb->retired;
+        sb->retired = storage->nextRetired;
+        free_storage (sb, storage);
+    }
+
+    if (sb->storage)
+        free_storage (sb, sb->storage);
+
+    while (sb->retiredTables)
+    {
+        StreamBufferTable *retired = sb->retiredTables;
+        sb->retiredTables = retired->next;
+        free (retired->table);
+        free (retired);
+    }
+
+    if (sb->fileHeader)
+    {
+        munmap (sb->fileHeader, sb->headerBytes);
+        close (sb->fd);
+    }
+
     free (sb);
     return 0;
 }
 
+// The storage is kept and refilled from the start. Readers don't need to be
+// waited for, the generation bump makes their snapshots count as overwritten.
 int stream_buffer_reset (StreamBuffer* sb)
 {
     assert (sb);
+    __atomic_store_n (& sb->storage->retiredPending, UINT64_MAX, __ATOMIC_RELAXED);
+    __atomic_fetch_add (& sb->generation, 1, __ATOMIC_ACQ_REL);
+
     sb->index   = 0;
-    sb->counter = 0;
+    sb->pendingCounter = 0;
+    __atomic_store_n (& sb->counter, 0, __ATOMIC_RELEASE);
+    if (sb->fileHeader)
+        ((FileHeader *) sb->fileHeader)->counter = 0;
 
+    __atomic_fetch_add (& sb->generation, 1, __ATOMIC_RELEASE);
     return 0;
 }
 
+// The producer announces which counter it is about to write up to before
+// touching the items, and publishes the new counter once they are written.
+// Readers never wait for the producer, they take a snapshot with
+// stream_buffer_get_snapshot and check afterwards with
+// stream_buffer_num_overwritten whether the oldest items were overwritten
+// while they were reading them, seqlock style.
+static inline void begin_write (StreamBuffer *sb, uint32_t n)
+{
+    // not below a counter stream_buffer_announce already went up to
+    uint64_t pending = MAX (sb->pendingCounter, sb->counter + n);
+    __atomic_store_n (& sb->pendingCounter, pending, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+}
+
+static inline void end_write (StreamBuffer *sb, uint32_t n)
+{
+    __atomic_store_n (& sb->counter, sb->counter + n, __ATOMIC_RELEASE);
+    if (sb->fileHeader)
+        ((FileHeader *) sb->fileHeader)->counter = sb->counter;
+}
+
+// Announces that the next n items are about to be inserted, for producers
+// that change what readers check along with the items, e.g. the segment
+// metadata, before inserting them. From now on readers count the items the
+// insert overwrites as overwritten.
+void stream_buffer_announce (StreamBuffer *sb, uint32_t n)
+{
+    begin_write (sb, n);
+}
+
 int stream_buffer_insert (StreamBuffer* sb, void* src)
 {
+    if (sb->segmentLen)
+        return stream_buffer_insert_n (sb, src, 1);
+
+    begin_write (sb, 1);
+
     uint32_t index0 = sb->index;
     uint32_t index1 = (index0 + sb->len) & (2 * sb->len - 1);
 
     //printf ("stream_buffer_insert: index0=%u, index1=%u  ", index0, index1);
 
-    void* dst0 = (void*) & ((uint8_t *) sb->buf) [sb->itemSize * index0];
-    void* dst1 = (void*) & ((uint8_t *) sb->buf) [sb->itemSize * index1];
+    for (uint32_t c=0; c<sb->nColumns; c++)
+    {
+        size_t cs = sb->columnSize[c];
+        void *field = & ((uint8_t *) src) [sb->columnOffset[c]];
+        void* dst0 = (void*) & ((uint8_t *) sb->columnBuf[c]) [cs * index0];
+        void* dst1 = (void*) & ((uint8_t *) sb->columnBuf[c]) [cs * index1];
 
-    memcpy (dst0, src, sb->itemSize);
-    memcpy (dst1, src, sb->itemSize);
+        memcpy (dst0, field, cs);
+        if (!sb->mirrored)
+            memcpy (dst1, field, cs);
+    }
 
     sb->index = (sb->index + 1) & (sb->len - 1);
-    sb->counter++;
+    end_write (sb, 1);
 
     return 0;
 }
 
+// only the last len items can survive, returns how many of the n items to
+// skip because they would be overwritten within the very same call
+static uint32_t skip_overflow (StreamBuffer *sb, uint32_t n)
+{
+    if (n <= sb->len)
+        return 0;
+
+    uint32_t skip = n - sb->len;
+    sb->index = (sb->index + skip) & (sb->len - 1);
+    begin_write (sb, skip);
+    end_write (sb, skip);
+    return skip;
+}
+
+int stream_buffer_insert_n (StreamBuffer* sb, const void* src, uint32_t n)
+{
+    if (n == 0)
+        return 0;
+
+    if (sb->segmentLen)
+        reserve_segments (sb, n);
+
+    uint32_t skip = skip_overflow (sb, n);
+    n -= skip;
+    const uint8_t *items = & ((const uint8_t *) src) [sb->itemSize * skip];
+
+    begin_write (sb, n);
+    for (uint32_t c=0; c<sb->nColumns; c++)
+    {
+        if (sb->segmentLen)
+            write_segments (sb, c, & items[sb->columnOffset[c]], sb->itemSize, n);
+        else
+            write_column (sb, c, sb->index, & items[sb->columnOffset[c]], sb->itemSize, n);
+    }
+    sb->index = (sb->index + n) & (sb->len - 1);
+    end_write (sb, n);
+
+    return 0;
+}
+
+int stream_buffer_insert_columns (StreamBuffer* sb, const void * const * columnSrcs, uint32_t n)
+{
+    if (n == 0)
+        return 0;
+
+    if (sb->segmentLen)
+        reserve_segments (sb, n);
+
+    uint32_t skip = skip_overflow (sb, n);
+    n -= skip;
+
+    begin_write (sb, n);
+    for (uint32_t c=0; c<sb->nColumns; c++)
+    {
+        const uint8_t *src = columnSrcs[c];
+        if (sb->segmentLen)
+            write_segments (sb, c, & src[sb->columnSize[c] * skip], sb->columnSize[c], n);
+        else
+            write_column (sb, c, sb->index, & src[sb->columnSize[c] * skip], sb->columnSize[c], n);
+    }
+    sb->index = (sb->index + n) & (sb->len - 1);
+    end_write (sb, n);
+
+    return 0;
+}
+
+int stream_buffer_get_snapshot (StreamBuffer *sb, StreamBufferSnapshot *snap)
+{
+    StreamBufferStorage *storage;
+    uint64_t counter;
+    uint32_t storageLen, generation;
+
+    // the storage and counter must belong together, retry if the producer
+    // was resetting or resizing meanwhile
+    for (;;)
+    {
+        generation = __atomic_load_n (& sb->generation, __ATOMIC_ACQUIRE);
+        storage    = __atomic_load_n (& sb->storage, __ATOMIC_SEQ_CST);
+        counter    = __atomic_load_n (& sb->counter, __ATOMIC_ACQUIRE);
+        storageLen = __atomic_load_n (& storage->len, __ATOMIC_ACQUIRE);
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+        if (!(generation & 1) && generation == __atomic_load_n (& sb->generation, __ATOMIC_RELAXED))
+            break;
+        sched_yield ();
+    }
+
+    uint32_t len = (uint32_t) MIN (counter, storageLen);
+    snap->storage    = storage;
+    snap->generation = generation;
+
+    if (sb->segmentLen)
+    {
+        uint32_t ringMask = sb->maxSegments * sb->segmentLen - 1;
+        snap->len     = len;
+        snap->start   = (uint32_t) (counter - len) & ringMask;
+        snap->counter = counter;
+
+        uint32_t n;
+        snap->buf = stream_buffer_snapshot_span (sb, snap, 0, 0, & n);
+        return 0;
+    }
+
+    uint32_t index   = (uint32_t) counter & (storageLen - 1);
+
+    uint32_t indexStop  = ((index - 1) & (storageLen - 1)) + storageLen;
+    uint32_t indexStart = indexStop - len + 1;
+
+    snap->buf     = (void*) & ((uint8_t *) storage->columnBuf[0]) [sb->columnSize[0] * indexStart];
+    snap->len     = len;
+    snap->start   = indexStart;
+    snap->counter = counter;
+
+    return 0;
+}
+
+void *stream_buffer_snapshot_column (StreamBuffer *sb, const StreamBufferSnapshot *snap, uint32_t column)
+{
+    assert (column < sb->nColumns);
+    assert (!sb->segmentLen); // not contiguous, use stream_buffer_snapshot_span
+    return (void*) & ((uint8_t *) snap->storage->columnBuf[column]) [sb->columnSize[column] * snap->start];
+}
+
+// Returns the field of column 'column' of the i:th item of the snapshot and
+// stores in *n how many items from there on are contiguous in memory: all of
+// the remaining ones for a single ring, the rest of the segment otherwise.
+void *stream_buffer_snapshot_span (StreamBuffer *sb, const StreamBufferSnapshot *snap, uint32_t column, uint32_t i, uint32_t *n)
+{
+    assert (column < sb->nColumns);
+    size_t cs = sb->columnSize[column];
+
+    if (!sb->segmentLen)
+    {
+        *n = snap->len - i;
+        return (void*) & ((uint8_t *) snap->storage->columnBuf[column]) [cs * (snap->start + i)];
+    }
+
+    uint32_t position = (snap->start + i) & (sb->maxSegments * sb->segmentLen - 1);
+    uint32_t offset   = position & (sb->segmentLen - 1);
+    uint32_t slot     = position >> sb->segmentShift;
+
+    // the producer may be replacing the table by a larger one
+    void **table = __atomic_load_n (& snap->storage->segments[column], __ATOMIC_ACQUIRE);
+
+    *n = MIN (snap->len - i, sb->segmentLen - offset);
+    return (void*) & ((uint8_t *) table[slot]) [cs * offset];
+}
+
+// Metadata of the segment holding the item at 'position', i.e. the item with
+// counter position + 1. For the producer, the segment may not be added yet.
+void *stream_buffer_segment_meta (StreamBuffer *sb, uint64_t position)
+{
+    if (!sb->meta)
+        return NULL;
+
+    uint32_t slot = (uint32_t) (position >> sb->segmentShift) & (sb->maxSegments - 1);
+    grow_tables (sb, slot);
+    return & sb->meta[sb->metaSize * slot];
+}
+
+// Metadata of the segment holding the i:th item of the snapshot, and in *n
+// how many items of the snapshot from there on are in that segment. Buffers
+// without metadata return NULL and all of the remaining items.
+void *stream_buffer_snapshot_meta (StreamBuffer *sb, const StreamBufferSnapshot *snap, uint32_t i, uint32_t *n)
+{
+    uint8_t *meta = __atomic_load_n (& snap->storage->meta, __ATOMIC_ACQUIRE);
+    if (!meta)
+    {
+        *n = snap->len - i;
+        return NULL;
+    }
+
+    uint32_t position = snap->start + i;
+    uint32_t slot = (position >> sb->segmentShift) & (sb->maxSegments - 1);
+    *n = MIN (snap->len - i, sb->segmentLen - (position & (sb->segmentLen - 1)));
+    return & meta[sb->metaSize * slot];
+}
+
+uint32_t stream_buffer_num_overwritten (StreamBuffer *sb, const StreamBufferSnapshot *snap)
+{
+    StreamBufferStorage *storage = snap->storage;
+    uint32_t generation = __atomic_load_n (& sb->generation, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    uint64_t pending = __atomic_load_n (& sb->pendingCounter, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+    // since a reset or resize the pending counter counts other items, the
+    // snapshot is as overwritten as it was by then
+    if (generation != snap->generation || generation != __atomic_load_n (& sb->generation, __ATOMIC_RELAXED))
+        pending = __atomic_load_n (& storage->retiredPending, __ATOMIC_RELAXED);
+
+    // the item with counter c shares slot with c + len, anything up to
+    // pending - len may have been destroyed by the producer
+    uint32_t len = __atomic_load_n (& storage->len, __ATOMIC_ACQUIRE);
+    uint64_t firstCounter = snap->counter - snap->len + 1;
+    if (pending < firstCounter + len)
+        return 0;
+
+    uint64_t n = pending - len - firstCounter + 1;
+    return (uint32_t) MIN (n, snap->len);
+}
+
 int stream_buffer_get (StreamBuffer *sb, void *_buf, uint32_t *len)
 {
     assert (_buf);
     void **buf = (void **) _buf;
-    *len = (uint32_t) MIN (sb->counter, sb->len);
-    uint32_t indexStop = ((sb->index - 1) & (sb->len - 1)) + sb->len;
-    uint32_t indexStart = indexStop - *len + 1;
-    *buf = (void*) & ((uint8_t *) sb->buf) [sb->itemSize * indexStart];
+
+    assert (!sb->segmentLen);
+
+    StreamBufferSnapshot snap;
+    stream_buffer_get_snapshot (sb, & snap);
+    *buf = snap.buf;
+    *len = snap.len;
+
+    return 0;
+}
+
+int stream_buffer_get_column (StreamBuffer *sb, uint32_t column, void *_buf, uint32_t *len)
+{
+    assert (_buf);
+    void **buf = (void **) _buf;
+
+    StreamBufferSnapshot snap;
+    stream_buffer_get_snapshot (sb, & snap);
+    *buf = stream_buffer_snapshot_column (sb, & snap, column);
+    *len = snap.len;
 
     return 0;
 }
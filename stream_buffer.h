@@ -8,20 +8,112 @@ extern "C" {
 #include <inttypes.h>
 #include <stddef.h>
 //#include "common.h"
+
+// flags for stream_buffer_create_ex
+#define STREAM_BUFFER_HUGE_PAGES 1 // ask for transparent huge pages on large buffers
+#define STREAM_BUFFER_NO_MIRROR  2 // always use the malloc'ed, doubly written buffer
+
+#define STREAM_BUFFER_MAX_COLUMNS 4
+#define STREAM_BUFFER_MAX_READERS 16
+#define STREAM_BUFFER_MAX_LAYOUT  128 // bytes of caller layout kept by file backed buffers
+
+// The memory readers of a snapshot touch. Resizing a buffer replaces it, the
+// old one is freed once no reader that may still use it is left in its
+// epoch, see stream_buffer_read_begin.
+typedef struct StreamBufferStorage
+{
+    void    *columnBuf[STREAM_BUFFER_MAX_COLUMNS];
+    void   **segments[STREAM_BUFFER_MAX_COLUMNS];
+    uint8_t *meta;
+    uint32_t len;            // ring length, grows with the segments of a segmented buffer
+    uint32_t nSegments;
+    uint32_t mirrored;
+    uint64_t retiredPending; // pending counter as of the last reset or replacement
+    uint64_t retiredEpoch;   // readers that entered up to this epoch may use the replaced storage
+    struct StreamBufferStorage *nextRetired;
+} StreamBufferStorage;
+
+// An item is made up of nColumns fields. A single column buffer stores whole
+// items interleaved, a multi column buffer keeps one ring per field, all
+// sharing the same counter. Items passed to the insert functions are always
+// packed, i.e. the fields back-to-back in column order.
 typedef struct
 {
-    void    *buf;
+    void    *buf;            // ring of column 0, all of the item for single column buffers
     uint32_t len;
     uint32_t index;
-    uint64_t counter;
-    size_t   itemSize;
+    uint64_t counter;        // published with release semantics after the items are written
+    uint64_t pendingCounter; // counter the producer is currently writing up to
+    size_t   itemSize;       // sum of the column sizes
+    uint32_t flags;
+    uint32_t mirrored;       // each ring is one physical copy mapped twice back-to-back
+    uint32_t nColumns;
+    size_t   columnSize[STREAM_BUFFER_MAX_COLUMNS];
+    size_t   columnOffset[STREAM_BUFFER_MAX_COLUMNS]; // offset of the field within a packed item
+    void    *columnBuf[STREAM_BUFFER_MAX_COLUMNS];
+    uint32_t segmentLen;     // items per segment of a segmented buffer, 0 for a single ring
+    uint32_t segmentShift;
+    uint32_t maxSegments;    // the buffer wraps at maxSegments * segmentLen items
+    uint32_t nSegments;      // segments allocated so far, len is nSegments * segmentLen
+    uint32_t tableLen;       // entries of the segment tables, doubled up to maxSegments as segments are added
+    void   **segments[STREAM_BUFFER_MAX_COLUMNS];
+    struct StreamBufferTable *retiredTables; // outgrown tables, readers may still use them
+    size_t   metaSize;       // bytes of caller metadata per segment
+    uint8_t *meta;
+    void    *fileHeader;     // mapped header of a file backed buffer, NULL otherwise
+    int      fd;
+    size_t   headerBytes;
+    size_t   slotBytes;
+    StreamBufferStorage *storage;   // published to the readers, see stream_buffer_get_snapshot
+    StreamBufferStorage *retired;   // replaced storage waiting for its readers to leave
+    uint32_t retireLock;
+    uint32_t generation;            // bumped around resets and resizes, odd while one is going on
+    uint64_t epoch;
+    uint64_t readerEpoch[STREAM_BUFFER_MAX_READERS]; // epoch each active reader entered, 0 if free
 } StreamBuffer;
 
+// Consistent view of the buffer taken by a reader, the newest item having
+// counter 'counter'. Items of a single ring are contiguous in memory starting
+// at buf, use stream_buffer_snapshot_column to get at the other columns.
+// Segmented buffers are read span by span with stream_buffer_snapshot_span,
+// which works for all buffers. A snapshot stays readable across resets and
+// resizes as long as it is taken and used between stream_buffer_read_begin
+// and stream_buffer_read_end, stream_buffer_num_overwritten tells whether
+// its items are still valid.
+typedef struct
+{
+    void    *buf;
+    uint32_t len;
+    uint32_t start;          // ring index of buf, position of the first item for segmented buffers
+    uint64_t counter;
+    StreamBufferStorage *storage;
+    uint32_t generation;
+} StreamBufferSnapshot;
+
 StreamBuffer* stream_buffer_create (uint32_t len, size_t itemSize);
+StreamBuffer* stream_buffer_create_ex (uint32_t len, size_t itemSize, uint32_t flags);
+StreamBuffer* stream_buffer_create_columns (uint32_t len, uint32_t nColumns, const size_t *columnSizes, uint32_t flags);
+StreamBuffer* stream_buffer_create_segmented (uint32_t segmentLen, uint32_t maxLen, uint32_t nColumns, const size_t *columnSizes,
+                                              size_t metaSize, uint32_t flags);
+StreamBuffer* stream_buffer_open_file (const char *path, uint32_t segmentLen, uint32_t maxLen, uint32_t nColumns,
+                                       const size_t *columnSizes, size_t metaSize,
+                                       const void *layout, size_t layoutSize, uint32_t flags);
 int stream_buffer_destroy (StreamBuffer* sb);
 int stream_buffer_insert (StreamBuffer* sb, void * src);
+int stream_buffer_insert_n (StreamBuffer* sb, const void * src, uint32_t n);
+int stream_buffer_insert_columns (StreamBuffer* sb, const void * const * columnSrcs, uint32_t n);
+void stream_buffer_announce (StreamBuffer *sb, uint32_t n);
 int stream_buffer_reset (StreamBuffer* sb);
 int stream_buffer_get (StreamBuffer* sb, void *buf, uint32_t* len);
+int stream_buffer_get_column (StreamBuffer* sb, uint32_t column, void *buf, uint32_t* len);
+int stream_buffer_read_begin (StreamBuffer *sb);
+void stream_buffer_read_end (StreamBuffer *sb, int reader);
+int stream_buffer_get_snapshot (StreamBuffer *sb, StreamBufferSnapshot *snap);
+void *stream_buffer_snapshot_column (StreamBuffer *sb, const StreamBufferSnapshot *snap, uint32_t column);
+void *stream_buffer_snapshot_span (StreamBuffer *sb, const StreamBufferSnapshot *snap, uint32_t column, uint32_t i, uint32_t *n);
+void *stream_buffer_segment_meta (StreamBuffer *sb, uint64_t position);
+void *stream_buffer_snapshot_meta (StreamBuffer *sb, const StreamBufferSnapshot *snap, uint32_t i, uint32_t *n);
+uint32_t stream_buffer_num_overwritten (StreamBuffer *sb, const StreamBufferSnapshot *snap);
 int stream_buffer_resize (StreamBuffer *sb, uint32_t newLen);
 int stream_buffer_counter_to_index (StreamBuffer* sb, uint64_t counter);
 uint64_t stream_buffer_index_to_counter (StreamBuffer* sb, uint32_t index);